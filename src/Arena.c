@@ -0,0 +1,234 @@
+#include <stdlib.h>
+
+#include "Arena.h"
+#include "Quit.h"
+
+// the alignment of every block handed out.
+#define ARENA_ALIGN 16
+// the size of each chunk that blocks of the size classes are carved from.
+#define ARENA_CHUNK_SIZE (4 * 1024 * 1024)
+
+// the block sizes handed out, each at most 1.5 times the one before, so
+//  rounding a request up wastes less than a third of its block.
+static const size_t class_sizes[] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072,
+  4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152, 65536
+};
+// the number of size classes.
+#define NUM_CLASSES ((int) (sizeof(class_sizes) / sizeof(class_sizes[0])))
+// the size of the largest class. larger blocks are malloc'ed directly.
+#define MAX_CLASS_SIZE 65536
+
+// the header in front of each chunk and each large block, which links it
+//  into the arena's lists. padded so the memory after it stays aligned.
+typedef union ArenaHeader ArenaHeader;
+union ArenaHeader {
+  struct {
+    ArenaHeader *prev;
+    ArenaHeader *next;
+    // the number of bytes after the header.
+    size_t size;
+  } links;
+  char padding[2 * ARENA_ALIGN];
+};
+
+// a freed block of a size class, linked into the free list of its class.
+typedef struct FreeBlock FreeBlock;
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+struct Arena {
+  // the chunks blocks of the size classes are carved from, linked by next.
+  ArenaHeader *chunks;
+  // the blocks too large for a size class, linked both ways so any one
+  //  can be freed on its own.
+  ArenaHeader *large;
+  // the unused end of the newest chunk, [bump, bump_end).
+  char *bump;
+  char *bump_end;
+  // the freed blocks of each size class.
+  FreeBlock *free_lists[NUM_CLASSES];
+  size_t bytes_used;
+  size_t bytes_reserved;
+};
+
+// Returns the index of the smallest size class holding size bytes.
+//  size must be at most MAX_CLASS_SIZE.
+static int Arena_ClassOf(size_t size) {
+  int class_idx = 0;
+  while (class_sizes[class_idx] < size) {
+    class_idx++;
+  }
+  return class_idx;
+}
+
+// Pushes block onto the free list of class class_idx.
+static void Arena_PushFree(Arena *arena, void *block, int class_idx) {
+  FreeBlock *free_block = block;
+  free_block->next = arena->free_lists[class_idx];
+  arena->free_lists[class_idx] = free_block;
+}
+
+// Splits what is left of the newest chunk into free blocks, so it isn't
+//  thrown away when blocks stop being carved from that chunk.
+static void Arena_RetireBump(Arena *arena) {
+  for (int i = NUM_CLASSES - 1; i >= 0; i--) {
+    while ((size_t) (arena->bump_end - arena->bump) >= class_sizes[i]) {
+      Arena_PushFree(arena, arena->bump, i);
+      arena->bump += class_sizes[i];
+    }
+  }
+}
+
+// Starts a new chunk to carve blocks from.
+static void Arena_NewChunk(Arena *arena) {
+  Arena_RetireBump(arena);
+
+  ArenaHeader *chunk = malloc(sizeof(ArenaHeader) + ARENA_CHUNK_SIZE);
+  if (chunk == NULL) {
+    quit("Arena_NewChunk");
+  }
+  chunk->links.size = ARENA_CHUNK_SIZE;
+  chunk->links.next = arena->chunks;
+  arena->chunks = chunk;
+  arena->bump = (char *) (chunk + 1);
+  arena->bump_end = arena->bump + ARENA_CHUNK_SIZE;
+  arena->bytes_reserved += sizeof(ArenaHeader) + ARENA_CHUNK_SIZE;
+}
+
+Arena *Arena_New(void) {
+  Arena *arena = calloc(1, sizeof(Arena));
+  if (arena == NULL) {
+    quit("Arena_New");
+  }
+  return arena;
+}
+
+void Arena_Destroy(Arena *arena) {
+  if (arena == NULL) {
+    return;
+  }
+  ArenaHeader *next;
+  for (ArenaHeader *chunk = arena->chunks; chunk != NULL; chunk = next) {
+    next = chunk->links.next;
+    free(chunk);
+  }
+  for (ArenaHeader *block = arena->large; block != NULL; block = next) {
+    next = block->links.next;
+    free(block);
+  }
+  free(arena);
+}
+
+void Arena_Merge(Arena *arena, Arena *other) {
+  Arena_RetireBump(other);
+  // other's lists are short compared to the blocks in them, so they are
+  //  walked to their tail and put in front of arena's.
+  if (other->chunks != NULL) {
+    ArenaHeader *tail = other->chunks;
+    while (tail->links.next != NULL) {
+      tail = tail->links.next;
+    }
+    tail->links.next = arena->chunks;
+    arena->chunks = other->chunks;
+  }
+  if (other->large != NULL) {
+    ArenaHeader *tail = other->large;
+    while (tail->links.next != NULL) {
+      tail = tail->links.next;
+    }
+    tail->links.next = arena->large;
+    if (arena->large != NULL) {
+      arena->large->links.prev = tail;
+    }
+    arena->large = other->large;
+  }
+  for (int i = 0; i < NUM_CLASSES; i++) {
+    if (other->free_lists[i] != NULL) {
+      FreeBlock *tail = other->free_lists[i];
+      while (tail->next != NULL) {
+        tail = tail->next;
+      }
+      tail->next = arena->free_lists[i];
+      arena->free_lists[i] = other->free_lists[i];
+    }
+  }
+  arena->bytes_used += other->bytes_used;
+  arena->bytes_reserved += other->bytes_reserved;
+  free(other);
+}
+
+size_t Arena_RoundUp(size_t size) {
+  if (size > MAX_CLASS_SIZE) {
+    return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  }
+  return class_sizes[Arena_ClassOf(size)];
+}
+
+void *Arena_Alloc(Arena *arena, size_t size) {
+  size = Arena_RoundUp(size);
+  arena->bytes_used += size;
+
+  if (size > MAX_CLASS_SIZE) {
+    // too large for a size class, so give the block its own allocation.
+    ArenaHeader *block = malloc(sizeof(ArenaHeader) + size);
+    if (block == NULL) {
+      quit("Arena_Alloc");
+    }
+    block->links.size = size;
+    block->links.prev = NULL;
+    block->links.next = arena->large;
+    if (arena->large != NULL) {
+      arena->large->links.prev = block;
+    }
+    arena->large = block;
+    arena->bytes_reserved += sizeof(ArenaHeader) + size;
+    return block + 1;
+  }
+
+  // reuse a freed block of the same class if there is one.
+  int class_idx = Arena_ClassOf(size);
+  FreeBlock *free_block = arena->free_lists[class_idx];
+  if (free_block != NULL) {
+    arena->free_lists[class_idx] = free_block->next;
+    return free_block;
+  }
+
+  if ((size_t) (arena->bump_end - arena->bump) < size) {
+    Arena_NewChunk(arena);
+  }
+  void *block = arena->bump;
+  arena->bump += size;
+  return block;
+}
+
+void Arena_Free(Arena *arena, void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+  size = Arena_RoundUp(size);
+  arena->bytes_used -= size;
+
+  if (size > MAX_CLASS_SIZE) {
+    // unlink the block from the list of large blocks and free it.
+    ArenaHeader *block = (ArenaHeader *) ptr - 1;
+    if (block->links.prev != NULL) {
+      block->links.prev->links.next = block->links.next;
+    } else {
+      arena->large = block->links.next;
+    }
+    if (block->links.next != NULL) {
+      block->links.next->links.prev = block->links.prev;
+    }
+    arena->bytes_reserved -= sizeof(ArenaHeader) + size;
+    free(block);
+    return;
+  }
+  Arena_PushFree(arena, ptr, Arena_ClassOf(size));
+}
+
+void Arena_GetStats(Arena *arena, ArenaStats *stats) {
+  stats->bytes_used = arena->bytes_used;
+  stats->bytes_reserved = arena->bytes_reserved;
+}
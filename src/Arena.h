@@ -0,0 +1,53 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+// A slab allocator for the many small, similar blocks that make up an
+//  open file (lines, display lines and the nodes holding them). Blocks
+//  are rounded up to one of a few size classes and carved out of large
+//  chunks; freed blocks are kept on a list per class for reuse. Blocks
+//  larger than the biggest class are malloc'ed one by one. Everything
+//  is released at once by Arena_Destroy. An arena must only be used by
+//  one thread at a time.
+
+#include <stddef.h>  // for size_t
+
+typedef struct Arena Arena;
+
+// memory use of an arena, in bytes.
+typedef struct {
+  // the size of all blocks handed out and not freed yet.
+  size_t bytes_used;
+  // the size of all memory the arena holds from malloc.
+  size_t bytes_reserved;
+} ArenaStats;
+
+// Returns a new, empty arena. Calls quit on allocation failure.
+Arena *Arena_New(void);
+
+// Frees every block of the arena and the arena itself. Does nothing if
+//  arena is NULL.
+void Arena_Destroy(Arena *arena);
+
+// Moves every block of other into arena, so they are freed along with
+//  it, and frees other. Blocks of other may then be freed to arena.
+//  Used to gather the blocks allocated by threads that each had their
+//  own arena.
+void Arena_Merge(Arena *arena, Arena *other);
+
+// Returns the size of the block that would be handed out for a request
+//  of size bytes. Callers with growing buffers use this as their
+//  capacity, so the rounding is not wasted.
+size_t Arena_RoundUp(size_t size);
+
+// Returns a block of at least size bytes, aligned for any of the types
+//  kept in an arena. Calls quit on allocation failure.
+void *Arena_Alloc(Arena *arena, size_t size);
+
+// Returns the block ptr, which was allocated with the given size, to
+//  arena for reuse. Does nothing if ptr is NULL.
+void Arena_Free(Arena *arena, void *ptr, size_t size);
+
+// Sets stats to the current memory use of arena.
+void Arena_GetStats(Arena *arena, ArenaStats *stats);
+
+#endif  // ARENA_H_
@@ -25,11 +25,32 @@
 #define ORIGIN "1;1"
 #define ESC_CMD_MOVE(pos) (ESC_SEQ pos "H")
 
+// the lines from row top to row bottom (1 indexed) form the scroll
+//  region, set with ESC_SEQ "top;bottom" SCROLL_REGION. a line feed on
+//  the region's last row scrolls only the region up, and a reverse index
+//  on its first row scrolls it down. setting or resetting the region
+//  moves the cursor to the origin.
+#define SCROLL_REGION "r"
+// reset the scroll region to the whole screen.
+#define ESC_CMD_SCROLL_RESET (ESC_SEQ SCROLL_REGION)
+// move the cursor up a line, scrolling down if it is on the first row.
+#define ESC_CMD_REVERSE_INDEX "\x1bM"
+
 // hide or show the cursor.
 #define HIDE "l"
 #define SHOW "h"
 // pass HIDE or SHOW to hide or show cursor.
 #define ESC_CMD_CUR_MODE(m) (ESC_SEQ "?25" m)
+// pass SHOW to turn on bracketed paste mode, in which the terminal sends
+//  pasted text between ESC[200~ and ESC[201~, or HIDE to turn it off.
+#define ESC_CMD_PASTE_MODE(m) (ESC_SEQ "?2004" m)
+// ask the terminal for its status (DSR). it answers ESC[0n once it has
+//  processed everything written before the request.
+#define ESC_CMD_STATUS_REPORT (ESC_SEQ "5n")
+// pass SHOW to begin a synchronized update, during which the terminal
+//  holds off showing what is written, or HIDE to end it and show it all
+//  at once. terminals without the mode ignore it.
+#define ESC_CMD_SYNC_MODE(m) (ESC_SEQ "?2026" m)
 
 // set the text format to use inverted colors
 #define INVERT "7"
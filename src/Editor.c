@@ -8,7 +8,6 @@
 #include <stdio.h>
 #include <sys/types.h>  // for ssize_t
 
-#include <time.h>  // for time_t
 #include <stdarg.h>  // for varidic args
 
 #include <unistd.h>  // for exec
@@ -16,15 +15,22 @@
 #include <stdbool.h>  // for boolean type
 
 #include <ctype.h>  // for iscntrl
+#include <signal.h>  // for SIGWINCH
+#include <limits.h>  // for INT_MAX
 
 #include "Editor.h"
 #include "TerminalUtils.h"
 #include "Keyboard.h"
+#include "EventLoop.h"
 #include "WriteBuffer.h"
 #include "ESCCommands.h"
 #include "FileParser.h"
 #include "Quit.h"
+#include "Screen.h"
+#include "OutputPacer.h"
+#include "Search.h"
 #include "SyntaxHL.h"
+#include "TabScan.h"
 
 // --- INTERNAL MACRO CONTANTS --- //
 
@@ -32,16 +38,24 @@
 #define BUF_SIZE_WEL 64
 // the size of the status bar buffer.
 #define BUF_SIZE_STATUS 64
-// the size of an esc cursor move command buffer.
-#define BUF_SIZE_MV 32
 // the size of the command message buffer.
 #define BUF_SIZE_CMD_MSG 64
+// the most characters of the last query shown in the find prompt.
+#define FIND_DEFAULT_SHOWN 16
 // the size of the input buffer for reading response from a prompt.
 #define BUF_SIZE_RESPONSE 256
-// the size of a text color command sequence buffer.
-#define BUF_SIZE_COLOR 16
 // the timeout to display a new message in seconds.
 #define MSG_TIMEOUT 5
+// how long to wait before drawing a frame that was put off, in
+//  milliseconds.
+#define FRAME_RETRY_MS 50
+// once the wrap width changes, the rows of WRAP_COUNT_LINES more lines
+//  are counted at it every WRAP_COUNT_MS milliseconds.
+#define WRAP_COUNT_MS 10
+#define WRAP_COUNT_LINES (32 * 1024)
+// how long to wait at exit for the terminal to show the last frames, in
+//  milliseconds.
+#define CLOSE_DRAIN_MS 200
 // the char after which alphabet characters are coded. i.e.,
 //  chars > '@' begin the capital alphabet chars in ASCII.
 #define ALPHA_OFFSET_CHAR '@'
@@ -50,9 +64,6 @@
 // the current ctek version.
 #define VERSION "1.0"
 
-// in raw mode, terminal does not automatically convert \n to \r\n,
-//  so this is used to represent newline characters.
-#define NL "\r\n"
 // the character that appears on the left of an empty line.
 #define EMPTY_LN_CHAR ">"
 
@@ -60,8 +71,6 @@
 // sets highest 3 bits to 0 (i.e., 0x1F == 0b00011111).
 #define CHAR_TO_CTRL(key) ((key) & 0x1F)
 
-// the string form of a single space.
-#define SPACE " "
 
 // --- INTERNAL STATE STRUCTURES --- //
 
@@ -94,21 +103,62 @@ typedef struct {
   // the current line number of the file being shown
   //  (indexed from top of file).
   int cur_file_row;
-  // current column offset into the file.
+  // true if long lines are soft-wrapped onto as many rows as they take,
+  //  rather than scrolled horizontally.
+  bool is_wrapped;
+  // when wrapped, the row of the line cur_file_row shown at the top.
+  int cur_wrap_row;
+  // the top row of text of the last frame drawn (see Editor_TopRow).
+  long shown_row;
+  // current column offset into the file. always 0 when wrapped.
   int cur_file_col;
-  // a pointer to an array of FileLines for text lines from the file.
-  FileLine *file_lines;
+  // the FileLines for text lines from the file. NULL until the first
+  //  line is read or typed.
+  FileLines *file_lines;
   // an index into the lind_display of the current FileLine.
   int ld_idx;
   // a message to display to the user about commands.
   char msg_line[BUF_SIZE_CMD_MSG];
   // 
-  time_t msg_time;
+  // the id of the timer that hides the message, or 0.
+  int msg_timer;
+  // the id of the timer that draws a frame that was put off, or 0.
+  int frame_timer;
+  // the id of the timer that counts the rows of more lines at the wrap
+  //  width, or 0.
+  int wrap_timer;
   // true if the editor has changed some text that has not
   //  been saved in the file; false otherwise.
   bool is_edited;
   // syntax information about the open file.
   Syntax *syntax;
+  // true while the find prompt is open.
+  bool is_finding;
+  // where the cursor was when the find prompt was opened; the first
+  //  match shown for a query is the one after it.
+  Cursor find_origin;
+  // the query of the last search, searched for again while nothing is
+  //  typed in the find prompt, or NULL.
+  char *find_default;
+  // true if find takes the query as a regular expression (see Regex.h).
+  //  toggled with CTRL-R in the find prompt, and kept for the next one.
+  bool find_regex;
+  // the find prompt, which shows whether find_regex is set.
+  char find_prompt[BUF_SIZE_CMD_MSG];
+  // which match from find_origin is shown once the search is done: 1 for
+  //  the one after it, -1 for the one before, 0 for the one at it or
+  //  after.
+  int find_direction;
+  // the index of the match shown (see Search_GetMatch), or -1 if none.
+  int find_match;
+  // the index of the line whose highlighting marks the match shown, and
+  //  its highlighting from before, to put back. NULL if no match is
+  //  marked.
+  int marked_row;
+  HLSpans *marked_highlight;
+  // the commands that draw a frame. kept between frames, so its
+  //  allocation only grows for the largest frame.
+  Buffer write_buf;
 } EditorState;
 
 static EditorState e_state;
@@ -116,20 +166,52 @@ static EditorState e_state;
 // --- STATIC HELPER FUNCTION DECLARATIONS --- //
 
 // draw rows of text.
-static void Editor_RenderRows(Buffer *wbuf);
-// Append the welcome message to the write buffer.
-static void Editor_RenderWelcome(Buffer *wbuf);
+static void Editor_RenderRows(void);
+// Draw the welcome message on screen row y.
+static void Editor_RenderWelcome(int y);
 // move the cursor in accordance with which key was pressed.
 static void Editor_MoveCursor(int key);
+// move the cursor left to the end of its line if it is past it.
+static void Editor_SnapCursor(void);
 // adjust the cur_file_row according to the new cursor location.
 static void Editor_Scroll(void);
+// Returns the row of the file shown at the top of the screen: a line
+//  index, or a wrapped row (see File_LineRow) when wrapped.
+static long Editor_TopRow(void);
+// Returns the row of the file the cursor is on, counted as in
+//  Editor_TopRow.
+static long Editor_CursorRow(void);
+// Shows row of the file, counted as in Editor_TopRow, at the top of the
+//  screen.
+static void Editor_SetTopRow(long row);
+// turns soft-wrapping of long lines on or off.
+static void Editor_ToggleWrap(void);
 // 
-static void Editor_RenderStatusBar(Buffer *wbuf);
+static void Editor_RenderStatusBar(void);
 // returns the smaller of the two numbers.
 static int min(int a, int b);
-static void Editor_RenderMessageLine(Buffer *wbuf);
+static void Editor_RenderMessageLine(void);
+// hides the message once it is MSG_TIMEOUT seconds old.
+static void Editor_ExpireMsg(void *arg);
+// draws a frame FRAME_RETRY_MS from now, for what was put off.
+static void Editor_DeferFrame(void);
+// draws the frame that was put off.
+static void Editor_DrawDeferred(void *arg);
+// counts the rows of the lines at the wrap width a few at a time, from
+//  WRAP_COUNT_MS from now, once the width changed.
+static void Editor_CountRowsLater(void);
+// counts the rows of WRAP_COUNT_LINES more lines at the wrap width.
+static void Editor_CountSomeRows(void *arg);
+// sets the size of the terminal the editor is drawn in.
+static void Editor_SetSize(int num_rows, int num_cols);
+// reads the size of the terminal again after it was resized, and draws
+//  the editor in it. called by the event loop on SIGWINCH.
+static void Editor_Resize(void *arg);
 
 static void Editor_InsertChar(char new_char);
+// Inserts the text the user pasted at the cursor, and moves the cursor
+//  after it.
+static void Editor_Paste();
 static void Editor_Save();
 // Removes 1 char from the current line to the left of the cursor. Does
 //  nothing if on an empty line, or no char exists to the left of the cursor.
@@ -141,9 +223,30 @@ static void Editor_SplitLine();
 typedef void (*AwaitPromptFn)(char *, int);
 static void Editor_FindCallback(char *str, int key);
 // str is expected to contain exactly 1 '%s' to show the built-up response.
-//  with the rest of the prompt string.
+//  with the rest of the prompt string. str is read again each time the
+//  prompt is shown, so ap_fn may change it.
 static char *Editor_GetResponse(const char *str, AwaitPromptFn ap_fn);
 static void Editor_Find();
+// Writes the find prompt for the find mode and query of the last search
+//  into find_prompt.
+static void Editor_MakeFindPrompt(void);
+// Moves the cursor to the match at index idx and marks it.
+static void Editor_ShowMatch(int idx);
+// Moves the cursor to match and marks it.
+static void Editor_MarkMatch(const SearchResult *match);
+// Searches for query, and shows its match near where the find prompt was
+//  opened (see find_direction) once it is found.
+static void Editor_FindNear(const char *query, int direction);
+// Shows the match near where the find prompt was opened, once it is
+//  found.
+static void Editor_ShowNearMatch(void);
+// Puts back the highlighting of the line with the match shown, if any.
+static void Editor_UnmarkMatch(void);
+// Shows the count of matches found so far, and the first match once it
+//  is found. Called by the event loop while a search runs on workers.
+static void Editor_FindProgress(void *arg);
+// prompt for a line number or byte offset and jump to it.
+static void Editor_Goto();
 
 // --- PUBLIC FUNCTIONS --- //
 
@@ -151,6 +254,15 @@ void Editor_Open(void) {
   // enable raw mode.
   Term_SetRawMode(&e_state.og_term_attr);
   atexit(Editor_Close);
+  Keyboard_Init();
+  // send frames as synchronized updates if the terminal supports them.
+  TermMode_t sync_mode = Term_QueryMode(TERM_MODE_SYNC);
+  Screen_SetSync(sync_mode == TERM_MODE_SET || sync_mode == TERM_MODE_RESET);
+  // keep frames from piling up on the way to the terminal.
+  Pacer_Init();
+  // have pasted text marked, so it can be inserted all at once.
+  write(STDOUT_FILENO, ESC_CMD_PASTE_MODE(SHOW),
+        sizeof(ESC_CMD_PASTE_MODE(SHOW)) - 1);
 
   // stays NULL if no file passed as an argument to the program.
   e_state.file_name = NULL;
@@ -162,30 +274,52 @@ void Editor_Open(void) {
   e_state.file_lines = NULL;
   // set the current line to 0.
   e_state.cur_file_row = 0;
+  e_state.is_wrapped = false;
+  e_state.cur_wrap_row = 0;
+  e_state.shown_row = 0;
   e_state.cur_file_col = 0;
   e_state.ld_idx = 0;
-  e_state.msg_time = 0;
+  e_state.msg_timer = 0;
+  e_state.frame_timer = 0;
+  e_state.wrap_timer = 0;
   // no message to display by default.
   e_state.msg_line[0] = '\0';
   // initially, the editor and file have the same contents.
   e_state.is_edited = false;
   // no file yet, so no filetype-specific syntax information yet.
   e_state.syntax = NULL;
+  e_state.is_finding = false;
+  e_state.find_default = NULL;
+  e_state.find_regex = false;
+  e_state.find_match = -1;
+  e_state.marked_highlight = NULL;
+  e_state.write_buf = (Buffer) EMPTY_BUF;
+  // show what a search on a large file finds as it goes.
+  Search_OnProgress(Editor_FindProgress, NULL);
 
   // get the size of the terminal window.
-  int res = Term_Size(&e_state.num_rows, &e_state.num_cols);
+  int num_rows, num_cols;
+  int res = Term_Size(&num_rows, &num_cols);
   if (res == -1)
     quit("Term_Size");
-  // reduce number of rows by 2 to make room for a status
-  //  bar and message line.
-  e_state.num_rows -= 2;
+  Editor_SetSize(num_rows, num_cols);
+  // follow the size of the window as it is resized.
+  Loop_WatchSignal(SIGWINCH, Editor_Resize, NULL);
 }
 
 void Editor_Close(void) {
+  // take in the terminal's answers about the last frames, which the
+  //  shell would show otherwise.
+  Pacer_Drain(CLOSE_DRAIN_MS);
   // restore the terminal to its original state.
   Term_UnSetRawMode(&e_state.og_term_attr);
+  write(STDOUT_FILENO, ESC_CMD_PASTE_MODE(HIDE),
+        sizeof(ESC_CMD_PASTE_MODE(HIDE)) - 1);
+  // a search may still be reading the lines.
+  Search_Clear();
   // free malloc'ed array of file lines.
   File_FreeLines((e_state.file_lines), e_state.num_file_lines);
+  WB_Free(&(e_state.write_buf));
   // no error checking with quit, since that might
   //  start a loop of error catching.
   // clear the screen.
@@ -248,6 +382,10 @@ void Editor_InterpretKeypress(void) {
       // no-op on ESC.
       break;
 
+    case KEY_PASTE:
+      Editor_Paste();
+      break;
+
     case CHAR_TO_CTRL('s'):
       // save command
       Editor_Save();
@@ -257,6 +395,16 @@ void Editor_InterpretKeypress(void) {
       // search/find command.
       Editor_Find();
       break;
+
+    case CHAR_TO_CTRL('g'):
+      // goto line or byte offset command.
+      Editor_Goto();
+      break;
+
+    case CHAR_TO_CTRL('w'):
+      // soft-wrap command.
+      Editor_ToggleWrap();
+      break;
     
     case KEY_HOME:
       e_state.cursor.col = 0;
@@ -265,26 +413,52 @@ void Editor_InterpretKeypress(void) {
     case KEY_END:
       // snap to the end of a line.
       if (e_state.cursor.row < e_state.num_file_lines) {
-        e_state.cursor.col = e_state.file_lines[e_state.cursor.row].size;
+        e_state.cursor.col = File_GetLine(e_state.file_lines, e_state.cursor.row)->size;
       }
       break;
 
     case KEY_PAGE_UP:
     case KEY_PAGE_DOWN:
       // scroll up or down by snapping cursor to either the top or bottom of
-      //  the window, then moving the page down with Editor_MoveCursor.
-      if (key == KEY_PAGE_UP) {
-        e_state.cursor.row = e_state.cur_file_row;
-      } else {
-        e_state.cursor.row = e_state.cur_file_row + e_state.num_rows - 1;
+      //  the window, then moving it a page further in one jump. keys read
+      //  in one burst are applied before the next frame, so bring the
+      //  window to the cursor first.
+      Editor_Scroll();
+      if (!e_state.is_wrapped && key == KEY_PAGE_UP) {
+        e_state.cursor.row = e_state.cur_file_row - e_state.num_rows;
+        if (e_state.cursor.row < 0) {
+          e_state.cursor.row = 0;
+        }
+      } else if (!e_state.is_wrapped) {
+        e_state.cursor.row = e_state.cur_file_row + 2 * e_state.num_rows - 1;
         if (e_state.cursor.row > e_state.num_file_lines) {
-          // prevent out of bounds jump beyond bottom of screen.
+          // prevent out of bounds jump beyond bottom of the file.
           e_state.cursor.row = e_state.num_file_lines;
         }
+      } else {
+        // when wrapped, the page is counted in rows, which may be parts
+        //  of a line longer than the screen. a page has no more rows
+        //  than lines, so only the lines a page either way are counted.
+        File_CountRows(e_state.file_lines,
+                       e_state.cur_file_row - e_state.num_rows,
+                       e_state.cur_file_row + 2 * e_state.num_rows);
+        long row = Editor_TopRow() + ((key == KEY_PAGE_UP) ?
+                   -e_state.num_rows : 2 * e_state.num_rows - 1);
+        if (row < 0) {
+          row = 0;
+        }
+        e_state.cursor.row = File_RowLine(e_state.file_lines, row);
+        // keep the cursor's column within the row, on the target row.
+        long wrap_row = row - File_LineRow(e_state.file_lines,
+                                           e_state.cursor.row);
+        int disp_col = wrap_row * e_state.num_cols +
+                       e_state.ld_idx % e_state.num_cols;
+        e_state.cursor.col = (e_state.cursor.row < e_state.num_file_lines) ?
+            File_DispToRawIdx(File_GetLine(e_state.file_lines,
+                                           e_state.cursor.row), disp_col) :
+            0;
       }
-      for (int i = e_state.num_rows; i > 0; i--) {
-        Editor_MoveCursor((key == KEY_PAGE_UP ? KEY_ARROW_UP : KEY_ARROW_DOWN));
-      }
+      Editor_SnapCursor();
       break;
 
     case KEY_ARROW_UP:
@@ -315,48 +489,105 @@ void Editor_InterpretKeypress(void) {
 }
 
 void Editor_Refresh(void) {
+  if (!Pacer_CanWrite()) {
+    // the terminal has not shown the last frames yet (e.g., over a slow
+    //  link), so another would only add to the backlog, and could block
+    //  on the write and keep keys from being read. the frame is drawn
+    //  once the terminal catches up, with all that changed meanwhile.
+    Editor_DeferFrame();
+    return;
+  }
   Editor_Scroll();
+  // scroll the rows still in view on the terminal, so only the ones
+  //  scrolled into view are drawn.
+  long top_row = Editor_TopRow();
+  long count = top_row - e_state.shown_row;
+  if (count > e_state.num_rows || count < -e_state.num_rows) {
+    // nothing in view is kept.
+    count = e_state.num_rows;
+  }
+  Screen_Scroll(0, e_state.num_rows, count);
+  e_state.shown_row = top_row;
+  // drop the lines of a huge file that are far off screen.
+  File_PageOut(e_state.file_lines, e_state.cur_file_row,
+               e_state.cur_file_row + e_state.num_rows);
+  // carry multi-line comments and strings onto the lines in view.
+  File_SyncHighlight(e_state.file_lines, e_state.cur_file_row,
+                     e_state.cur_file_row + e_state.num_rows,
+                     e_state.syntax);
+
+  // draw the frame on the screen's copy of the terminal.
+  Screen_BeginFrame();
+  Editor_RenderRows();
+  if (Pacer_IsLagging() && Screen_KeepRow(e_state.num_rows)) {
+    // the terminal is behind, so the status bar is left as it is until
+    //  it catches up.
+    Editor_DeferFrame();
+  } else {
+    Editor_RenderStatusBar();
+  }
+  Editor_RenderMessageLine();
 
-  Buffer write_buf = EMPTY_BUF;
-
-  // hide the cursor while rendering.
-  WB_AppendESCCmd(&write_buf,
-                  ESC_CMD_CUR_MODE(HIDE));
-  // move cursor to origin.
-  WB_AppendESCCmd(&write_buf,
-                  ESC_CMD_MOVE(ORIGIN));
-
-  Editor_RenderRows(&write_buf);
-  Editor_RenderStatusBar(&write_buf);
-  Editor_RenderMessageLine(&write_buf);
-
-  // move the cursor to its current position.
-  char mv_cmd[BUF_SIZE_MV];
-  // cursor col and row are indexed from 0, while
-  //  screen row and col are 1 indexed. (TODO: is this correct?)
-  // set the cursor position in the line according to the current
-  //  position in the line_display field (ld_idx).
-  Get_ESCCmd_Move(mv_cmd, BUF_SIZE_MV,
-                  (e_state.ld_idx - e_state.cur_file_col) + 1,
-                  (e_state.cursor.row - e_state.cur_file_row) + 1);
-  WB_AppendESCCmd(&write_buf, mv_cmd);
-
-  // show the cursor.
-  WB_AppendESCCmd(&write_buf,
-                  ESC_CMD_CUR_MODE(SHOW));
+  // write the cells that changed since the last frame, then move the
+  //  cursor to its current position in the line_display field (ld_idx).
+  int cursor_col = e_state.is_wrapped ?
+                   e_state.ld_idx % e_state.num_cols :
+                   e_state.ld_idx - e_state.cur_file_col;
+  Screen_Flush(&(e_state.write_buf), Editor_CursorRow() - top_row,
+               cursor_col);
 
   // write all commands to stdout.
-  WB_Write(&write_buf);
-  // free the buffer.
-  WB_Free(&write_buf);
+  Pacer_WriteFrame(&(e_state.write_buf));
+  // empty the buffer for the next frame.
+  WB_Clear(&(e_state.write_buf));
 }
 
 // --- STATIC HELPER FUNCTION DEFINITIONS --- //
 
-static void Editor_RenderRow(Buffer *wbuf, int disp_line) {
+static void Editor_SetSize(int num_rows, int num_cols) {
+  // the screen keeps a copy of what the terminal shows.
+  Screen_Resize(num_rows, num_cols);
+  e_state.num_cols = num_cols;
+  // reduce number of rows by 2 to make room for a status
+  //  bar and message line.
+  e_state.num_rows = num_rows - 2;
+}
+
+static void Editor_Resize(void *arg) {
+  (void) arg;
+  int num_rows, num_cols;
+  if (Term_Size(&num_rows, &num_cols) == -1 ||
+      (num_rows == e_state.num_rows + 2 && num_cols == e_state.num_cols)) {
+    return;
+  }
+  int old_cols = e_state.num_cols;
+  Editor_SetSize(num_rows, num_cols);
+  // the view keeps its first line, and Editor_Scroll only moves it as far
+  //  as it takes to keep the cursor in it. nothing shown can be scrolled
+  //  on the terminal, which is drawn again in full.
+  if (e_state.is_wrapped) {
+    // keep the text at the top of the view in view: the display column
+    //  the top row began at is on another row of the line at the new
+    //  width (Editor_Scroll clamps it to the line).
+    e_state.cur_wrap_row = (long) e_state.cur_wrap_row * old_cols /
+                           e_state.num_cols;
+    // only the lines in view are counted at the new width before the
+    //  frame (see Editor_Scroll); the rest are counted after it.
+    File_SetWrap(e_state.file_lines, e_state.num_cols);
+    Editor_CountRowsLater();
+  }
+  e_state.shown_row = Editor_TopRow();
+  // draw at once, even in the middle of a prompt.
+  Editor_Refresh();
+}
+
+// Draws f_line on screen row y, from display column start on.
+static void Editor_RenderRow(int y, FileLine *f_line, int start) {
+  // lines are only expanded for display once they are first shown.
+  File_DisplayText(f_line, start + e_state.num_cols, e_state.syntax);
   // calculate how much of the row to show by subtracting the 
   //  column position in the file from the size of the line.
-  int size = e_state.file_lines[disp_line].size_display - e_state.cur_file_col;
+  int size = f_line->size_display - start;
     if (size < 0) {
       // scrolled too far over to view any chars from this line.
       size = 0;
@@ -366,13 +597,31 @@ static void Editor_RenderRow(Buffer *wbuf, int disp_line) {
     }
 
     // alias for the current display line.
-    char *line = &(e_state.file_lines[disp_line].line_display[e_state.cur_file_col]);
-    // alias for the current highligh array line.
-    unsigned char *h_line = &(e_state.file_lines[disp_line].highlight[e_state.cur_file_col]);
-    // track the current text color to avoid changing color sequences on every write.
-    // -1 indicates default color.
-    int cur_color = -1;
+    char *line = &(f_line->line_display[start]);
+
+    // draw the row as plain text, then color the parts of it that are
+    //  covered by highlight spans.
+    Screen_PutText(y, 0, line, size, SCREEN_PLAIN);
+    const HLSpans *spans = f_line->highlight;
+    int end_col = start + size;
+    for (int k = HS_Find(spans, start);
+         spans != NULL && k < spans->num_spans &&
+         spans->spans[k].start < end_col; k++) {
+      const HLSpan *span = &(spans->spans[k]);
+      // the part of the span on screen.
+      int first = (span->start > start) ?
+                  span->start : start;
+      int last = span->start + span->size;
+      if (last > end_col) {
+        last = end_col;
+      }
+      Screen_PutText(y, first - start,
+                     &(f_line->line_display[first]), last - first,
+                     span->code);
+    }
 
+    HSReader codes;
+    HS_ReaderInit(&codes, spans, start);
     for (int i = 0; i < size; i++) {
       if (iscntrl(line[i])) {
         // if the char is a control char, print the cooresponding
@@ -380,61 +629,49 @@ static void Editor_RenderRow(Buffer *wbuf, int disp_line) {
         //  ctrl-@ -> @ is the null (0) ctrl char.
         char cntrl_char = (line[i] <= CTRL_CHAR_OFFSET) ?
                           ALPHA_OFFSET_CHAR + line[i] : '?';
-        WB_AppendESCCmd(wbuf, ESC_CMD_TEXT_FORMAT(INVERT));
-        WB_Append(wbuf, &cntrl_char, 1);
-        WB_AppendESCCmd(wbuf, ESC_CMD_TEXT_FORMAT(RESET INVERT));
-      } else if (h_line[i] == HL_NORMAL) {
-        if (cur_color != -1) {
-          // reset the text color to default.
-          WB_AppendESCCmd(wbuf, RES);
-          cur_color = -1;
-        }
-        // append a single character.
-        WB_Append(wbuf, &(line[i]), 1);
-      } else {
-        int color = File_GetHighlightCode(h_line[i]);
-        if (color != cur_color) {
-          // a new color, so set the text color with the new code.
-          cur_color = color;
-          char buf[BUF_SIZE_COLOR];
-          int color_size = snprintf(buf, BUF_SIZE_COLOR, ESC_SEQ "%dm", color);
-          WB_Append(wbuf, buf, color_size);
-        }
-        // append the character.
-        WB_Append(wbuf, &(line[i]), 1);
+        unsigned char code = HS_CodeAt(&codes, start + i);
+        Screen_PutCell(y, i, cntrl_char, code | SCREEN_INVERT);
       }
     }
-    // reset the text color for the rest of the output.
-    WB_AppendESCCmd(wbuf, RES);
 }
 
-static void Editor_RenderRows(Buffer *wbuf) {
+static void Editor_RenderRows(void) {
+  // the file line to display on the current screen row, and the display
+  //  column it is shown from.
+  int disp_line = e_state.cur_file_row;
+  int start = e_state.is_wrapped ? e_state.cur_wrap_row * e_state.num_cols :
+                                   e_state.cur_file_col;
   for (int y = 0; y < e_state.num_rows; y++) {
-    // calculate the file line to display on the current screen row.
-    int disp_line = y + e_state.cur_file_row;
     if (disp_line >= e_state.num_file_lines) {
       // row is not part of the text buffer.
       // write the welcome message 1/3rd down the screen.
       if (e_state.num_file_lines == 0 && y == e_state.num_rows / 3) {
         // only show the welcome message when the text buffer is empty.
-        Editor_RenderWelcome(wbuf);
+        Editor_RenderWelcome(y);
       } else {
-        WB_AppendESCCmd(wbuf, EMPTY_LN_CHAR);
+        Screen_PutText(y, 0, EMPTY_LN_CHAR, strlen(EMPTY_LN_CHAR),
+                       SCREEN_PLAIN);
       }
     } else {
       // drawing a row that is part of the text buffer.
-      Editor_RenderRow(wbuf, disp_line);
+      FileLine *f_line = File_GetLine(e_state.file_lines, disp_line);
+      Editor_RenderRow(y, f_line, start);
+      if (!e_state.is_wrapped) {
+        disp_line++;
+      } else {
+        // a wrapped line goes on at the start of the next row, up to the
+        //  row after its last column.
+        start += e_state.num_cols;
+        if (start > f_line->size_display) {
+          disp_line++;
+          start = 0;
+        }
+      }
     }
-
-    // clear the line to the end.
-    WB_AppendESCCmd(wbuf, ESC_CMD_CLEAR(LINE, END));
-    // if (y < e_state.num_rows - 1) {
-      WB_AppendESCCmd(wbuf, NL);
-    // }
   }
 }
 
-static void Editor_RenderWelcome(Buffer *wbuf) {
+static void Editor_RenderWelcome(int y) {
   // a buffer for the welcome message
   char w_msg_buf[BUF_SIZE_WEL];
   int w_len = snprintf((char *) w_msg_buf, BUF_SIZE_WEL,
@@ -448,13 +685,10 @@ static void Editor_RenderWelcome(Buffer *wbuf) {
   int margin = (e_state.num_cols - w_len) / 2;
   if (margin > 0) {
     // works because EMPTY_LN_CHAR has a constant length.
-    WB_AppendESCCmd(wbuf, EMPTY_LN_CHAR);
-    margin--;
-  }
-  while (margin--) {
-    WB_AppendESCCmd(wbuf, " ");
+    Screen_PutText(y, 0, EMPTY_LN_CHAR, strlen(EMPTY_LN_CHAR), SCREEN_PLAIN);
   }
-  WB_Append(wbuf, w_msg_buf, w_len);
+  // the cells of the margin are blank already.
+  Screen_PutText(y, margin, w_msg_buf, w_len, SCREEN_PLAIN);
 }
 
 static void Editor_MoveCursor(int key) {
@@ -462,7 +696,7 @@ static void Editor_MoveCursor(int key) {
   //  lines in the file, set line to NULL. Otherwise, set line to point
   //  to the last line in the file.
   FileLine *line = (e_state.cursor.row >= e_state.num_file_lines) ?
-                    NULL : &(e_state.file_lines[e_state.cursor.row]);
+                    NULL : File_GetLine(e_state.file_lines, e_state.cursor.row);
   // recall, row number increases down, col number increases left.
   // do not change cursor position if the move would bring the cursor
   //  out of bounds on the screen.
@@ -503,13 +737,16 @@ static void Editor_MoveCursor(int key) {
         // move to the end of upper adjacent line if moving left of
         //  the viewable window.
         e_state.cursor.row--;
-        e_state.cursor.col = e_state.file_lines[e_state.cursor.row].size;
+        e_state.cursor.col = File_GetLine(e_state.file_lines, e_state.cursor.row)->size;
       }
       break;
   }
+  Editor_SnapCursor();
+}
 
-  line = (e_state.cursor.row >= e_state.num_file_lines) ?
-          NULL : &(e_state.file_lines[e_state.cursor.row]);
+static void Editor_SnapCursor(void) {
+  FileLine *line = (e_state.cursor.row >= e_state.num_file_lines) ?
+                   NULL : File_GetLine(e_state.file_lines, e_state.cursor.row);
   int line_size = (line != NULL) ? line->size : 0;
   if (e_state.cursor.col > line_size) {
     // adjust the cursor horizontally to the end of a shorter
@@ -533,18 +770,53 @@ static void Editor_Scroll(void) {
   e_state.ld_idx = e_state.cursor.col;
   // if (e_state.cursor.row < e_state.num_file_lines) {
   //   e_state.ld_idx =
-  //   File_RawToDispIdx(&(e_state.file_lines[e_state.cursor.row]), e_state.cursor.col);
+  //   File_RawToDispIdx(File_GetLine(e_state.file_lines, e_state.cursor.row), e_state.cursor.col);
   // }
 
+  // wrap the lines at the width of the screen. does nothing unless the
+  //  width or the wrap mode changed.
+  File_SetWrap(e_state.file_lines,
+               e_state.is_wrapped ? e_state.num_cols : 0);
+  if (e_state.is_wrapped) {
+    // the row and column of the cursor on screen follow from where it is
+    //  shown in its line, which tabs put after its index.
+    if (e_state.cursor.row < e_state.num_file_lines) {
+      e_state.ld_idx = File_RawToDispIdx(File_GetLine(e_state.file_lines,
+                                                      e_state.cursor.row),
+                                         e_state.cursor.col);
+    }
+    // count the rows of the lines in view, and of the lines a screen above
+    //  the cursor, which the view is moved to if it's below it.
+    File_CountRows(e_state.file_lines, e_state.cur_file_row,
+                   e_state.cur_file_row + e_state.num_rows);
+    File_CountRows(e_state.file_lines, e_state.cursor.row - e_state.num_rows,
+                   e_state.cursor.row + 1);
+    e_state.cur_file_col = 0;
+    // an edit may have left the top line with fewer rows.
+    int num_wrap_rows = File_LineRow(e_state.file_lines,
+                                     e_state.cur_file_row + 1) -
+                        File_LineRow(e_state.file_lines,
+                                     e_state.cur_file_row);
+    if (e_state.cur_wrap_row >= num_wrap_rows) {
+      e_state.cur_wrap_row = (num_wrap_rows > 0) ? num_wrap_rows - 1 : 0;
+    }
+  }
+
   // vertical scroll correction.
   // check if cursor is above visible screen, and scrolls up to
   //  the cursor location if true.
-  if (e_state.cursor.row < e_state.cur_file_row) {
-    e_state.cur_file_row = e_state.cursor.row;
+  long top_row = Editor_TopRow();
+  long cursor_row = Editor_CursorRow();
+  if (cursor_row < top_row) {
+    Editor_SetTopRow(cursor_row);
   }
   // check if cursor is below visible screen, and adjust to cursor location.
-  if (e_state.cursor.row >= e_state.cur_file_row + e_state.num_rows) {
-    e_state.cur_file_row = e_state.cursor.row - e_state.num_rows + 1;
+  if (cursor_row >= top_row + e_state.num_rows) {
+    Editor_SetTopRow(cursor_row - e_state.num_rows + 1);
+  }
+  if (e_state.is_wrapped) {
+    // nothing is off screen to the right.
+    return;
   }
 
   // horizontal scroll correction.
@@ -556,8 +828,50 @@ static void Editor_Scroll(void) {
   }
 }
 
-static void Editor_RenderStatusBar(Buffer *wbuf) {
-  WB_AppendESCCmd(wbuf, ESC_CMD_TEXT_FORMAT(INVERT));
+static long Editor_TopRow(void) {
+  if (!e_state.is_wrapped) {
+    return e_state.cur_file_row;
+  }
+  return File_LineRow(e_state.file_lines, e_state.cur_file_row) +
+         e_state.cur_wrap_row;
+}
+
+static long Editor_CursorRow(void) {
+  if (!e_state.is_wrapped) {
+    return e_state.cursor.row;
+  }
+  return File_LineRow(e_state.file_lines, e_state.cursor.row) +
+         e_state.ld_idx / e_state.num_cols;
+}
+
+static void Editor_SetTopRow(long row) {
+  if (!e_state.is_wrapped) {
+    e_state.cur_file_row = row;
+    return;
+  }
+  e_state.cur_file_row = File_RowLine(e_state.file_lines, row);
+  e_state.cur_wrap_row = row - File_LineRow(e_state.file_lines,
+                                            e_state.cur_file_row);
+}
+
+static void Editor_ToggleWrap(void) {
+  e_state.is_wrapped = !e_state.is_wrapped;
+  // the top line is kept in view from its start.
+  e_state.cur_wrap_row = 0;
+  e_state.cur_file_col = 0;
+  File_SetWrap(e_state.file_lines,
+               e_state.is_wrapped ? e_state.num_cols : 0);
+  if (e_state.is_wrapped) {
+    Editor_CountRowsLater();
+  }
+  // rows counted one way can't be scrolled to rows counted the other.
+  e_state.shown_row = Editor_TopRow();
+  Editor_SetCmdMsg("soft wrap %s", e_state.is_wrapped ? "on" : "off");
+}
+
+static void Editor_RenderStatusBar(void) {
+  // the status bar is the row below the text.
+  int y = e_state.num_rows;
 
   // build the status string in two parts; one left-aligned,
   //  the other right-aligned.
@@ -579,37 +893,48 @@ static void Editor_RenderStatusBar(Buffer *wbuf) {
     status_size_left = e_state.num_cols;
   }
 
+  // while finding, show which match is shown out of how many.
+  char find_status[BUF_SIZE_STATUS] = "";
+  if (e_state.is_finding && Search_Error() != NULL) {
+    snprintf(find_status, BUF_SIZE_STATUS, "<bad regex: %s> | ",
+             Search_Error());
+  } else if (e_state.is_finding && !Search_IsDone()) {
+    snprintf(find_status, BUF_SIZE_STATUS, "<searching: %d found> | ",
+             Search_NumMatches());
+  } else if (e_state.is_finding && e_state.find_match != -1) {
+    // a search with too many matches shows how many it stopped at.
+    snprintf(find_status, BUF_SIZE_STATUS, "<match %d of %d%s> | ",
+             e_state.find_match + 1, Search_NumMatches(),
+             Search_IsCapped() ? "+" : "");
+  } else if (e_state.is_finding && Search_NumMatches() == 0) {
+    snprintf(find_status, BUF_SIZE_STATUS, "<no matches> | ");
+  }
   // show the filetype on the right of the status bar.
   char *file_type = (e_state.syntax == NULL) ? "N/A" : e_state.syntax->language;
   // print the current line number out of total lines.
   // e_state.cursor.row is 0 indexed, so add 1 to the displayed value.
   int status_size_right = snprintf(status_line_right, BUF_SIZE_STATUS,
-                                   "<%s> | <%d> | <%d>",
+                                   "%s<%s> | <%d> | <%d>",
+                                   find_status,
                                    file_type,
                                    e_state.cursor.row + 1,
                                    e_state.num_file_lines);
+  // snprintf gives the size the string would have had if it was cut off.
+  status_size_right = min(status_size_right, BUF_SIZE_STATUS - 1);
 
-  // write the left side of the status bar to the buffer.
-  WB_Append(wbuf, status_line_left, status_size_left);
-
-  // write spaces to the buffer until adding the right side would
-  //  align it flush with the last column on the right.
-  while (status_size_left < e_state.num_cols) {
-    if (e_state.num_cols - status_size_left == status_size_right) {
-      // if there is exactly enough space for the right side,
-      //  write it to the buffer.
-      WB_Append(wbuf, status_line_right, status_size_right);
-      break;
-    }
-    // draw spaces to the edge of the screen so the status
-    //  is on an inverted background.
-    WB_AppendESCCmd(wbuf, SPACE);
-    status_size_left++;
+  // draw spaces to the edge of the screen so the status is on an
+  //  inverted background.
+  for (int x = 0; x < e_state.num_cols; x++) {
+    Screen_PutCell(y, x, ' ', SCREEN_INVERT);
+  }
+  // draw the left side of the status bar.
+  Screen_PutText(y, 0, status_line_left, status_size_left, SCREEN_INVERT);
+  if (e_state.num_cols - status_size_left >= status_size_right) {
+    // there is enough space for the right side, so align it flush with
+    //  the last column on the right.
+    Screen_PutText(y, e_state.num_cols - status_size_right,
+                   status_line_right, status_size_right, SCREEN_INVERT);
   }
-
-  WB_AppendESCCmd(wbuf, ESC_CMD_TEXT_FORMAT(DEFAULT));
-  // make room for the message line.
-  WB_AppendESCCmd(wbuf, NL);
 }
 
 void Editor_SetCmdMsg(const char *msg, ...) {
@@ -621,18 +946,76 @@ void Editor_SetCmdMsg(const char *msg, ...) {
   //  copy the message into the global struct.
   vsnprintf(e_state.msg_line, BUF_SIZE_CMD_MSG, msg, args);
   va_end(args);
-  // NULL arg gets current time.
-  e_state.msg_time = time(NULL);
+  // hide the message MSG_TIMEOUT seconds from now. a newer message
+  //  restarts the count.
+  Loop_CancelTimer(e_state.msg_timer);
+  e_state.msg_timer = Loop_AddTimer(MSG_TIMEOUT * 1000L,
+                                    Editor_ExpireMsg, NULL);
+}
+
+// Draws a frame FRAME_RETRY_MS from now, unless one is already due.
+static void Editor_DeferFrame(void) {
+  if (e_state.frame_timer == 0) {
+    e_state.frame_timer = Loop_AddTimer(FRAME_RETRY_MS, Editor_DrawDeferred,
+                                        NULL);
+  }
+}
+
+// Draws the frame put off by Editor_DeferFrame. Called by the event loop.
+static void Editor_DrawDeferred(void *arg) {
+  (void) arg;
+  e_state.frame_timer = 0;
+  Editor_Refresh();
 }
 
-static void Editor_RenderMessageLine(Buffer *wbuf) {
-  // clear the line.
-  WB_AppendESCCmd(wbuf, ESC_CMD_CLEAR(LINE, END));
+// Counts the rows of more lines WRAP_COUNT_MS from now, unless that's
+//  already due.
+static void Editor_CountRowsLater(void) {
+  if (e_state.wrap_timer == 0) {
+    e_state.wrap_timer = Loop_AddTimer(WRAP_COUNT_MS, Editor_CountSomeRows,
+                                       NULL);
+  }
+}
+
+// Counts the rows of WRAP_COUNT_LINES more lines at the wrap width, until
+//  all of them are. Called by the event loop.
+static void Editor_CountSomeRows(void *arg) {
+  (void) arg;
+  e_state.wrap_timer = 0;
+  if (!e_state.is_wrapped) {
+    // the count goes on when wrapping is turned on again.
+    return;
+  }
+  // counting the lines above the view moves its top row; the frame drawn
+  //  last moves with it, so nothing is scrolled that didn't move.
+  long top_row = Editor_TopRow();
+  bool is_done = File_CountSomeRows(e_state.file_lines, WRAP_COUNT_LINES);
+  e_state.shown_row += Editor_TopRow() - top_row;
+  if (!is_done) {
+    Editor_CountRowsLater();
+  }
+}
+
+// Hides the message on the message line. Called by the event loop once
+//  the message is MSG_TIMEOUT seconds old.
+static void Editor_ExpireMsg(void *arg) {
+  (void) arg;
+  e_state.msg_line[0] = '\0';
+  e_state.msg_timer = 0;
+}
+
+static void Editor_RenderMessageLine(void) {
+  // expand the tabs a response may hold, as in the text.
+  char msg_display[BUF_SIZE_CMD_MSG * TS_TAB_SIZE];
+  int msg_size = TS_Expand(e_state.msg_line, strlen(e_state.msg_line), 0,
+                           msg_display);
   // ensure the message can fit in the window.
-  int msg_size = min(strlen(e_state.msg_line), e_state.num_cols);
-  // only render the message if it is less than MSG_TIMEOUT seconds old.
-  if (msg_size != 0 && time(NULL) - e_state.msg_time < MSG_TIMEOUT) {
-    WB_Append(wbuf, e_state.msg_line, msg_size);
+  msg_size = min(msg_size, e_state.num_cols);
+  // messages older than MSG_TIMEOUT seconds were emptied.
+  if (msg_size != 0) {
+    // the message line is the last row, below the status bar.
+    Screen_PutText(e_state.num_rows + 1, 0, msg_display, msg_size,
+                   SCREEN_PLAIN);
   }
 }
 
@@ -642,7 +1025,8 @@ static int min(int a, int b) {
 }
 
 static void Editor_InsertChar(char new_char) {
-  if (e_state.cursor.row == e_state.num_file_lines) {
+  bool is_new_line = (e_state.cursor.row == e_state.num_file_lines);
+  if (is_new_line) {
     // if the cursor is on the last line, append a new FileLine to the
     //  array of file lines.
     File_InsertFileLine(&(e_state.file_lines),
@@ -650,9 +1034,11 @@ static void Editor_InsertChar(char new_char) {
                         e_state.num_file_lines,
                         e_state.syntax);
   }
-  File_InsertChar(&(e_state.file_lines[e_state.cursor.row]),
+  File_InsertChar(File_GetLine(e_state.file_lines, e_state.cursor.row),
                   e_state.cursor.col, new_char,
                   e_state.syntax);
+  File_LineEdited(e_state.file_lines, e_state.cursor.row, e_state.syntax);
+  Search_Edited(e_state.file_lines, e_state.cursor.row, !is_new_line, 1);
   // move the cursor 1 column to the right so the next character inserted
   //  is on a different space.
   e_state.cursor.col++;
@@ -660,6 +1046,27 @@ static void Editor_InsertChar(char new_char) {
   e_state.is_edited = true;
 }
 
+// Inserts the text the user pasted at the cursor, and moves the cursor
+//  after it.
+static void Editor_Paste() {
+  Buffer paste = EMPTY_BUF;
+  Keyboard_ReadPaste(&paste);
+  if (paste.size > 0) {
+    int row = e_state.cursor.row;
+    // text pasted past the last line goes on a new line.
+    int num_replaced = (row < e_state.num_file_lines) ? 1 : 0;
+    File_InsertText(&(e_state.file_lines), &(e_state.num_file_lines),
+                    e_state.cursor.row, e_state.cursor.col,
+                    (const char *) paste.buffer, paste.size,
+                    &(e_state.cursor.row), &(e_state.cursor.col),
+                    e_state.syntax);
+    Search_Edited(e_state.file_lines, row, num_replaced,
+                  e_state.cursor.row - row + 1);
+    e_state.is_edited = true;
+  }
+  WB_Free(&paste);
+}
+
 // Removes 1 char from the current line to the left of the cursor. Does
 //  nothing if on an empty line, or no char exists to the left of the cursor.
 static void Editor_RemoveChar() {
@@ -674,9 +1081,11 @@ static void Editor_RemoveChar() {
   if (e_state.cursor.col > 0) {
     // on a line with a char to the left of the cursor,
     //  so delete it.
-    File_RemoveChar(&(e_state.file_lines[e_state.cursor.row]),
+    File_RemoveChar(File_GetLine(e_state.file_lines, e_state.cursor.row),
                     e_state.cursor.col - 1,
                     e_state.syntax);
+    File_LineEdited(e_state.file_lines, e_state.cursor.row, e_state.syntax);
+    Search_Edited(e_state.file_lines, e_state.cursor.row, 1, 1);
     // move the cursor back by 1 column.
     e_state.cursor.col--;
     // record that the file has been changed in the editor.
@@ -685,12 +1094,15 @@ static void Editor_RemoveChar() {
     // at the start of a line, so append this line to the one above it,
     //  and delete the current line from the array of FileLines.
     // the cursor's new position is 1 line above, at the last column on the line.
-    e_state.cursor.col = e_state.file_lines[e_state.cursor.row - 1].size;
-    File_AppendLine(&(e_state.file_lines[e_state.cursor.row - 1]),
-                    e_state.file_lines[e_state.cursor.row].line,
-                    e_state.file_lines[e_state.cursor.row].size,
+    e_state.cursor.col = File_GetLine(e_state.file_lines, e_state.cursor.row - 1)->size;
+    File_AppendLine(File_GetLine(e_state.file_lines, e_state.cursor.row - 1),
+                    File_LineText(File_GetLine(e_state.file_lines, e_state.cursor.row)),
+                    File_GetLine(e_state.file_lines, e_state.cursor.row)->size,
                     e_state.syntax);
     File_RemoveRow(e_state.file_lines, &(e_state.num_file_lines), e_state.cursor.row);
+    File_LineEdited(e_state.file_lines, e_state.cursor.row - 1, e_state.syntax);
+    // the two lines were joined into one.
+    Search_Edited(e_state.file_lines, e_state.cursor.row - 1, 2, 1);
     e_state.cursor.row--;
   }
 }
@@ -709,14 +1121,13 @@ static void Editor_Save() {
     Syntax_LangFromFile(e_state.file_name, &(e_state.syntax));
   }
 
-  int res = File_Save(e_state.file_name, &(e_state.file_lines),
-                e_state.num_file_lines);
+  long res = File_Save(e_state.file_name, e_state.file_lines);
 
   if (res == -1) {
     // error saving.
     Editor_SetCmdMsg("ERROR: file NOT saved: %s", strerror(errno));
   } else {
-    Editor_SetCmdMsg("SAVE SUCCESSFUL: %d bytes written to %s",
+    Editor_SetCmdMsg("SAVE SUCCESSFUL: %ld bytes written to %s",
                      res, e_state.file_name);
     // record that the editor and file are in sync.
     e_state.is_edited = false;
@@ -727,13 +1138,20 @@ static void Editor_SplitLine() {
   File_SplitLine(&(e_state.file_lines), &(e_state.num_file_lines),
                  e_state.cursor.row, e_state.cursor.col,
                  e_state.syntax);
+  if (e_state.cursor.col == 0) {
+    // an empty line was inserted above the cursor.
+    Search_Edited(e_state.file_lines, e_state.cursor.row, 0, 1);
+  } else {
+    Search_Edited(e_state.file_lines, e_state.cursor.row, 1, 2);
+  }
   // set the cursor to one line down and to the start of the line.
   e_state.cursor.row++;
   e_state.cursor.col = 0;
 }
 
 // str is expected to contain exactly 1 '%s' to show the built-up response.
-//  with the rest of the prompt string.
+//  with the rest of the prompt string. str is read again each time the
+//  prompt is shown, so ap_fn may change it.
 static char *Editor_GetResponse(const char *str, AwaitPromptFn ap_fn) {
   // allocate space for the response buffer, which is initialized
   //  to an empty string.
@@ -746,7 +1164,11 @@ static char *Editor_GetResponse(const char *str, AwaitPromptFn ap_fn) {
     // keep showing the prompt until the user finishes entering 
     //  the response.
     Editor_SetCmdMsg(str, res_buf);
-    Editor_Refresh();
+    if (!Keyboard_KeyPending()) {
+      // draw the prompt only once the keys that already arrived (e.g., a
+      //  pasted response) are taken in.
+      Editor_Refresh();
+    }
 
     // wait for a keypress.
     int key = Keyboard_ReadKey();
@@ -770,8 +1192,9 @@ static char *Editor_GetResponse(const char *str, AwaitPromptFn ap_fn) {
       free(res_buf);
       return NULL;
     } else if (key == KEY_RETURN) {
-      // the user pressed ENTER.
-      if (res_buf_len != 0) {
+      // the user pressed ENTER. a prompt with a callback may take an
+      //  empty response (e.g., find, for its last query).
+      if (res_buf_len != 0 || ap_fn != NULL) {
         // clear the prompt message before returning the response
         //  string.
         Editor_SetCmdMsg("");
@@ -783,21 +1206,46 @@ static char *Editor_GetResponse(const char *str, AwaitPromptFn ap_fn) {
         return res_buf;
       }
       // no text was entered, so continue to wait.
-    } else if (!iscntrl(key) && key < 128) {
-      // the key was a printable character, so append it to the buffer.
-      if (res_buf_len >= res_buf_size - 1) {
-        // resize the buffer if it is full. the buffer has to fit '\0'
-        //  at the end, so the length has to be 1 less than the size of the
-        //  current allocated buffer.
-        res_buf_size += BUF_SIZE_RESPONSE;
+    } else if (key == KEY_PASTE || key == '\t' ||
+               (!iscntrl(key) && key < 128)) {
+      // the key was a printable character or a tab, or text was pasted,
+      //  so append the printable characters and tabs to the buffer.
+      Buffer paste = EMPTY_BUF;
+      char typed = key;
+      const char *chars = &typed;
+      int num_chars = 1;
+      if (key == KEY_PASTE) {
+        Keyboard_ReadPaste(&paste);
+        chars = (const char *) paste.buffer;
+        num_chars = paste.size;
+      }
+      for (int i = 0; i < num_chars; i++) {
+        unsigned char c = chars[i];
+        if ((iscntrl(c) && c != '\t') || c >= 128) {
+          // a response is one line of printable characters and tabs
+          //  (e.g., a query to find).
+          continue;
+        }
+        if (res_buf_len >= res_buf_size - 1) {
+          // resize the buffer if it is full. the buffer has to fit '\0'
+          //  at the end, so the length has to be 1 less than the size of
+          //  the current allocated buffer.
+          res_buf_size += BUF_SIZE_RESPONSE;
+          char *grown = realloc(res_buf, res_buf_size);
+          if (grown == NULL) {
+            quit("Editor_GetResponse");
+          }
+          res_buf = grown;
+        }
+        // set the input character in the buffer and increment the size
+        //  of the response string.
+        res_buf[res_buf_len] = chars[i];
+        res_buf_len++;
       }
-      // set the input character in the buffer and increment the size
-      //  of the response string.
-      res_buf[res_buf_len] = key;
-      res_buf_len++;
       // null-terminate the new string so the caller can calcualte its
       //  length.
       res_buf[res_buf_len] = '\0';
+      WB_Free(&paste);
     }
 
     if (ap_fn != NULL) {
@@ -811,8 +1259,25 @@ static void Editor_Find() {
   Cursor og_cursor = e_state.cursor;
   int og_file_col = e_state.cur_file_col;
   int og_file_row = e_state.cur_file_row;
-
-  char *str = Editor_GetResponse("FIND <ESC to cancel>: %s", Editor_FindCallback);
+  int og_wrap_row = e_state.cur_wrap_row;
+
+  // offer the last query, searched for again if nothing is typed.
+  const char *last_query = Search_Query();
+  if (last_query != NULL) {
+    e_state.find_default = strdup(last_query);
+    if (e_state.find_default == NULL) {
+      quit("Editor_Find");
+    }
+  }
+  Editor_MakeFindPrompt();
+
+  e_state.is_finding = true;
+  e_state.find_origin = og_cursor;
+  e_state.find_match = -1;
+  char *str = Editor_GetResponse(e_state.find_prompt, Editor_FindCallback);
+  e_state.is_finding = false;
+  free(e_state.find_default);
+  e_state.find_default = NULL;
   if (str != NULL) {
     // pressed RETURN to leave search.
     free(str);
@@ -821,100 +1286,198 @@ static void Editor_Find() {
     e_state.cursor = og_cursor;
     e_state.cur_file_col = og_file_col;
     e_state.cur_file_row = og_file_row;
+    e_state.cur_wrap_row = og_wrap_row;
   }
 }
 
-static void Editor_FindCallback(char *str, int key) {
-  // index of previous row containing a match: -1 if no match.
-  static int prev_match_row = -1;
-  static int direction = 1;
-
-  // save the current highlight code to restore later.
-  // the index of the FileLine that has a highlight line that
-  //  needs to be restored.
-  static int h_line_idx;
-  // a copy of the FileLine highlight array to restore later.
-  // NULL when nothing needs to be restored.
-  static char *h_line_og = NULL;
+static void Editor_MakeFindPrompt(void) {
+  char *prompt = e_state.find_prompt;
+  const char *mode = e_state.find_regex ? "REGEX" : "FIND";
+  const char *last_query = e_state.find_default;
+  if (last_query == NULL) {
+    snprintf(prompt, BUF_SIZE_CMD_MSG, "%s <ESC to cancel>: %%s", mode);
+    return;
+  }
+  // show the start of the query, with '%' escaped for the prompt.
+  int size = snprintf(prompt, BUF_SIZE_CMD_MSG, "%s [", mode);
+  for (int i = 0; last_query[i] != '\0' && i < FIND_DEFAULT_SHOWN; i++) {
+    if (last_query[i] == '%') {
+      prompt[size++] = '%';
+    }
+    prompt[size++] = last_query[i];
+  }
+  snprintf(&(prompt[size]), BUF_SIZE_CMD_MSG - size,
+           "] <ESC to cancel>: %%s");
+}
 
-  // NOTE: it is impossible for the user to modify the file while
-  //  searching, so h_line_idx can be used as an index into
-  //  the FileLine array safely.
-
-  if (h_line_og != NULL) {
-    // there was a highlight array to restore.
-    // copy the saved highlight array into the current FileLine's highlight
-    //  field
-    memcpy(e_state.file_lines[h_line_idx].highlight, h_line_og,
-           e_state.file_lines[h_line_idx].size_display);
-    // free and reset the allocated saved highlight array.
-    free(h_line_og);
-    h_line_og = NULL;
-  }
-
-  // set prev_match_row to -1 if an arrow key was not pressed, so advances
-  //  are only made upon pressing an arrow key. always proceed forward
-  //  unless the back keys are pressed.
-  if (key == KEY_RETURN || key == KEY_ESC) {
-    // return early if the user entered return or esc (cancel).
-    prev_match_row = -1;
-    direction = 1;
+static void Editor_Goto() {
+  char *str = Editor_GetResponse("GOTO line, or @byte <ESC to cancel>: %s",
+                                 NULL);
+  if (str == NULL) {
+    return;
+  }
+  // a leading '@' gives a byte offset rather than a line number.
+  bool is_offset = (str[0] == '@');
+  char *end;
+  long target = strtol(is_offset ? &(str[1]) : str, &end, 10);
+  if (*end != '\0' || end == str + is_offset || target < 0) {
+    Editor_SetCmdMsg("ERROR: not a number: %.32s", str);
+    free(str);
     return;
-  } else if (key == KEY_ARROW_RIGHT || key == KEY_ARROW_DOWN) {
+  }
+  free(str);
+
+  if (is_offset) {
+    // land on the byte itself, or at the end of a line for its newline.
+    e_state.cursor.row = File_OffsetLine(e_state.file_lines, target);
+    long col = target - File_LineOffset(e_state.file_lines,
+                                         e_state.cursor.row);
+    e_state.cursor.col = (col > INT_MAX) ? INT_MAX : col;
+  } else {
+    // line numbers are shown from 1.
+    e_state.cursor.row = (target < 1) ? 0 :
+        (target > e_state.num_file_lines) ? e_state.num_file_lines :
+        target - 1;
+    e_state.cursor.col = 0;
+  }
+  Editor_SnapCursor();
+  // show the target at the top of the screen.
+  e_state.cur_file_row = e_state.cursor.row;
+  e_state.cur_wrap_row = 0;
+  Editor_SetCmdMsg("line %d, byte %ld", e_state.cursor.row + 1,
+                   File_LineOffset(e_state.file_lines, e_state.cursor.row) +
+                   e_state.cursor.col);
+}
+
+static void Editor_FindCallback(char *str, int key) {
+  // with nothing typed, the query of the last search is used again.
+  bool is_default = (str[0] == '\0' && e_state.find_default != NULL);
+  const char *query = is_default ? e_state.find_default : str;
+  int direction = 0;
+  if (key == KEY_ARROW_RIGHT || key == KEY_ARROW_DOWN) {
     // moving forward through results.
     direction = 1;
   } else if (key == KEY_ARROW_LEFT || key == KEY_ARROW_UP) {
     // moving backwards through results.
     direction = -1;
-  } else {
-    prev_match_row = -1;
-    direction = 1;
   }
 
-  if (prev_match_row == -1) {
-    // go forward if there was no previous match.
-    direction = 1;
+  if (key == CHAR_TO_CTRL('r')) {
+    // switch between plain and regular expression queries, and search
+    //  for the query again the other way.
+    e_state.find_regex = !e_state.find_regex;
+    Editor_MakeFindPrompt();
+    if (query[0] != '\0') {
+      Editor_FindNear(query, 0);
+    }
+  } else if (key == KEY_RETURN || key == KEY_ESC) {
+    // leaving search mode. RETURN alone goes to the next match of the
+    //  last query.
+    if (key == KEY_RETURN && is_default && e_state.find_match == -1) {
+      Editor_FindNear(query, 1);
+    }
+    Editor_UnmarkMatch();
+  } else if (direction != 0 && e_state.find_match != -1) {
+    // step through the matches, wrapping around at either end.
+    int num_matches = Search_NumMatches();
+    Editor_ShowMatch((e_state.find_match + direction + num_matches) %
+                     num_matches);
+  } else if (direction != 0 && is_default) {
+    Editor_FindNear(query, direction);
+  } else if (direction == 0) {
+    // the query changed, so find all of its matches, and start over from
+    //  where the search started.
+    Editor_FindNear(query, 0);
   }
+}
 
-  // index of the line currently being searched.
-  int cur_match_row = prev_match_row;
+static void Editor_FindNear(const char *query, int direction) {
+  Search_Start(e_state.file_lines, query, e_state.find_regex,
+               e_state.find_origin.row, e_state.find_origin.col, direction);
+  Editor_UnmarkMatch();
+  e_state.find_match = -1;
+  e_state.find_direction = direction;
+  Editor_ShowNearMatch();
+}
 
-  for (int i = 0; i < e_state.num_file_lines; i++) {
-    cur_match_row += direction;
-    if (cur_match_row == -1) {
-      // at the top, so wrap to the bottom and continue searching.
-      cur_match_row = e_state.num_file_lines - 1;
-    } else if (cur_match_row == e_state.num_file_lines) {
-      // at the bottom, so wrap to the top and continue searching.
-      cur_match_row = 0;
-    }
+static void Editor_ShowMatch(int idx) {
+  Editor_MarkMatch(Search_GetMatch(idx));
+  e_state.find_match = idx;
+}
 
-    // alias for current FileLine being searched.
-    FileLine *f_line = &(e_state.file_lines[cur_match_row]);
-    // use strstr to find a substring of the display line containing str.
-    // strstr returns a pointer to the start of the matching substring.
-    char *match_ptr = strstr(f_line->line_display, str);
-    // strstr returns NULL upon finding no matches.
-    if (match_ptr != NULL) {
-      // successful match.
-      // start the next search from this new matched row.
-      prev_match_row = cur_match_row;
-      // the column number of where the match starts is found with
-      //  poitner arithmetic using the display line as a reference.
-      e_state.cursor.col = File_DispToRawIdx(f_line, match_ptr - (f_line->line_display));
-      e_state.cursor.row = cur_match_row;
-      e_state.cur_file_row = e_state.num_file_lines;
-
-      // save the FileLine whose highlight line is being modified.
-      h_line_idx = cur_match_row;
-      // allocate space for the saved highlight line and copy it.
-      h_line_og = malloc(f_line->size_display);
-      memcpy(h_line_og, f_line->highlight, f_line->size_display);
-      // highlight the result by setting the cooresponding values of the highlight
-      //  array to the HL_MATCH color
-      memset(&(f_line->highlight[match_ptr - (f_line->line_display)]), HL_MATCH, strlen(str));
-      break;
+static void Editor_MarkMatch(const SearchResult *match) {
+  Editor_UnmarkMatch();
+  int row = match->cur_row;
+  e_state.cursor.row = row;
+  e_state.cursor.col = match->cur_col;
+  // show the line with the match at the top of the screen.
+  e_state.cur_file_row = e_state.num_file_lines;
+  e_state.cur_wrap_row = 0;
+
+  // highlight the line for the comments and strings above it first, so
+  //  it isn't highlighted again over the match when shown.
+  File_SyncHighlight(e_state.file_lines, row, row + 1, e_state.syntax);
+  FileLine *f_line = File_GetLine(e_state.file_lines, row);
+  File_EnsureDisplay(f_line, e_state.syntax);
+  // save the line's highlight spans to put back later.
+  e_state.marked_row = row;
+  e_state.marked_highlight = File_SaveHighlight(f_line);
+  // highlight the result by giving the matched characters the HL_MATCH
+  //  color.
+  int start = File_RawToDispIdx(f_line, match->cur_col);
+  int end = File_RawToDispIdx(f_line, match->cur_col + match->size);
+  File_SetHighlight(f_line, start, end - start, HL_MATCH);
+}
+
+static void Editor_ShowNearMatch(void) {
+  SearchResult near;
+  if (!Search_IsDone()) {
+    // jump to the match as soon as it is found, and mark it again with
+    //  its index once all are.
+    if (e_state.marked_highlight == NULL && Search_FindNear(&near)) {
+      Editor_MarkMatch(&near);
     }
+    return;
+  }
+  int num_matches = Search_NumMatches();
+  if (num_matches == 0) {
+    return;
+  }
+  int row = e_state.find_origin.row;
+  int col = e_state.find_origin.col;
+  int idx;
+  if (e_state.find_direction > 0) {
+    // skip a match right at the cursor, e.g., the one found last time.
+    idx = Search_FindNext(row, col + 1);
+  } else if (e_state.find_direction < 0) {
+    idx = (Search_FindNext(row, col) + num_matches - 1) % num_matches;
+  } else {
+    idx = Search_FindNext(row, col);
+  }
+  Editor_ShowMatch(idx);
+}
+
+static void Editor_UnmarkMatch(void) {
+  if (e_state.marked_highlight == NULL) {
+    return;
+  }
+  // NOTE: it is impossible for the user to modify the file while
+  //  searching, so marked_row is still the index of the line marked.
+  FileLine *f_line = File_GetLine(e_state.file_lines, e_state.marked_row);
+  // the line may have been paged out and loaded again since.
+  File_EnsureDisplay(f_line, e_state.syntax);
+  File_RestoreHighlight(f_line, e_state.marked_highlight);
+  e_state.marked_highlight = NULL;
+}
+
+static void Editor_FindProgress(void *arg) {
+  (void) arg;
+  if (!e_state.is_finding) {
+    // the search was left before it was done.
+    return;
+  }
+  if (e_state.find_match == -1) {
+    Editor_ShowNearMatch();
   }
-  // no matches found.
+  Editor_Refresh();
 }
@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>   // for fcntl
+#include <limits.h>  // for INT_MAX
+#include <poll.h>
+#include <signal.h>  // for sigaction
+#include <stdbool.h>
+#include <time.h>    // for clock_gettime
+#include <unistd.h>  // for pipe, read, write
+
+#include "EventLoop.h"
+#include "Quit.h"
+
+// the most file descriptors, timers and signals that can be watched at
+//  once.
+#define LOOP_MAX_FDS 8
+#define LOOP_MAX_TIMERS 16
+#define LOOP_MAX_SIGNALS 8
+
+typedef struct {
+  int fd;
+  LoopFn fn;
+  void *arg;
+} Watch;
+
+typedef struct {
+  // 0 if the slot is free.
+  int id;
+  // when the timer is due, in milliseconds of the monotonic clock.
+  long long deadline;
+  LoopFn fn;
+  void *arg;
+} Timer;
+
+typedef struct {
+  int signum;
+  LoopFn fn;
+  void *arg;
+} SignalWatch;
+
+static Watch watches[LOOP_MAX_FDS];
+static int num_watches = 0;
+
+static Timer timers[LOOP_MAX_TIMERS];
+// the id of the last timer added.
+static int last_timer_id = 0;
+
+static SignalWatch signal_watches[LOOP_MAX_SIGNALS];
+static int num_signal_watches = 0;
+// set by the signal handler for each watched signal that arrived.
+static volatile sig_atomic_t signal_pending[LOOP_MAX_SIGNALS];
+
+// the self-pipe: the signal handler writes a byte to its write end to
+//  wake up the poll on its read end. -1 until first needed.
+static int wake_pipe[2] = {-1, -1};
+
+long long Loop_Now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Creates the self-pipe if it doesn't exist yet. Both ends are
+//  non-blocking, so the handler never blocks on a full pipe and the loop
+//  never blocks draining it.
+static void Loop_OpenWakePipe(void) {
+  if (wake_pipe[0] != -1) {
+    return;
+  }
+  if (pipe(wake_pipe) == -1) {
+    quit("Loop_OpenWakePipe");
+  }
+  for (int i = 0; i < 2; i++) {
+    int flags = fcntl(wake_pipe[i], F_GETFL);
+    if (flags == -1 ||
+        fcntl(wake_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1 ||
+        fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC) == -1) {
+      quit("Loop_OpenWakePipe");
+    }
+  }
+}
+
+// The handler of watched signals. Only marks the signal and wakes the
+//  loop, as little else is safe to do in a handler.
+static void Loop_HandleSignal(int signum) {
+  int saved_errno = errno;
+  for (int i = 0; i < num_signal_watches; i++) {
+    if (signal_watches[i].signum == signum) {
+      signal_pending[i] = 1;
+    }
+  }
+  // the pipe may be full, which already wakes the loop.
+  ssize_t res = write(wake_pipe[1], "", 1);
+  (void) res;
+  errno = saved_errno;
+}
+
+void Loop_WatchFd(int fd, LoopFn fn, void *arg) {
+  for (int i = 0; i < num_watches; i++) {
+    if (watches[i].fd == fd) {
+      watches[i].fn = fn;
+      watches[i].arg = arg;
+      return;
+    }
+  }
+  if (num_watches == LOOP_MAX_FDS) {
+    errno = ENOMEM;
+    quit("Loop_WatchFd");
+  }
+  watches[num_watches++] = (Watch) {fd, fn, arg};
+}
+
+void Loop_UnwatchFd(int fd) {
+  for (int i = 0; i < num_watches; i++) {
+    if (watches[i].fd == fd) {
+      watches[i] = watches[--num_watches];
+      return;
+    }
+  }
+}
+
+int Loop_AddTimer(long delay_ms, LoopFn fn, void *arg) {
+  for (int i = 0; i < LOOP_MAX_TIMERS; i++) {
+    if (timers[i].id == 0) {
+      last_timer_id = (last_timer_id == INT_MAX) ? 1 : last_timer_id + 1;
+      timers[i] = (Timer) {last_timer_id, Loop_Now() + delay_ms, fn, arg};
+      return last_timer_id;
+    }
+  }
+  errno = ENOMEM;
+  quit("Loop_AddTimer");
+  return 0;
+}
+
+void Loop_CancelTimer(int id) {
+  if (id == 0) {
+    return;
+  }
+  for (int i = 0; i < LOOP_MAX_TIMERS; i++) {
+    if (timers[i].id == id) {
+      timers[i].id = 0;
+      return;
+    }
+  }
+}
+
+void Loop_WatchSignal(int signum, LoopFn fn, void *arg) {
+  if (num_signal_watches == LOOP_MAX_SIGNALS) {
+    errno = ENOMEM;
+    quit("Loop_WatchSignal");
+  }
+  Loop_OpenWakePipe();
+  signal_pending[num_signal_watches] = 0;
+  signal_watches[num_signal_watches++] = (SignalWatch) {signum, fn, arg};
+
+  struct sigaction action;
+  action.sa_handler = Loop_HandleSignal;
+  sigemptyset(&action.sa_mask);
+  // restart the reads and writes the signal interrupts; poll still
+  //  returns early.
+  action.sa_flags = SA_RESTART;
+  if (sigaction(signum, &action, NULL) == -1) {
+    quit("Loop_WatchSignal");
+  }
+}
+
+// Calls the functions of the timers that are due.
+static void Loop_RunTimers(void) {
+  long long now = Loop_Now();
+  for (int i = 0; i < LOOP_MAX_TIMERS; i++) {
+    if (timers[i].id != 0 && timers[i].deadline <= now) {
+      // free the slot first, so the function can add timers.
+      Timer timer = timers[i];
+      timers[i].id = 0;
+      timer.fn(timer.arg);
+    }
+  }
+}
+
+void Loop_RunOnce(long timeout_ms) {
+  Loop_OpenWakePipe();
+  // wait no longer than until the next timer is due.
+  long long now = Loop_Now();
+  for (int i = 0; i < LOOP_MAX_TIMERS; i++) {
+    if (timers[i].id != 0) {
+      long long until = timers[i].deadline - now;
+      if (until < 0) {
+        until = 0;
+      }
+      if (timeout_ms < 0 || until < timeout_ms) {
+        timeout_ms = until;
+      }
+    }
+  }
+
+  struct pollfd pfds[LOOP_MAX_FDS + 1];
+  pfds[0] = (struct pollfd) {wake_pipe[0], POLLIN, 0};
+  int num_pfds = 1;
+  for (int i = 0; i < num_watches; i++) {
+    pfds[num_pfds++] = (struct pollfd) {watches[i].fd, POLLIN, 0};
+  }
+  if (timeout_ms > INT_MAX) {
+    timeout_ms = INT_MAX;
+  }
+  int res = poll(pfds, num_pfds, (int) timeout_ms);
+  if (res == -1 && errno != EINTR) {
+    quit("Loop_RunOnce");
+  }
+
+  if (pfds[0].revents != 0) {
+    // empty the self-pipe; the pending flags tell which signals came.
+    char drain[64];
+    while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+  }
+  for (int i = 0; i < num_signal_watches; i++) {
+    if (signal_pending[i]) {
+      signal_pending[i] = 0;
+      signal_watches[i].fn(signal_watches[i].arg);
+    }
+  }
+  for (int i = 1; res > 0 && i < num_pfds; i++) {
+    if (pfds[i].revents == 0) {
+      continue;
+    }
+    // look the descriptor up again, as an earlier function may have
+    //  stopped watching it.
+    for (int j = 0; j < num_watches; j++) {
+      if (watches[j].fd == pfds[i].fd) {
+        watches[j].fn(watches[j].arg);
+        break;
+      }
+    }
+  }
+  Loop_RunTimers();
+}
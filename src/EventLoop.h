@@ -0,0 +1,48 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+// The event loop the editor sleeps in between frames. It waits in one
+//  poll(2) for input on any watched file descriptor, for the next timer
+//  to be due, or for a watched signal, and then calls the functions
+//  registered for whatever happened. Signals are turned into input on a
+//  pipe (the self-pipe trick), so their functions run in the loop rather
+//  than in a signal handler. An idle editor sleeps without waking up.
+
+#include <stdbool.h>
+
+// a function called by the loop with the arg it was registered with.
+typedef void (*LoopFn)(void *arg);
+
+// Calls fn with arg from the loop each time fd has input to read, or is
+//  closed. Replaces the function fd was watched with before, if any.
+//  Calls quit if too many descriptors are watched.
+void Loop_WatchFd(int fd, LoopFn fn, void *arg);
+
+// Stops watching fd. Does nothing if it isn't watched.
+void Loop_UnwatchFd(int fd);
+
+// Calls fn with arg from the loop once, delay_ms milliseconds from now.
+//  Returns the id of the timer, which is never 0, for Loop_CancelTimer.
+//  Calls quit if too many timers are pending.
+int Loop_AddTimer(long delay_ms, LoopFn fn, void *arg);
+
+// Cancels the timer with the given id. Does nothing if it already went
+//  off or was cancelled, or if id is 0.
+void Loop_CancelTimer(int id);
+
+// Calls fn with arg from the loop after signum is delivered; signals that
+//  arrive before the loop gets to them are taken together. Calls quit if
+//  the handler can't be installed or too many signals are watched.
+void Loop_WatchSignal(int signum, LoopFn fn, void *arg);
+
+// Returns the time of the monotonic clock the timers run on, in
+//  milliseconds.
+long long Loop_Now(void);
+
+// Sleeps until a watched descriptor has input, a timer is due or a
+//  watched signal arrives, for at most timeout_ms milliseconds (or with
+//  no limit if it is negative), then calls the functions of all that
+//  happened. Calls quit if polling fails.
+void Loop_RunOnce(long timeout_ms);
+
+#endif  // EVENT_LOOP_H_
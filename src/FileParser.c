@@ -2,10 +2,12 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "FileParser.h"
+#include "Arena.h"
 #include "IOUtils.h"
 #include "Quit.h"
 
-#include <sys/stat.h>  // for struct stat
+#include <sys/stat.h>  // for struct stat, umask
+#include <sys/mman.h>  // for mmap
 #include <fcntl.h>
 #include <stdlib.h>  // for NULL
 #include <string.h>  // for strchr
@@ -13,195 +15,678 @@
 #include <stdio.h>
 
 #include "SyntaxHL.h"
+#include "LineTree.h"
+#include "Ingest.h"
+#include "TabScan.h"
 
 #include <stdbool.h>  // for boolean type
 
 #include <ctype.h>  // for isdigit
+#include <errno.h>
+#include <limits.h>  // for INT_MAX
 
 // the size of a single tab character in number of spaces (" ").
-#define TAB_SIZE 8
+#define TAB_SIZE TS_TAB_SIZE
 // a single tab character.
 #define TAB '\t'
 // a single space character.
 #define SPACE_CHAR ' '
 // the default permissions for a text file. (user: rw; others: r)
 #define PERMS_DEFAULT 0644
+// the minimum number of free bytes in the gap of a line after it grows.
+#define GAP_MIN 16
+// the number of display characters after an edit that are made
+//  contiguous for the lexer to catch up with the old highlighting.
+#define RELEX_WINDOW 256
+// the suffix of the temporary file written by File_Save before it is
+//  renamed over the target file. the X's are replaced by mkstemp.
+#define SAVE_TMP_SUFFIX ".ctek-XXXXXX"
+// the size of the buffer lines are written through by File_Save.
+#define SAVE_BUF_SIZE (1024 * 1024)
+// the number of loaded leaves of lines kept in paging mode before the
+//  ones far from the screen are unloaded.
+#define PAGING_MAX_LOADED 1024
+// the number of lines around the screen kept loaded by File_PageOut.
+#define PAGING_MARGIN (64 * LT_LEAF_MAX)
+// the most lines looked back at for a line with a known lexer state
+//  before the state above them is taken to be LEX_NORMAL.
+#define LEX_SYNC_LINES 1000
+
+// the memory-mapped contents of the open file. lines that have not
+//  been edited point into this mapping, so it stays mapped until
+//  File_FreeLines is called.
+static char *file_map = NULL;
+// the size of the mapping in bytes.
+static size_t file_map_size = 0;
+// the device and inode of the mapped file, to tell if a file saved to is
+//  the one open.
+static dev_t file_map_dev = 0;
+static ino_t file_map_ino = 0;
+// true if the mapping is of a copy of the file, as the file was
+//  overwritten in place (see File_Save).
+static bool is_map_detached = false;
+// the arena holding the open file's FileLines tree and every buffer its
+//  lines own, so closing the file frees them all at once.
+static Arena *line_arena = NULL;
+// true if the open file is in paging mode: it is mapped, only the index
+//  of its runs of lines is kept in memory, and the lines far from the
+//  screen are dropped again (see File_PageOut).
+static bool paging = false;
+// the current generation of lexer states (see FileLine's lex_gen). never
+//  0, which is the generation of lines whose state was never set.
+static unsigned char lex_gen = 1;
+// true if an edit changed the lexer state at the end of a line, or lost
+//  track of it, since File_LineEdited was last called.
+static bool lex_out_changed = false;
 
 // static int File_Open(const char *file_name, int *fd, int *size);
 static int validate_idx(int idx, int size);
 
-// Returns a pointer to a string containing all the lines from the given
-//  FileLines array containing num_lines FileLines. The caller is 
-//  responsible for free'ing the returned pointer. Upon return,
-//  file_size contains the size of the allocated buffer/string.
-const unsigned char *File_ToString(FileLine **file_lines, int num_lines,
-                    int *file_size) {
-  for (int i = 0; i < num_lines; i++) {
-    // calculate the total number of bytes per line (plus 1 for newline
-    //  characters for each line). set the total in the output parameter.
-    *file_size += (*file_lines)[i].size + 1;
-  }
-
-  // malloc space for the string.
-  char *buf = (char *) malloc(*file_size);
-  if (buf == NULL) {
-    // malloc failed.
-    return NULL;
+// Writes f_line and a newline to the FILE * arg. Used with LT_Walk.
+static bool File_WriteLine(FileLine *f_line, void *arg) {
+  FILE *f_ptr = arg;
+  return fwrite(File_LineText(f_line), 1, f_line->size, f_ptr) ==
+             (size_t) f_line->size &&
+         putc('\n', f_ptr) != EOF;
+}
+
+// Creates a temporary file next to path, with the owner and permissions
+//  of st, the file it will replace, or the default permissions less the
+//  umask if st is NULL. Returns its descriptor and sets *tmp_name to its
+//  name, or returns -1 if it can't be made just so (e.g., in a directory
+//  that can't be written to).
+static int File_OpenTemp(const char *path, const struct stat *st,
+                         char **tmp_name) {
+  *tmp_name = malloc(strlen(path) + sizeof(SAVE_TMP_SUFFIX));
+  if (*tmp_name == NULL) {
+    return -1;
   }
-  // an index into the string buffer.
-  char *buf_idx = buf;
+  strcpy(*tmp_name, path);
+  strcat(*tmp_name, SAVE_TMP_SUFFIX);
 
-  for (int i = 0; i < num_lines; i++) {
-    // copy the line into the buffer at the apprpriate lcoation.
-    memcpy(buf_idx, (*file_lines)[i].line, (*file_lines)[i].size);
-    // move the buffer index pointer ahead of the copied line.
-    buf_idx += (*file_lines)[i].size;
-    // set the end of the line with a newline character.
-    *buf_idx = '\n';
-    // increment the buffer index.
-    buf_idx++;
+  int fd = mkstemp(*tmp_name);
+  if (fd == -1) {
+    // mkstemp error.
+    free(*tmp_name);
+    *tmp_name = NULL;
+    return -1;
   }
+  // a new file gets the default permissions less the umask, as open
+  //  would give it. umask can only be read by setting it.
+  mode_t mode;
+  if (st != NULL) {
+    mode = st->st_mode & 07777;
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = PERMS_DEFAULT & ~mask;
+  }
+  // the owner is set first, as changing it may clear the mode's set-id
+  //  bits.
+  if ((st != NULL && fchown(fd, st->st_uid, st->st_gid) == -1) ||
+      fchmod(fd, mode) == -1) {
+    close(fd);
+    unlink(*tmp_name);
+    free(*tmp_name);
+    *tmp_name = NULL;
+    return -1;
+  }
+  return fd;
+}
 
-  return (const unsigned char *) buf;
+// Maps a copy of the open file in place of its mapping, so the lines
+//  that point into it keep their text while the file is overwritten in
+//  place. Returns false on error.
+static bool File_DetachMap(void) {
+  if (file_map == NULL || is_map_detached) {
+    return true;
+  }
+  // the copy is written to a temporary file rather than to memory, so a
+  //  huge file doesn't have to fit in it. the file is removed once it is
+  //  unmapped.
+  FILE *copy = tmpfile();
+  if (copy == NULL) {
+    return false;
+  }
+  // mapping the copy over the mapping of the file replaces its pages at
+  //  once, so the lines (and the search workers reading them) never see
+  //  anything but their text.
+  if (fwrite(file_map, 1, file_map_size, copy) != file_map_size ||
+      fflush(copy) == EOF ||
+      mmap(file_map, file_map_size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+           fileno(copy), 0) == MAP_FAILED) {
+    int saved_errno = errno;
+    fclose(copy);
+    errno = saved_errno;
+    return false;
+  }
+  // the mapping stays valid after the file is closed.
+  fclose(copy);
+  is_map_detached = true;
+  return true;
 }
 
-int File_Save(const char *file_name, FileLine **file_lines,
-               int num_lines) {
-  // TODO: write to a temporary file, then rename the file to avoid
-  //  issues with truncating.
-  if (file_name == NULL) {
-    // this check is handeled in Editor
+// Writes the lines of file_lines to fd, flushes them to disk and closes
+//  fd. Returns the number of bytes written, or -1 on error.
+static long File_WriteLines(int fd, FileLines *file_lines) {
+  FILE *f_ptr = fdopen(fd, "w");
+  if (f_ptr == NULL) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
     return -1;
   }
+  // the lines are streamed out through a large buffer rather than copied
+  //  into one string first, so a file of any size can be saved. lines
+  //  that are not loaded are written straight from the mapping.
+  setvbuf(f_ptr, NULL, _IOFBF, SAVE_BUF_SIZE);
 
-  int file_size = 0;
-  const unsigned char *file_str = File_ToString(file_lines, num_lines, &file_size);
-  // O_RDWR: open for reading and writing.
-  // O_CREAT: create the file with the given name if it doesn't exist.
-  // 0644: default permissions for a newly created file (user: rw; others: r)
-  int fd = open(file_name, O_RDWR | O_CREAT, PERMS_DEFAULT);
-  if (fd == -1) {
-    // open error.
-    free((void *) file_str);
+  bool is_written = (file_lines == NULL) ||
+                    LT_Walk(file_lines, File_WriteLine, f_ptr);
+  long file_size = ftell(f_ptr);
+  // the text must be on disk before the file is renamed over the old one,
+  //  or a crash could leave an empty file in its place.
+  if (!is_written || file_size == -1 || fflush(f_ptr) == EOF ||
+      fsync(fd) == -1) {
+    // write error. keep errno for the caller's error message.
+    int saved_errno = errno;
+    fclose(f_ptr);
+    errno = saved_errno;
     return -1;
   }
+  return (fclose(f_ptr) == EOF) ? -1 : file_size;
+}
 
-  // make the file have a size of file_size, since the new file_str
-  //  might contain fewer characters than was already in the file,
-  //  so discard whatever was not overwritten. also, pad with \0
-  //  bytes if the file is shorter than file_size.
-  if (ftruncate(fd, file_size) == -1) {
-    // ftruncate error.
-    close(fd);
-    free((void *) file_str);
+long File_Save(const char *file_name, FileLines *file_lines) {
+  if (file_name == NULL) {
+    // this check is handeled in Editor
     return -1;
   }
 
-  if (WrappedWrite(fd, file_str, file_size) != file_size) {
-    // write error. clean up regardless.
+  // follow symbolic links, so the file they point to is replaced rather
+  //  than the link.
+  char *path = realpath(file_name, NULL);
+  if (path == NULL) {
+    if (errno != ENOENT || (path = strdup(file_name)) == NULL) {
+      return -1;
+    }
   }
+  struct stat st;
+  bool exists = (stat(path, &st) == 0);
 
-  close(fd);
-  free((void *) file_str);
+  // write to a temporary file in the same directory, then rename it over
+  //  the target, so a crash never leaves a partly written file. unedited
+  //  lines still point into the mapping of the original file, which the
+  //  rename leaves as it was. hard links would be broken off, though.
+  char *tmp_name = NULL;
+  int fd = -1;
+  if (!exists || st.st_nlink == 1) {
+    fd = File_OpenTemp(path, exists ? &st : NULL, &tmp_name);
+  }
+  if (fd == -1) {
+    // overwrite the file in place instead, which keeps its links and
+    //  owner. the mapping must not follow the file if it is the one open.
+    if (exists && st.st_dev == file_map_dev && st.st_ino == file_map_ino &&
+        !File_DetachMap()) {
+      free(path);
+      return -1;
+    }
+    // O_CREAT: create the file with the given name if it doesn't exist.
+    // O_TRUNC: discard whatever was in the file.
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, PERMS_DEFAULT);
+    if (fd == -1) {
+      // open error.
+      int saved_errno = errno;
+      free(path);
+      errno = saved_errno;
+      return -1;
+    }
+  }
+
+  long file_size = File_WriteLines(fd, file_lines);
+  if (tmp_name != NULL &&
+      (file_size == -1 || rename(tmp_name, path) == -1)) {
+    // write or rename error. remove the temporary file, keeping errno
+    //  for the caller's error message.
+    int saved_errno = errno;
+    unlink(tmp_name);
+    errno = saved_errno;
+    file_size = -1;
+  }
+  int saved_errno = errno;
+  free(tmp_name);
+  free(path);
+  errno = saved_errno;
   return file_size;
 }
 
-static int StrCount(const char *str, int size, char target) {
-  int count = 0;
-  for (int i = 0; i < size; i++) {
-    if (str[i] == target) {
-      count++;
-    }
+// Returns the number of display columns taken by c at display column col.
+static int File_CharWidth(char c, int col) {
+  // a tab reaches the nearest column number divisible by TAB_SIZE.
+  return (c == TAB) ? TAB_SIZE - (col % TAB_SIZE) : 1;
+}
+
+// Copies a line that points into the memory-mapped file into a gap
+//  buffer owned by the FileLine, so it can be modified. Does nothing
+//  if the line is already owned.
+static void File_Materialize(FileLine *f_line) {
+  if (f_line->is_owned) {
+    return;
+  }
+  int capacity = Arena_RoundUp(f_line->size + GAP_MIN);
+  char *owned = Arena_Alloc(line_arena, capacity);
+  memcpy(owned, f_line->line, f_line->size);
+  f_line->line = owned;
+  f_line->is_owned = true;
+  f_line->capacity = capacity;
+  // the gap starts out at the end of the line.
+  f_line->gap = f_line->size;
+  f_line->gap_size = capacity - f_line->size;
+  f_line->gap_tabs = 0;
+}
+
+// Moves the gap of an owned line so that it starts at index idx.
+static void File_MoveGap(FileLine *f_line, int idx) {
+  char *line = f_line->line;
+  if (idx < f_line->gap) {
+    // move the text in [idx, gap) to after the gap.
+    f_line->gap_tabs += TS_CountTabs(&(line[idx]), f_line->gap - idx);
+    memmove(&(line[idx + f_line->gap_size]), &(line[idx]), f_line->gap - idx);
+  } else if (idx > f_line->gap) {
+    // move the text after the gap up to idx in front of the gap.
+    char *gap_end = &(line[f_line->gap + f_line->gap_size]);
+    f_line->gap_tabs -= TS_CountTabs(gap_end, idx - f_line->gap);
+    memmove(&(line[f_line->gap]), gap_end, idx - f_line->gap);
   }
-  return count;
+  f_line->gap = idx;
+}
+
+// Grows an owned line geometrically until its gap holds more than
+//  num_chars bytes. One byte is always left over, so File_LineText can
+//  null-terminate the line.
+static void File_ReserveGap(FileLine *f_line, int num_chars) {
+  if (f_line->gap_size > num_chars) {
+    return;
+  }
+  int capacity = f_line->capacity * 2;
+  if (capacity < f_line->size + num_chars + GAP_MIN) {
+    capacity = f_line->size + num_chars + GAP_MIN;
+  }
+  capacity = Arena_RoundUp(capacity);
+  char *grown = Arena_Alloc(line_arena, capacity);
+  // copy the text before the gap to the start of the grown buffer, and
+  //  the text after it to the end.
+  int tail_size = f_line->size - f_line->gap;
+  memcpy(grown, f_line->line, f_line->gap);
+  memcpy(&(grown[capacity - tail_size]),
+         &(f_line->line[f_line->gap + f_line->gap_size]), tail_size);
+  Arena_Free(line_arena, f_line->line, f_line->capacity);
+  f_line->line = grown;
+  f_line->capacity = capacity;
+  f_line->gap_size = capacity - f_line->size;
+}
+
+// Moves the gap of line_display so that it starts at display index idx.
+static void File_MoveDisplayGap(FileLine *f_line, int idx) {
+  char *disp = f_line->line_display;
+  int gap = f_line->disp_gap;
+  int gap_size = f_line->disp_gap_size;
+  if (idx < gap) {
+    // move the text in [idx, gap) to after the gap.
+    memmove(&(disp[idx + gap_size]), &(disp[idx]), gap - idx);
+  } else if (idx > gap) {
+    // move the text after the gap up to idx in front of the gap.
+    memmove(&(disp[gap]), &(disp[gap + gap_size]), idx - gap);
+  }
+  f_line->disp_gap = idx;
+}
+
+// Grows line_display until its gap holds more than num_chars characters.
+//  Blocks are allocated exactly for their first use and then grow
+//  geometrically as the line is edited. One byte is always left over, so
+//  File_DisplayText can null-terminate the line.
+static void File_ReserveDisplayGap(FileLine *f_line, int num_chars) {
+  if (f_line->disp_gap_size > num_chars) {
+    return;
+  }
+  int min_capacity = f_line->size_display + num_chars + 1;
+  int capacity = (f_line->line_display == NULL) ?
+                 min_capacity : f_line->display_capacity * 2;
+  if (capacity < min_capacity) {
+    capacity = min_capacity + GAP_MIN;
+  }
+  capacity = Arena_RoundUp(capacity);
+  char *display = Arena_Alloc(line_arena, capacity);
+  // copy the text before the gap to the start of the grown buffer, and
+  //  the text after it to its end.
+  int gap = f_line->disp_gap;
+  int gap_end = gap + f_line->disp_gap_size;
+  int tail_size = f_line->size_display - gap;
+  if (f_line->line_display != NULL) {
+    memcpy(display, f_line->line_display, gap);
+    memcpy(&(display[capacity - tail_size]), &(f_line->line_display[gap_end]),
+           tail_size);
+    Arena_Free(line_arena, f_line->line_display, f_line->display_capacity);
+  }
+  f_line->line_display = display;
+  f_line->display_capacity = capacity;
+  f_line->disp_gap_size = capacity - f_line->size_display;
 }
 
 // Copies the file_line's line into its line_display and replaces
 //  all non-renderable characters (like tabs) with appropriate
 //  substitutes (like " " (spaces) for tabs).
 static void File_SetLineDisplay(FileLine *file_line, Syntax *syntax) {
+  // the text is split in two by the gap.
+  const char *head = file_line->line;
+  int head_size = file_line->gap;
+  const char *tail = &(file_line->line[file_line->gap + file_line->gap_size]);
+  int tail_size = file_line->size - file_line->gap;
+
   // find how much memory to allocate for tab conversion.
-  int num_tabs = StrCount(file_line->line, file_line->size, TAB);
-
-  free(file_line->line_display);
-  // TODO: use realloc here instead of free and malloc ?
-  file_line->line_display = malloc(file_line->size + (num_tabs * (TAB_SIZE - 1)) + 1);
-
-  // after loop, idx_line_disp contains num chars copied to line_display.
-  int idx_line_disp = 0;
-  for (int idx_line = 0; idx_line < file_line->size; idx_line++) {
-    if (file_line->line[idx_line] == TAB) {
-      // when replacing tabs, always insert 1 space, then check and
-      //  add more so the line reaches the nearest column number
-      //  divisible by TAB_SIZE.
-      file_line->line_display[idx_line_disp++] = SPACE_CHAR;
-      while (idx_line_disp % TAB_SIZE != 0) {
-        file_line->line_display[idx_line_disp++] = SPACE_CHAR;
-      }
+  int size_display = TS_Expand(tail, tail_size,
+                               TS_Expand(head, head_size, 0, NULL), NULL);
+  // drop the old display, if any, by making it all gap.
+  file_line->size_display = 0;
+  file_line->disp_gap = 0;
+  file_line->disp_gap_size = file_line->display_capacity;
+  File_ReserveDisplayGap(file_line, size_display);
+
+  char *disp = file_line->line_display;
+  TS_Expand(tail, tail_size, TS_Expand(head, head_size, 0, disp), disp);
+  disp[size_display] = '\0';
+  file_line->size_display = size_display;
+  file_line->disp_gap = size_display;
+  file_line->disp_gap_size = file_line->display_capacity - size_display;
+  // the line changed, so forget any cached index conversion.
+  file_line->map_raw = 0;
+  file_line->map_disp = 0;
+
+  file_line->lex_out = Syntax_SetHighlight(syntax, file_line->line_display,
+                                           file_line->size_display,
+                                           &(file_line->highlight),
+                                           file_line->lex_in, line_arena);
+}
+
+// Updates line_display and highlight after num_removed characters
+//  (copied in removed) at raw index raw_idx were replaced by num_inserted
+//  characters, which directly precede the gap. Only the edited characters
+//  are expanded: the display gap is moved to the edit, so the text after
+//  it doesn't move unless a tab changes width, and then only the run of
+//  text up to that tab moves. Highlighting is redone for the edited token
+//  only, until the lexer is back in sync with the old codes.
+static void File_UpdateDisplay(FileLine *f_line, int raw_idx,
+                               const char *removed, int num_removed,
+                               int num_inserted, Syntax *syntax) {
+  if (f_line->map_raw > raw_idx) {
+    // the cached conversion lies after the edit, so it is stale. it is
+    //  kept by lines that were never rendered too.
+    f_line->map_raw = 0;
+    f_line->map_disp = 0;
+  }
+  if (f_line->line_display == NULL) {
+    // the line has not been rendered yet, so there is nothing to update,
+    //  but the state at its end has to be found again.
+    f_line->lex_out = LEX_UNKNOWN;
+    lex_out_changed = true;
+    return;
+  }
+  // the text before the edit is unchanged, so so is its display.
+  int disp_idx = File_RawToDispIdx(f_line, raw_idx);
+  // the display columns right after the removed and inserted characters.
+  int old_end = TS_Expand(removed, num_removed, disp_idx, NULL);
+  int new_end = TS_Expand(&(f_line->line[raw_idx]), num_inserted,
+                          disp_idx, NULL);
+
+  // the unchanged text after the edit directly follows the gap. find the
+  //  run of it before the first tab, which only shifts by the change in
+  //  width of the edited characters.
+  const char *rest = &(f_line->line[f_line->gap + f_line->gap_size]);
+  const char *tab = (f_line->gap_tabs == 0) ? NULL :
+                    memchr(rest, TAB, f_line->size - f_line->gap);
+  int run_size = (tab == NULL) ? f_line->size - f_line->gap : tab - rest;
+
+  // the display columns after the run and its tab, before and after.
+  int tail_old = old_end + run_size;
+  int tail_new = new_end + run_size;
+  if (tab != NULL) {
+    tail_old += File_CharWidth(TAB, tail_old);
+    tail_new += File_CharWidth(TAB, tail_new);
+  }
+  // the display that changes is [disp_idx, region_old), which becomes
+  //  [disp_idx, region_new). unless the tab changes width, that's only
+  //  the edited characters, as the rest just shifts along with the gap.
+  bool tab_resized = (tail_new - tail_old != new_end - old_end);
+  int region_old = tab_resized ? tail_old : old_end;
+  int region_new = tab_resized ? tail_new : new_end;
+  int growth = region_new - region_old;
+
+  // bring the changed display in front of the gap. the gap was left at
+  //  the last edit, so while typing this moves at most a window's worth.
+  File_MoveDisplayGap(f_line, region_old);
+  File_ReserveDisplayGap(f_line, growth);
+  char *disp = f_line->line_display;
+  if (tab_resized) {
+    // move the run to its new place, and expand the tab after it.
+    memmove(&(disp[new_end]), &(disp[old_end]), run_size);
+    memset(&(disp[new_end + run_size]), SPACE_CHAR,
+           tail_new - (new_end + run_size));
+  }
+  TS_Expand(&(f_line->line[raw_idx]), num_inserted, disp_idx, disp);
+  f_line->disp_gap = region_new;
+  f_line->disp_gap_size -= growth;
+  f_line->size_display += growth;
+  // the spans after the changed display move along with it.
+  HS_Edit(f_line->highlight, disp_idx, region_old - disp_idx,
+          region_new - disp_idx);
+
+  // the next edit is most likely right after this one.
+  f_line->map_raw = raw_idx + num_inserted;
+  f_line->map_disp = new_end;
+
+  // the lexer needs contiguous text, so make a window after the edit
+  //  contiguous. it is usually back in sync well within the window.
+  int size = f_line->size_display;
+  int window_end = region_new + RELEX_WINDOW;
+  if (window_end > size) {
+    window_end = size;
+  }
+  File_DisplayText(f_line, window_end, syntax);
+  int limit = (window_end == size) ? size : window_end - LEX_LOOKAHEAD;
+  unsigned char lex_out = f_line->lex_out;
+  if (Syntax_UpdateHighlight(syntax, disp, size, &(f_line->highlight),
+                             disp_idx, region_new, limit, f_line->lex_in,
+                             &lex_out, line_arena) < 0) {
+    // the edit changed the highlighting past the window (e.g., it opened
+    //  a string), so relex up to the end of the line.
+    File_DisplayText(f_line, size, syntax);
+    Syntax_UpdateHighlight(syntax, disp, size, &(f_line->highlight),
+                           disp_idx, region_new, size, f_line->lex_in,
+                           &lex_out, line_arena);
+  }
+  if (lex_out != f_line->lex_out) {
+    f_line->lex_out = lex_out;
+    lex_out_changed = true;
+  }
+}
+
+// Returns true if the lexer state at the start of f_line is known to
+//  follow from the lines above it.
+static bool File_LexValid(FileLine *f_line) {
+  return f_line->lex_gen == lex_gen && f_line->lex_in != LEX_UNKNOWN;
+}
+
+// Sets the generation of f_line's lexer state to 0. Used with LT_Walk.
+static bool File_ClearLexGen(FileLine *f_line, void *arg) {
+  (void) arg;
+  f_line->lex_gen = 0;
+  return true;
+}
+
+// Forgets the lexer states of all lines, by starting a new generation.
+static void File_ForgetLexStates(FileLines *file_lines) {
+  lex_gen++;
+  if (lex_gen == 0) {
+    // the generations wrapped around, so lines of old generations could
+    //  pass for current ones. clear them all.
+    LT_Walk(file_lines, File_ClearLexGen, NULL);
+    lex_gen = 1;
+  }
+}
+
+// Sets the lexer state at the start of f_line to state, highlighting its
+//  display again if it was lexed from another state, and makes sure the
+//  state at its end is known.
+static void File_SetLexIn(FileLine *f_line, unsigned char state,
+                          Syntax *syntax) {
+  unsigned char old_in = (f_line->lex_in == LEX_UNKNOWN) ?
+                         LEX_NORMAL : f_line->lex_in;
+  f_line->lex_in = state;
+  f_line->lex_gen = lex_gen;
+  if (old_in != state) {
+    if (f_line->line_display != NULL) {
+      File_DisplayText(f_line, f_line->size_display, syntax);
+      f_line->lex_out = Syntax_SetHighlight(syntax, f_line->line_display,
+                                            f_line->size_display,
+                                            &(f_line->highlight), state,
+                                            line_arena);
     } else {
-      file_line->line_display[idx_line_disp++] = file_line->line[idx_line];
+      f_line->lex_out = LEX_UNKNOWN;
     }
   }
-  file_line->line_display[idx_line_disp] = '\0';
-  file_line->size_display = idx_line_disp;
+  if (f_line->lex_out == LEX_UNKNOWN) {
+    // only the comments and strings of the line matter for its end.
+    f_line->lex_out = Syntax_ScanState(syntax, File_LineText(f_line),
+                                       f_line->size, state);
+  }
+}
 
-  Syntax_SetHighlight(syntax, file_line->line_display,
-                      file_line->size_display, &(file_line->highlight));
+// Makes the lexer states of the lines [first, last) follow from the lines
+//  above them, then carries the state at the end of the last one on to
+//  the lines below until a line already starts in the state it is given.
+//  If changed, the states at the end of the lines in the range may have
+//  changed even where the states at their start did not.
+static void File_SyncLex(FileLines *file_lines, int first, int last,
+                         bool changed, Syntax *syntax) {
+  if (syntax == NULL || file_lines == NULL || file_lines->num_lines == 0) {
+    return;
+  }
+  if (first >= file_lines->num_lines) {
+    first = file_lines->num_lines - 1;
+  }
+  if (first < 0) {
+    first = 0;
+  }
+  // start from the nearest line at or above first with a known state.
+  //  the first line always starts out of any comment or string.
+  int anchor = first;
+  int lower = (first > LEX_SYNC_LINES) ? first - LEX_SYNC_LINES : 0;
+  FileLine *f_line = File_GetLine(file_lines, anchor);
+  while (anchor > lower && (f_line == NULL || !File_LexValid(f_line))) {
+    f_line = File_GetLine(file_lines, --anchor);
+  }
+  unsigned char state = (anchor > 0 && File_LexValid(f_line)) ?
+                        f_line->lex_in : LEX_NORMAL;
+
+  // true if the state given to the current line may differ from the
+  //  one its own state at the end was found from.
+  bool carry = changed;
+  LTIter iter;
+  LT_IterInit(file_lines, &iter, anchor);
+  for (int idx = anchor; (f_line = LT_IterNext(&iter)) != NULL; idx++) {
+    bool valid = File_LexValid(f_line);
+    if (idx >= last && !carry && valid && f_line->lex_in == state) {
+      // the line, and so the ones below it, already follow from here.
+      return;
+    }
+    if (idx >= last && !valid) {
+      if (carry) {
+        // the lines below may depend on this line's old state, which is
+        //  unknown, so none of their states can be trusted anymore.
+        File_ForgetLexStates(file_lines);
+      }
+      return;
+    }
+    unsigned char old_in = f_line->lex_in;
+    unsigned char old_out = f_line->lex_out;
+    File_SetLexIn(f_line, state, syntax);
+    if (valid) {
+      carry = (old_in != state) && (f_line->lex_out != old_out);
+    }
+    if (idx < last) {
+      carry = carry || changed;
+    }
+    state = f_line->lex_out;
+  }
+}
+
+// Returns a new, empty FileLines for the open file, creating the arena
+//  for its lines if needed.
+static FileLines *File_NewLines(void) {
+  if (line_arena == NULL) {
+    line_arena = Arena_New();
+  }
+  return LT_New(line_arena);
 }
 
 // Insert the given string 'str' with the given size 'size'
 //  to the given array of FileLines as a new FileLine struct
-//  at position idx.
+//  at position idx, without syncing the lexer states of the lines
+//  around it. Returns false if idx is out of range.
 //  'num_lines' is the number of FileLine objects in 'f_lines'.
 //  'num_lines' is incremented by 1 after the operation.
-void File_InsertFileLine(FileLine **f_lines, int *num_lines,
+static bool File_InsertLine(FileLines **f_lines, int *num_lines,
                             const char *str, size_t size,
                             int idx, Syntax *syntax) {
-  if (idx < 0 || idx > *num_lines) {
-    return;
+  if (*f_lines == NULL) {
+    // the first line of a new file.
+    *f_lines = File_NewLines();
+  }
+  if (idx < 0 || idx > (*f_lines)->num_lines) {
+    return false;
   }
 
-  // increase the size of the array by an extra sizeof(FileLine).
-  *f_lines = realloc(*f_lines, (*num_lines + 1) * sizeof(FileLine));
-  // make room for the new FileLine at the given target index.
-  memmove(&((*f_lines)[idx + 1]), &((*f_lines)[idx]),
-          (*num_lines - idx) * sizeof(FileLine));
-
-  (*f_lines)[idx].size = size;
-  // malloc a buffer for the line in the new FileLine struct at the end.
-  (*f_lines)[idx].line = malloc(size + 1);
-
-  // copy the line into the malloc'ed buffer.
-  memcpy((*f_lines)[idx].line, str, size);
-  // null-terminate the line.
-  (*f_lines)[idx].line[size] = '\0';
+  FileLine f_line = {0};
+  f_line.size = size;
+  // allocate a gap buffer for the line in the new FileLine struct.
+  f_line.capacity = Arena_RoundUp(size + GAP_MIN);
+  f_line.line = Arena_Alloc(line_arena, f_line.capacity);
 
-  // initialize the display line fields.
-  (*f_lines)[idx].size_display = 0;
-  (*f_lines)[idx].line_display = NULL;
-  (*f_lines)[idx].highlight = NULL;
+  // copy the line into the new buffer, leaving the gap at the end.
+  memcpy(f_line.line, str, size);
+  f_line.gap = size;
+  f_line.gap_size = f_line.capacity - size;
+  f_line.is_owned = true;
 
   // initialize the display line for the new FileLine struct.
-  File_SetLineDisplay(&((*f_lines)[idx]), syntax);
+  File_SetLineDisplay(&f_line, syntax);
 
-  (*num_lines)++;
+  // add the new FileLine to the tree at the target index.
+  LT_Insert(*f_lines, idx, &f_line);
+  *num_lines = (*f_lines)->num_lines;
+  return true;
+}
+
+void File_InsertFileLine(FileLines **f_lines, int *num_lines,
+                            const char *str, size_t size,
+                            int idx, Syntax *syntax) {
+  if (File_InsertLine(f_lines, num_lines, str, size, idx, syntax)) {
+    File_SyncLex(*f_lines, idx, idx + 1, true, syntax);
+  }
 }
 
-FileLine *File_GetLines(const char *file_name, int *size, Syntax *syntax) {
+// Reads the lines of a file that cannot be memory-mapped (e.g., a pipe)
+//  with getline, inserting a new FileLine for each line read.
+static FileLines *File_ReadLines(int fd, int *size, Syntax *syntax) {
   // read in a single line from the given file.
   // returns a buffer up to the first \r or \n in the file.
-  FILE *f_ptr = fopen(file_name, "r");
+  FILE *f_ptr = fdopen(fd, "r");
   if (f_ptr == NULL) {
-    quit("fopen");
+    close(fd);
+    quit("fdopen");
   }
 
-  // malloc space for the array of FileLines
-  // FileLine *lines = (FileLine *) malloc(sizeof(FileLine));
-  // if (lines == NULL) {
-  //   fclose(f_ptr);
-  //   quit("malloc'ing FileLine");
-  // }
-  FileLine *lines = NULL;
+  FileLines *lines = File_NewLines();
   int num_lines = 0;
 
   // use getline to get the first line from the file.
@@ -216,7 +701,7 @@ FileLine *File_GetLines(const char *file_name, int *size, Syntax *syntax) {
       line_size--;
     }
     // inser the new FileLine at the end of the array.
-    File_InsertFileLine(&lines, &num_lines, line, line_size, num_lines, syntax);
+    File_InsertLine(&lines, &num_lines, line, line_size, num_lines, syntax);
   }
 
   // set the output parameters with the number of lines read.
@@ -228,63 +713,256 @@ FileLine *File_GetLines(const char *file_name, int *size, Syntax *syntax) {
   fclose(f_ptr);
 
   return lines;
-  // int size;
-  // char *file_str = File_ToString(file_name, &size);
-  // if (file_str == NULL) {
-  //   return NULL;
-  // }
-  // int idx = (int) (strchr(file_str, '\n') - file_str);
-  // if (idx > 0)
-  // file_str[idx] = '\0';
-  // fprintf(stderr, "made it\n");
-  // return file_str;
-}
-
-void File_FreeLines(FileLine *file_lines, int num_lines) {
-  for (int i = 0; i < num_lines; i++) {
-    // free the line from each FileLine struct.
-    free(file_lines[i].line);
-    free(file_lines[i].line_display);
-    free(file_lines[i].highlight);
-    // fprintf(stderr, "LINE %d: ", i);
-    // for (int j = 0; j < file_lines[i].size; j++) {      
-    //   fprintf(stderr, "%c", file_lines[i].line[j]);
-    // }
-    // fprintf(stderr, "\n");
-  }
-  // free the malloc'ed FileLine array poitner.
-  free(file_lines);
+}
+
+FileLines *File_GetLines(const char *file_name, int *size, Syntax *syntax) {
+  int fd = open(file_name, O_RDONLY);
+  if (fd == -1) {
+    quit("open");
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    quit("fstat");
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    // only regular files can be mapped, so read anything else line by line.
+    return File_ReadLines(fd, size, syntax);
+  }
+
+  file_map = NULL;
+  file_map_size = st.st_size;
+  file_map_dev = st.st_dev;
+  file_map_ino = st.st_ino;
+  is_map_detached = false;
+  if (file_map_size > 0) {
+    // map the whole file read-only. pages are only read from disk
+    //  when a line on them is indexed or displayed.
+    file_map = mmap(NULL, file_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file_map == MAP_FAILED) {
+      file_map = NULL;
+      file_map_size = 0;
+      close(fd);
+      quit("mmap");
+    }
+    // the file is read once from start to end while it is indexed.
+    posix_madvise(file_map, file_map_size, POSIX_MADV_SEQUENTIAL);
+  }
+  // the mapping stays valid after the descriptor is closed.
+  close(fd);
+
+  // build the line index: each FileLine only records where its line
+  //  starts in the mapping and how long it is. no line is copied, and
+  //  display and highlight data is built when the line is rendered.
+  if (line_arena == NULL) {
+    line_arena = Arena_New();
+  }
+  // even the FileLines are only made for lines in use: the index just
+  //  records where each run of lines starts and ends. a FileLine costs
+  //  far more than a short line, so this is done whatever the size of
+  //  the file.
+  paging = true;
+  FileLines *lines = Ingest_MappedLines(file_map, file_map_size, line_arena,
+                                        paging);
+
+  if (file_map != NULL) {
+    // lines are displayed in no particular order from now on.
+    posix_madvise(file_map, file_map_size, POSIX_MADV_NORMAL);
+  }
+
+  // set the output parameters with the number of lines read.
+  *size = lines->num_lines;
+  return lines;
+}
+
+void File_FreeLines(FileLines *file_lines, int num_lines) {
+  (void) num_lines;
+  (void) file_lines;
+  // the tree and all of its lines' buffers are in the arena.
+  Arena_Destroy(line_arena);
+  line_arena = NULL;
+  paging = false;
+
+  if (file_map != NULL) {
+    // no line points into the mapped file anymore.
+    munmap(file_map, file_map_size);
+    file_map = NULL;
+    file_map_size = 0;
+  }
+}
+
+void File_LineEdited(FileLines *file_lines, int idx, Syntax *syntax) {
+  LT_Resized(file_lines, idx);
+  File_SyncLex(file_lines, idx, idx + 1, lex_out_changed, syntax);
+  lex_out_changed = false;
+}
+
+void File_SyncHighlight(FileLines *file_lines, int first, int last,
+                        Syntax *syntax) {
+  File_SyncLex(file_lines, first, last, false, syntax);
+}
+
+long File_LineOffset(FileLines *file_lines, int idx) {
+  return (file_lines == NULL) ? 0 : LT_OffsetOf(file_lines, idx);
+}
+
+int File_OffsetLine(FileLines *file_lines, long offset) {
+  return (file_lines == NULL) ? 0 : LT_LineAt(file_lines, offset);
+}
+
+void File_SetWrap(FileLines *file_lines, int num_cols) {
+  if (file_lines != NULL) {
+    LT_SetWrap(file_lines, num_cols);
+  }
+}
+
+void File_CountRows(FileLines *file_lines, int first, int last) {
+  if (file_lines != NULL) {
+    LT_CountRows(file_lines, first, last);
+  }
+}
+
+bool File_CountSomeRows(FileLines *file_lines, int num_lines) {
+  return file_lines == NULL || LT_CountSomeRows(file_lines, num_lines);
+}
+
+long File_LineRow(FileLines *file_lines, int idx) {
+  return (file_lines == NULL) ? 0 : LT_RowOf(file_lines, idx);
+}
+
+int File_RowLine(FileLines *file_lines, long row) {
+  return (file_lines == NULL) ? 0 : LT_LineAtRow(file_lines, row);
+}
+
+void File_PageOut(FileLines *file_lines, int first, int last) {
+  if (!paging || LT_NumLoaded(file_lines) <= PAGING_MAX_LOADED) {
+    return;
+  }
+  // the pages of the dropped lines stay in the page cache, which the
+  //  kernel can reclaim since they are clean.
+  LT_Unload(file_lines, first - PAGING_MARGIN, last + PAGING_MARGIN);
+}
+
+const char *File_MappedLine(const char *pos, const char *end,
+                            FileLine *f_line) {
+  const char *newline = memchr(pos, '\n', end - pos);
+  const char *line_end = (newline == NULL) ? end : newline;
+  int line_size = line_end - pos;
+  while (line_size > 0 && pos[line_size - 1] == '\r') {
+    // remove '\r' characters from the end of the line.
+    line_size--;
+  }
+  // a mapped line has no gap: its text is all before the gap.
+  *f_line = (FileLine) {.size = line_size, .line = (char *) pos,
+                        .gap = line_size};
+  return (newline == NULL) ? end : newline + 1;
+}
+
+void File_GetMemoryStats(ArenaStats *stats) {
+  if (line_arena == NULL) {
+    // no file is open.
+    stats->bytes_used = 0;
+    stats->bytes_reserved = 0;
+    return;
+  }
+  Arena_GetStats(line_arena, stats);
+}
+
+FileLine *File_GetLine(FileLines *file_lines, int idx) {
+  if (file_lines == NULL) {
+    return NULL;
+  }
+  return LT_Get(file_lines, idx);
+}
+
+void File_EnsureDisplay(FileLine *f_line, Syntax *syntax) {
+  if (f_line->line_display == NULL) {
+    File_SetLineDisplay(f_line, syntax);
+  }
+}
+
+char *File_DisplayText(FileLine *f_line, int end, Syntax *syntax) {
+  File_EnsureDisplay(f_line, syntax);
+  if (end > f_line->size_display) {
+    end = f_line->size_display;
+  }
+  if (f_line->disp_gap < end) {
+    File_MoveDisplayGap(f_line, end);
+  }
+  if (end == f_line->size_display) {
+    // the gap always has room for the null-terminator.
+    f_line->line_display[end] = '\0';
+  }
+  return f_line->line_display;
+}
+
+int File_LineWidth(FileLine *f_line) {
+  if (f_line->line_display != NULL) {
+    return f_line->size_display;
+  }
+  const char *tail = &(f_line->line[f_line->gap + f_line->gap_size]);
+  return TS_Expand(tail, f_line->size - f_line->gap,
+                   TS_Expand(f_line->line, f_line->gap, 0, NULL), NULL);
+}
+
+char *File_LineText(FileLine *f_line) {
+  if (f_line->is_owned) {
+    File_MoveGap(f_line, f_line->size);
+    // the gap always has room for the null-terminator.
+    f_line->line[f_line->size] = '\0';
+  }
+  return f_line->line;
 }
 
 int File_RawToDispIdx(FileLine *f_line, int line_idx) {
+  if (line_idx > f_line->size) {
+    line_idx = f_line->size;
+  }
+  int i = 0;
   int res = 0;
-  // only count characters to the left of line_idx
-  for (int i = 0; i < line_idx; i++) {
-    if (f_line->line[i] == TAB) {
-      // res % TAB_SIZE: num cols we are to the right
-      //  of last tab snap.
-      // subtracting from (TAB_SIZE - 1) gives num cols currently
-      //  we are to the left of the next tab snap. Adding to res
-      //  counts just up to the left of next tab snap.
-      res += (TAB_SIZE - 1) - (res % TAB_SIZE);
-    }
-    res++;
+  if (line_idx >= f_line->map_raw) {
+    // continue from the last conversion instead of the start of the line.
+    i = f_line->map_raw;
+    res = f_line->map_disp;
   }
+  // only count characters to the left of line_idx, which lie in at most
+  //  two runs, before and after the gap.
+  if (i < f_line->gap) {
+    int head_end = (line_idx < f_line->gap) ? line_idx : f_line->gap;
+    res = TS_Expand(&(f_line->line[i]), head_end - i, res, NULL);
+    i = head_end;
+  }
+  if (i < line_idx) {
+    res = TS_Expand(&(f_line->line[i + f_line->gap_size]), line_idx - i, res,
+                    NULL);
+  }
+  f_line->map_raw = line_idx;
+  f_line->map_disp = res;
   return res;
 }
 
 int File_DispToRawIdx(FileLine *f_line, int disp_idx) {
+  int i = 0;
   int res = 0;
-  int i;
-  for (i = 0; i < f_line->size; i++) {
-    if (f_line->line[i] == TAB) {
-      res += (TAB_SIZE - 1) - (res % TAB_SIZE);
-    }
-    res++;
-
-    if (res > disp_idx) {
-      return i;
-    }
+  if (disp_idx >= f_line->map_disp) {
+    // continue from the last conversion instead of the start of the line.
+    i = f_line->map_raw;
+    res = f_line->map_disp;
+  }
+  // look for disp_idx before the gap, then after it.
+  if (i < f_line->gap) {
+    i += TS_IndexOfColumn(&(f_line->line[i]), f_line->gap - i, &res, disp_idx);
+  }
+  if (i >= f_line->gap && i < f_line->size) {
+    i += TS_IndexOfColumn(&(f_line->line[i + f_line->gap_size]),
+                          f_line->size - i, &res, disp_idx);
+  }
+  if (i < f_line->size) {
+    f_line->map_raw = i;
+    f_line->map_disp = res;
+    return i;
   }
   // the caller gave disp_idx that's out of range (should not happen).
   return i;
@@ -292,55 +970,94 @@ int File_DispToRawIdx(FileLine *f_line, int disp_idx) {
 
 void File_InsertChar(FileLine *f_line, int idx, char new_char, Syntax *syntax) {
   // validate the index.
-  // if(idx < 0 || idx > f_line->size) {
-  //   idx = f_line->size;
-  // }
   idx = validate_idx(idx, f_line->size);
+  File_Materialize(f_line);
 
-  // allocate space for the line plus 1 byte we're inserting plus
-  //  the null-terminator.
-  f_line->line = realloc(f_line->line, f_line->size + 2);
-  // use memmove since the destination and source strings overlap.
-  // shift chars in the line from idx (including idx) 1 spot to 
-  //  the right to make room for the new char.
-  memmove(&(f_line->line[idx + 1]), &(f_line->line[idx]),
-          (f_line->size) - idx + 1);
+  // move the gap to the insertion point, and make sure it has room for
+  //  the new char. typing moves the gap along, so this is usually free.
+  File_MoveGap(f_line, idx);
+  File_ReserveGap(f_line, 1);
+  // assign the new character to the start of the gap.
+  f_line->line[f_line->gap++] = new_char;
+  f_line->gap_size--;
   // increment the size of the line by 1 character.
   (f_line->size)++;
-  // assign the new character to its position.
-  f_line->line[idx] = new_char;
 
   // update the line_display field to account for the new character.
-  File_SetLineDisplay(f_line, syntax);
+  File_UpdateDisplay(f_line, idx, NULL, 0, 1, syntax);
 }
 
 void File_RemoveChar(FileLine *f_line, int idx, Syntax *syntax) {
-  idx = validate_idx(idx, f_line->size);
-  // move over the characters to the right of idx by one space to the left
-  //  (including '\0').
-  memmove(&(f_line->line[idx]), &(f_line->line[idx + 1]),
-          f_line->size - idx);
+  if (idx < 0 || idx >= f_line->size) {
+    // no character at idx to remove.
+    return;
+  }
+  File_Materialize(f_line);
+  // move the gap to idx, then widen it over the removed character.
+  File_MoveGap(f_line, idx);
+  char removed = f_line->line[f_line->gap + f_line->gap_size];
+  if (removed == TAB) {
+    f_line->gap_tabs--;
+  }
+  f_line->gap_size++;
   f_line->size--;
-  File_SetLineDisplay(f_line, syntax);
+  File_UpdateDisplay(f_line, idx, &removed, 1, 0, syntax);
 }
 
-// free the malloc'ed buffers in the FileLine.
+HLSpans *File_SaveHighlight(FileLine *f_line) {
+  int num_spans = (f_line->highlight == NULL) ?
+                  0 : f_line->highlight->num_spans;
+  HLSpans *saved = malloc(sizeof(HLSpans) + num_spans * sizeof(HLSpan));
+  if (saved == NULL) {
+    quit("File_SaveHighlight");
+  }
+  saved->num_spans = num_spans;
+  saved->capacity = num_spans;
+  if (num_spans > 0) {
+    memcpy(saved->spans, f_line->highlight->spans,
+           num_spans * sizeof(HLSpan));
+  }
+  return saved;
+}
+
+void File_RestoreHighlight(FileLine *f_line, HLSpans *saved) {
+  HS_Replace(&(f_line->highlight), 0, INT_MAX, saved->spans,
+             saved->num_spans, line_arena);
+  free(saved);
+}
+
+void File_SetHighlight(FileLine *f_line, int start, int size,
+                       unsigned char code) {
+  HLSpan span = {start, size, code};
+  HS_Replace(&(f_line->highlight), start, start + size, &span, 1,
+             line_arena);
+}
+
+// free the buffers in the FileLine.
 void File_FreeFileLineBufs(FileLine *f_line) {
-  free(f_line->line);
-  free(f_line->line_display);
+  if (f_line->is_owned) {
+    Arena_Free(line_arena, f_line->line, f_line->capacity);
+  }
+  Arena_Free(line_arena, f_line->line_display, f_line->display_capacity);
+  HS_Free(f_line->highlight, line_arena);
 }
 
-void File_RemoveRow(FileLine *f_line, int *num_lines, int idx) {
+void File_RemoveRow(FileLines *f_lines, int *num_lines, int idx) {
   idx = validate_idx(idx, *num_lines);
+  if (idx == *num_lines) {
+    // there is no line at the end of the file to remove.
+    return;
+  }
+  // take the target FileLine out of the tree.
+  FileLine removed;
+  LT_Remove(f_lines, idx, &removed);
   // free the line and display line buffers in the target
   //  FileLine being removed.
-  File_FreeFileLineBufs(&(f_line[idx]));
-  // copy over all the FileLines coming after the target index one
-  //  position before them, overwriting the target FileLine.
-  memmove(&(f_line[idx]), &(f_line[idx + 1]),
-          (*num_lines - idx - 1) * sizeof(FileLine));
-  // removed a line, so decrease the size of the FileLines array.
-  (*num_lines)--;
+  File_FreeFileLineBufs(&removed);
+  // the line below now follows another line.
+  lex_out_changed = true;
+  // removed a line, so decrease the number of FileLines.
+  *num_lines = f_lines->num_lines;
 }
 
 // if idx is negative or greater than size, returns size; otherwise,
@@ -350,15 +1067,53 @@ static int validate_idx(int idx, int size) {
 }
 
 void File_AppendLine(FileLine *f_line, const char *str, size_t str_size, Syntax *syntax) {
-  // make room for the new string to append to f_line's line buffer.
-  f_line->line = realloc(f_line->line, f_line->size + str_size + 1);
-  // copy over the new string to f_line's line buffer.
-  memcpy(&(f_line->line[f_line->size]), str, str_size);
+  File_Materialize(f_line);
+  int old_size = f_line->size;
+  // make room for the new string at the end of f_line's line buffer.
+  File_MoveGap(f_line, old_size);
+  File_ReserveGap(f_line, str_size);
+  // copy over the new string to the start of the gap.
+  memcpy(&(f_line->line[f_line->gap]), str, str_size);
   // update the size of the f_line's line buffer.
+  f_line->gap += str_size;
+  f_line->gap_size -= str_size;
   f_line->size += str_size;
-  f_line->line[f_line->size] = '\0';  // null-terminate the new line string.
   // update the line_display field from the new line string.
-  File_SetLineDisplay(f_line, syntax);
+  File_UpdateDisplay(f_line, old_size, NULL, 0, str_size, syntax);
+}
+
+// Cuts the owned line f_line off at raw index col, which the gap must
+//  be at.
+static void File_Truncate(FileLine *f_line, int col, Syntax *syntax) {
+  // remove the characters after col by widening the gap over them.
+  f_line->gap_size += f_line->size - col;
+  f_line->gap_tabs = 0;
+  f_line->size = col;
+  if (f_line->map_raw > col) {
+    // the cached conversion was cut off with the text.
+    f_line->map_raw = 0;
+    f_line->map_disp = 0;
+  }
+  if (f_line->line_display != NULL) {
+    // the display before col is unchanged, so cut it off there by
+    //  widening the display gap over the rest, and highlight its last
+    //  token again.
+    int disp_col = File_RawToDispIdx(f_line, col);
+    if (f_line->disp_gap < disp_col) {
+      File_MoveDisplayGap(f_line, disp_col);
+    }
+    f_line->disp_gap = disp_col;
+    f_line->disp_gap_size = f_line->display_capacity - disp_col;
+    f_line->size_display = disp_col;
+    f_line->line_display[disp_col] = '\0';
+    HS_Truncate(f_line->highlight, disp_col);
+    Syntax_UpdateHighlight(syntax, f_line->line_display, disp_col,
+                           &(f_line->highlight), disp_col, disp_col,
+                           disp_col, f_line->lex_in, &(f_line->lex_out),
+                           line_arena);
+  } else {
+    f_line->lex_out = LEX_UNKNOWN;
+  }
 }
 
 // Split the FileLine at position row in the given FileLine array
@@ -367,55 +1122,135 @@ void File_AppendLine(FileLine *f_line, const char *str, size_t str_size, Syntax
 //  num_lines is the number of FileLines in the f_line array.
 //  After returning, num_lines is incremented, since a new
 //  FileLine was added to the array.
-void File_SplitLine(FileLine **f_line, int *num_lines, int row, int col, Syntax *syntax) {
+void File_SplitLine(FileLines **f_lines, int *num_lines, int row, int col, Syntax *syntax) {
   if (col == 0) {
     // at the start of a line.
     // insert a brand new empty FileLine at position row 
     //  (above the current row).
-    File_InsertFileLine(f_line, num_lines, "", strlen(""), row, syntax);
+    File_InsertFileLine(f_lines, num_lines, "", strlen(""), row, syntax);
   } else {
-    // alias for a FileLine to split in the array.
-    FileLine *l_ptr = &((*f_line)[row]);
+    // alias for a FileLine to split in the tree.
+    FileLine *l_ptr = File_GetLine(*f_lines, row);
+    File_Materialize(l_ptr);
+    // with the gap at col, the characters right of col follow the gap.
+    File_MoveGap(l_ptr, col);
     // create a new line below the current cursor-highlighted line
     //  which contains the characters to the right of the cursor.
-    File_InsertFileLine(f_line, num_lines, &(l_ptr->line[col]),
-                        l_ptr->size - col, row + 1, syntax);
-    // realloc in File_InsertFileLine might invalidate l_ptr,
+    File_InsertLine(f_lines, num_lines,
+                    &(l_ptr->line[l_ptr->gap + l_ptr->gap_size]),
+                    l_ptr->size - col, row + 1, syntax);
+    // inserting into the tree might move the line's FileLine,
     //  so reassign it here.
-    l_ptr = &((*f_line)[row]);
-    // remove characters on the current line by reducing the size.
-    l_ptr->size = col;
-    // null-terminate the new line string.
-    l_ptr->line[l_ptr->size] = '\0';
-    // update the diaply line according to the new line.
-    File_SetLineDisplay(l_ptr, syntax);
+    l_ptr = File_GetLine(*f_lines, row);
+    File_Truncate(l_ptr, col, syntax);
+    LT_Resized(*f_lines, row);
+    // both halves may end in other states than the whole line did.
+    File_SyncLex(*f_lines, row, row + 2, true, syntax);
   }
   // editor should increment row position and set col position to 0.
 }
 
-// Searches the array of FileLines (containing num_lines FileLines) for a
-//  line containing str as a substring. Returns 0 on success, -1 on failure.
-//  Upon success s_res contains the row and column index into the matching
-//  FileLine (see FileParser.h for SearchResult details).
-int File_SearchFileLines(FileLine *f_lines, int num_lines, const char *str,
-                         SearchResult *s_res) {
-  for (int i = 0; i < num_lines; i++) {
-    // alias for current FileLine being searched.
-    FileLine *f_line = &(f_lines[i]);
-    // use strstr to find a substring of the display line containing str.
-    // strstr returns a pointer to the start of the matching substring.
-    char *match_ptr = strstr(f_line->line_display, str);
-    // strstr returns NULL upon finding no matches.
-    if (match_ptr != NULL) {
-      // successful match, so set the output parameter.\
-      // the column number of where the match starts is found with
-      //  poitner arithmetic using the display line as a reference.
-      s_res->cur_col = match_ptr - (f_line->line_display);
-      s_res->cur_row = i;
-      return 0;
-    }
+// Returns the end of the line of text starting at pos, which ends at the
+//  next \n, \r or \r\n, or at end. Sets *next to the start of the next
+//  line, or NULL if the line ends at end.
+static const char *File_TextLine(const char *pos, const char *end,
+                                 const char **next) {
+  while (pos < end && *pos != '\n' && *pos != '\r') {
+    pos++;
+  }
+  if (pos == end) {
+    *next = NULL;
+  } else {
+    *next = (*pos == '\r' && pos + 1 < end && pos[1] == '\n') ?
+            pos + 2 : pos + 1;
+  }
+  return pos;
+}
+
+// Sets f_line to a new owned line holding str followed by tail, with the
+//  gap between them, and no display yet.
+static void File_NewTextLine(FileLine *f_line, const char *str, int size,
+                             const char *tail, int tail_size) {
+  *f_line = (FileLine) {0};
+  f_line->size = size + tail_size;
+  f_line->capacity = Arena_RoundUp(f_line->size + GAP_MIN);
+  f_line->line = Arena_Alloc(line_arena, f_line->capacity);
+  f_line->is_owned = true;
+  memcpy(f_line->line, str, size);
+  f_line->gap = size;
+  f_line->gap_size = f_line->capacity - f_line->size;
+  memcpy(&(f_line->line[size + f_line->gap_size]), tail, tail_size);
+  f_line->gap_tabs = TS_CountTabs(tail, tail_size);
+}
+
+void File_InsertText(FileLines **f_lines, int *num_lines, int row, int col,
+                     const char *text, size_t size, int *end_row,
+                     int *end_col, Syntax *syntax) {
+  if (row >= *num_lines) {
+    // past the last line, so start a new one.
+    row = *num_lines;
+    File_InsertLine(f_lines, num_lines, "", 0, row, syntax);
+  }
+  const char *text_end = &(text[size]);
+  const char *next;
+  const char *line_end = File_TextLine(text, text_end, &next);
+  FileLine *f_line = File_GetLine(*f_lines, row);
+  col = validate_idx(col, f_line->size);
+  File_Materialize(f_line);
+  File_MoveGap(f_line, col);
+  if (next == NULL) {
+    // the text fits on the line, so insert it at the gap in one go.
+    File_ReserveGap(f_line, size);
+    memcpy(&(f_line->line[f_line->gap]), text, size);
+    f_line->gap += size;
+    f_line->gap_size -= size;
+    f_line->size += size;
+    File_UpdateDisplay(f_line, col, NULL, 0, size, syntax);
+    File_LineEdited(*f_lines, row, syntax);
+    *end_row = row;
+    *end_col = col + size;
+    return;
+  }
+
+  // the lines after the first line of text are made all at once, without
+  //  their displays, which are only built (and highlighted) if they are
+  //  shown. the last one takes the text after col.
+  int num_new = 0;
+  for (const char *pos = next; pos != NULL; num_new++) {
+    File_TextLine(pos, text_end, &pos);
+  }
+  FileLine *new_lines = malloc(num_new * sizeof(FileLine));
+  if (new_lines == NULL) {
+    quit("File_InsertText");
   }
-  // no matches found.
-  return -1;
+  const char *tail = &(f_line->line[f_line->gap + f_line->gap_size]);
+  int tail_size = f_line->size - col;
+  for (int i = 0; i < num_new; i++) {
+    const char *pos = next;
+    const char *pos_end = File_TextLine(pos, text_end, &next);
+    bool is_last = (i == num_new - 1);
+    File_NewTextLine(&(new_lines[i]), pos, pos_end - pos,
+                     is_last ? tail : "", is_last ? tail_size : 0);
+  }
+  *end_row = row + num_new;
+  *end_col = new_lines[num_new - 1].gap;
+
+  // cut the line at col and add the first line of text to it.
+  File_Truncate(f_line, col, syntax);
+  File_ReserveGap(f_line, line_end - text);
+  memcpy(&(f_line->line[f_line->gap]), text, line_end - text);
+  f_line->gap += line_end - text;
+  f_line->gap_size -= line_end - text;
+  f_line->size += line_end - text;
+  File_UpdateDisplay(f_line, col, NULL, 0, line_end - text, syntax);
+  LT_Resized(*f_lines, row);
+
+  LT_InsertLines(*f_lines, row + 1, new_lines, num_new);
+  *num_lines = (*f_lines)->num_lines;
+  free(new_lines);
+  // the lexer states only have to be found again for the lines of text,
+  //  and the lines below as far as the state at their end changed.
+  File_SyncLex(*f_lines, row, *end_row + 1, true, syntax);
+  lex_out_changed = false;
 }
 
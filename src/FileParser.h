@@ -2,7 +2,9 @@
 #define FILE_PARSER_H_
 
 #include <unistd.h>
+#include <stdbool.h>  // for boolean type
 #include "SyntaxHL.h"
+#include "Arena.h"  // for ArenaStats
 
 // struct to store a line of text.
 typedef struct {
@@ -10,18 +12,66 @@ typedef struct {
   int size;
   // the size of the line_display string.
   int size_display;
-  // pointer to a raw line of characters from a file.
+  // pointer to a raw line of characters from a file. points into the
+  //  memory-mapped file (and is not null-terminated) until the line
+  //  is first edited, after which it is a gap buffer in the open
+  //  file's arena. use File_LineText to read it as a contiguous string.
   char *line;
   // the line replaced with characters able to be
-  //  appropriately displayed on the terminal window.
+  //  appropriately displayed on the terminal window. NULL until the
+  //  line is first rendered (see File_EnsureDisplay).
   char *line_display;
-  // each value in this char array is between 0 and 255
-  //  and corresponds to a letter in line_display which
-  //  indicates the type of highlighting the character
-  //  should get.
-  unsigned char *highlight;
+  // the runs of characters in line_display that get a type of
+  //  highlighting other than HL_NORMAL (see HLSpans.h). NULL for a line
+  //  that is all plain text, or that has not been rendered yet.
+  HLSpans *highlight;
+  // true if line is a buffer owned by this FileLine; false if
+  //  line points into the memory-mapped file and must not be modified.
+  bool is_owned;
+  // the lexer states at the start and end of the line (see LexLine_t in
+  //  SyntaxHL.h), which carry multi-line comments and strings from one
+  //  line to the next. the highlighting of the line always starts in
+  //  lex_in; lex_out may be LEX_UNKNOWN until it is needed.
+  unsigned char lex_in;
+  unsigned char lex_out;
+  // the generation of lexer states lex_in was set in. lex_in is only
+  //  known to follow from the lines above while this is the current
+  //  generation (see File_SyncHighlight).
+  unsigned char lex_gen;
+  // the number of bytes allocated for an owned line. its text is
+  //  line[0, gap) followed by line[gap + gap_size, capacity).
+  int capacity;
+  // the index in line of the gap, which follows the last edit so
+  //  consecutive edits there don't move the rest of the line.
+  int gap;
+  // the number of unused bytes in the gap.
+  int gap_size;
+  // the number of tabs in the text after the gap, so edits to lines
+  //  without any there don't search the rest of the line for one.
+  int gap_tabs;
+  // the number of bytes allocated for line_display. it has a gap like
+  //  line's, at the display index of the last edit, so its text is
+  //  [0, disp_gap) followed by [disp_gap + disp_gap_size,
+  //  display_capacity). use File_DisplayText to read a contiguous prefix
+  //  of it. the highlight spans are indexed as if there was no gap.
+  int display_capacity;
+  int disp_gap;
+  int disp_gap_size;
+  // a raw index into line and its index into line_display, remembered
+  //  from the last edit or conversion so that nearby conversions don't
+  //  rescan the line from its start.
+  int map_raw;
+  int map_disp;
+  // the number of screen rows the line takes when soft-wrapped at the
+  //  width its leaf was counted at, or 0 if not counted since the line
+  //  was edited (see LT_CountRows).
+  int num_rows;
 } FileLine;
 
+// the lines of an open file, kept in a balanced tree of line chunks so
+//  lines can be found, inserted and removed in O(log n). see LineTree.h.
+typedef struct LineTree FileLines;
+
 // TODO: replace with a cursor struct.
 typedef struct {
   // the index of the FileLine struct which contains
@@ -33,24 +83,124 @@ typedef struct {
   // the index into the line_display field of the FileLine
   //  struct with a match.
   // int file_col;// not needed
+  // the number of characters of the line field the match
+  //  spans.
+  int size;
 } SearchResult;
 
 
-// const unsigned char *File_ToString(FileLine **file_lines, int num_lines,
-//                     size_t *file_size);
+// Save the given file_lines in a file named file_name. Creates and
+//  writes to a new file if the name does not exist as a file. The file is
+//  replaced by a new one with the same owner and permissions, or written
+//  over in place if that can't be done or would break its hard links.
+//  Returns the number of bytes written to the file, or -1 on error.
+long File_Save(const char *file_name, FileLines *file_lines);
+
+// Returns the FileLines of the given file, delimiting on \n and \r. The
+//  file is memory-mapped and only indexed by its newlines, so the returned
+//  lines point into the mapping and have no display or highlight data
+//  yet. Client must call File_FreeLines later.
+FileLines *File_GetLines(const char *file_name, int *size, Syntax *syntax);
+
+// Frees the FileLines and unmaps the file they were read from. Does
+//  nothing if file_lines is NULL. The lines of the open file and all of
+//  their buffers are kept in one arena, so this frees them all at once.
+void File_FreeLines(FileLines *file_lines, int num_lines);
+
+// Updates the index of line offsets after the line at index idx was
+//  edited, and carries any change to the lexer state at its end on to
+//  the lines below, until their states stop changing. Must be called
+//  after File_InsertChar, File_RemoveChar and File_AppendLine; the
+//  functions taking the FileLines do it already.
+void File_LineEdited(FileLines *file_lines, int idx, Syntax *syntax);
+
+// Makes the highlighting of the lines [first, last) follow from the
+//  lines above them, for multi-line comments and strings. Lines whose
+//  state is unknown are lexed from the nearest line above with a known
+//  state, looking back at most LEX_SYNC_LINES lines.
+void File_SyncHighlight(FileLines *file_lines, int first, int last,
+                        Syntax *syntax);
+
+// Returns the byte offset of the line at index idx in the file as it
+//  would be saved, or the size of that file if idx is the number of
+//  lines. Costs O(log n).
+long File_LineOffset(FileLines *file_lines, int idx);
+
+// Returns the index of the line holding the byte at offset in the file
+//  as it would be saved. Offsets past the end give the last line. Costs
+//  O(log n).
+int File_OffsetLine(FileLines *file_lines, long offset);
+
+// Wraps the lines of file_lines at num_cols columns when mapping them to
+//  screen rows, or gives each line one row if num_cols is 0. Costs O(1):
+//  the rows of the lines are only counted at the new width once they are
+//  reached (see File_CountRows), and edits only recount the rows of the
+//  lines they touch. Does nothing if file_lines is NULL.
+void File_SetWrap(FileLines *file_lines, int num_cols);
+
+// Counts the rows of the lines [first, last) of file_lines at the width
+//  set by File_SetWrap, if they were counted at another, which moves the
+//  rows of the lines below them. Until then, lines keep the rows counted
+//  at the old width. Costs O(log n) per leaf of lines counted, plus
+//  measuring them. Does nothing if file_lines is NULL.
+void File_CountRows(FileLines *file_lines, int first, int last);
+
+// Counts the rows of about num_lines more lines of file_lines at the width
+//  set by File_SetWrap, the first ones not yet counted at it, so a huge
+//  file can be counted a bit at a time. Returns true once all are.
+bool File_CountSomeRows(FileLines *file_lines, int num_lines);
 
-// Save the given file_lines (an array of size num_lines)
-//  in a file named file_name. Creates and writes to
-//  a new file if the name does not exist as a file.
-//  Returns the number of bytes written to the file.
-int File_Save(const char *file_name, FileLine **file_lines,
-               int num_lines);
+// Returns the first screen row of the line at index idx with the lines
+//  wrapped as set by File_SetWrap, or the number of rows of all lines if
+//  idx is the number of lines. Costs O(log n), counting the rows of the
+//  lines near it first (see File_CountRows).
+long File_LineRow(FileLines *file_lines, int idx);
 
-// Returns a malloc'ed array of FileLines from the given file, delimiting on
-//  \n and \r. Client must call File_FreeLines later.
-FileLine *File_GetLines(const char *file_name, int *size, Syntax *syntax);
+// Returns the index of the line shown on screen row row with the lines
+//  wrapped as set by File_SetWrap, or the number of lines if row is past
+//  the last line. Costs O(log n), counting the rows of the lines near it
+//  first (see File_CountRows).
+int File_RowLine(FileLines *file_lines, long row);
 
-void File_FreeLines(FileLine *file_lines, int num_lines);
+// In paging mode (any file that could be mapped), unloads the unedited
+//  lines far from the lines [first, last) once too many lines are
+//  loaded, freeing their display buffers. Does nothing otherwise.
+//  Pointers to lines are invalid afterwards.
+void File_PageOut(FileLines *file_lines, int first, int last);
+
+// Sets f_line to the line of mapped text starting at pos, which ends at
+//  the next \n or at end, without any \r before the \n. Returns the start
+//  of the next line.
+const char *File_MappedLine(const char *pos, const char *end,
+                            FileLine *f_line);
+
+// Sets stats to the memory used and reserved by the lines of the open
+//  file. Lines that point into the memory-mapped file are not counted.
+void File_GetMemoryStats(ArenaStats *stats);
+
+// Returns the line at index idx of file_lines, or NULL if there is no
+//  such line. The pointer is only valid until a line is inserted or
+//  removed.
+FileLine *File_GetLine(FileLines *file_lines, int idx);
+
+// Builds the line_display and highlight fields of f_line if it has not
+//  been rendered yet.
+void File_EnsureDisplay(FileLine *f_line, Syntax *syntax);
+
+// Returns f_line's line_display after making its first end characters
+//  contiguous, building it and its highlighting first if needed. If end
+//  is at least size_display, the whole display line is made contiguous
+//  and null-terminated. Cheap when end is near the last edit to the line.
+char *File_DisplayText(FileLine *f_line, int end, Syntax *syntax);
+
+// Returns the number of columns f_line takes on screen. Lines that have
+//  not been rendered yet are measured in their text.
+int File_LineWidth(FileLine *f_line);
+
+// Returns f_line's line as a contiguous string of f_line->size bytes.
+//  Owned lines have their gap moved to the end and are null-terminated;
+//  lines in the memory-mapped file are not null-terminated.
+char *File_LineText(FileLine *f_line);
 
 // converts an index into f_line's line field to an index into the 
 //  line_display field. returns the converted cooresponding index.
@@ -59,7 +209,9 @@ void File_FreeLines(FileLine *file_lines, int num_lines);
 int File_RawToDispIdx(FileLine *f_line, int line_idx);
 int File_DispToRawIdx(FileLine *f_line, int disp_idx);
 
-void File_InsertFileLine(FileLine **f_lines, int *num_lines,
+// Inserts a new line holding a copy of str at index idx. Creates the
+//  FileLines if *f_lines is NULL.
+void File_InsertFileLine(FileLines **f_lines, int *num_lines,
                             const char *str, size_t size,
                             int idx, Syntax *syntax);
 
@@ -68,26 +220,47 @@ void File_InsertChar(FileLine *f_line, int idx, char new_char, Syntax *syntax);
 // see editor_removechar
 void File_RemoveChar(FileLine *f_line, int idx, Syntax *syntax);
 
-// free the malloc'ed buffers in the FileLine. The memory for f_line
-//  is unaffected by this function.
+// Returns a copy of the highlighting of f_line, which must have been
+//  rendered, to give back to File_RestoreHighlight. Calls quit on
+//  allocation failure.
+HLSpans *File_SaveHighlight(FileLine *f_line);
+
+// Sets the highlighting of f_line back to saved, which was returned by
+//  File_SaveHighlight while the line had the same display, and frees
+//  saved.
+void File_RestoreHighlight(FileLine *f_line, HLSpans *saved);
+
+// Gives the size characters of f_line's display from index start the
+//  highlight code, until the line is highlighted again. f_line must have
+//  been rendered.
+void File_SetHighlight(FileLine *f_line, int start, int size,
+                       unsigned char code);
+
+// free the buffers in the FileLine, returning them to the arena of the
+//  open file. The memory for f_line is unaffected by this function.
 void File_FreeFileLineBufs(FileLine *f_line);
 
 // Delete a FileLine at position idx from the given FileLine
 //  array containing num_lines FileLines. Decrements num_lines
-//  upon successful deletion.
-void File_RemoveRow(FileLine *f_line, int *num_lines, int idx);
+//  upon successful deletion. The lines below are highlighted for the
+//  lexer state of the removed line until File_LineEdited is called on
+//  the line above idx.
+void File_RemoveRow(FileLines *f_lines, int *num_lines, int idx);
 
 // Append the given string str of size str_size to the end of f_line's
 //  line field.
 void File_AppendLine(FileLine *f_line, const char *str, size_t str_size, Syntax *syntax);
 
-void File_SplitLine(FileLine **f_line, int *num_lines, int row, int col, Syntax *syntax);
+void File_SplitLine(FileLines **f_lines, int *num_lines, int row, int col, Syntax *syntax);
 
-// Searches the array of FileLines (containing num_lines FileLines) for a
-//  line containing str as a substring. Returns 0 on success, -1 on failure.
-//  Upon success s_res contains the row and column index into the matching
-//  FileLine (see FileParser.h for SearchResult details).
-int File_SearchFileLines(FileLine *f_lines, int num_lines, const char *str,
-                         SearchResult *s_res);
+// Inserts the size bytes of text at raw index col of the line at index
+//  row, or on a new last line if row is the number of lines. Each \n,
+//  \r or \r\n in text starts a new line, and the text after col goes
+//  to the end of the last one. All the new lines are spliced in at once,
+//  and only the lines around the text are highlighted again. Sets
+//  *end_row and *end_col to the position after the inserted text.
+void File_InsertText(FileLines **f_lines, int *num_lines, int row, int col,
+                     const char *text, size_t size, int *end_row,
+                     int *end_col, Syntax *syntax);
 
 #endif  // FILE_PARSER_H_
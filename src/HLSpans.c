@@ -0,0 +1,236 @@
+#include <stdlib.h>  // for realloc
+#include <string.h>  // for memcpy, memmove
+
+#include "HLSpans.h"
+#include "Quit.h"
+#include "SyntaxHL.h"  // for HL_NORMAL
+
+// the number of spans a builder first makes room for.
+#define HS_MIN_CAPACITY 16
+
+// Returns the display index after the last character of span.
+static int HS_End(const HLSpan *span) {
+  return span->start + span->size;
+}
+
+// Returns the size of a block of spans with room for capacity spans.
+static size_t HS_BlockSize(int capacity) {
+  return sizeof(HLSpans) + (size_t) capacity * sizeof(HLSpan);
+}
+
+// Appends span to the num spans of spans, or adds it to the last of
+//  them if it goes on from it with the same code.
+static void HS_Push(HLSpan *spans, int *num, HLSpan span) {
+  if (*num > 0) {
+    HLSpan *last = &(spans[*num - 1]);
+    if (last->code == span.code && HS_End(last) == span.start) {
+      last->size += span.size;
+      return;
+    }
+  }
+  spans[*num] = span;
+  (*num)++;
+}
+
+void HS_BuilderClear(HSBuilder *builder) {
+  builder->num_spans = 0;
+}
+
+void HS_BuilderAppend(HSBuilder *builder, int start, int size,
+                      unsigned char code) {
+  if (code == HL_NORMAL || size <= 0) {
+    return;
+  }
+  if (builder->num_spans == builder->capacity) {
+    int capacity = (builder->capacity == 0) ? HS_MIN_CAPACITY
+                                            : 2 * builder->capacity;
+    HLSpan *grown = realloc(builder->spans, capacity * sizeof(HLSpan));
+    if (grown == NULL) {
+      quit("HS_BuilderAppend");
+    }
+    builder->spans = grown;
+    builder->capacity = capacity;
+  }
+  HS_Push(builder->spans, &(builder->num_spans),
+          (HLSpan) {start, size, code});
+}
+
+int HS_Find(const HLSpans *spans, int idx) {
+  if (spans == NULL) {
+    return 0;
+  }
+  // binary search, as the ends of the spans are in order too.
+  int low = 0;
+  int high = spans->num_spans;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (HS_End(&(spans->spans[mid])) > idx) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
+void HS_ReaderInit(HSReader *reader, const HLSpans *spans, int idx) {
+  reader->spans = spans;
+  reader->next = HS_Find(spans, idx);
+}
+
+unsigned char HS_CodeAt(HSReader *reader, int idx) {
+  const HLSpans *spans = reader->spans;
+  if (spans == NULL) {
+    return HL_NORMAL;
+  }
+  while (reader->next > 0 && HS_End(&(spans->spans[reader->next - 1])) > idx) {
+    reader->next--;
+  }
+  while (reader->next < spans->num_spans &&
+         HS_End(&(spans->spans[reader->next])) <= idx) {
+    reader->next++;
+  }
+  if (reader->next < spans->num_spans &&
+      spans->spans[reader->next].start <= idx) {
+    return spans->spans[reader->next].code;
+  }
+  return HL_NORMAL;
+}
+
+void HS_Replace(HLSpans **spans_ptr, int start, int end, const HLSpan *with,
+                int num_with, Arena *arena) {
+  HLSpans *spans = *spans_ptr;
+  int num_spans = (spans == NULL) ? 0 : spans->num_spans;
+  if (num_spans == 0 && num_with == 0) {
+    HS_Free(spans, arena);
+    *spans_ptr = NULL;
+    return;
+  }
+  // the spans [first, last) overlap [start, end). keep the parts of the
+  //  outer two that lie outside of it.
+  int first = HS_Find(spans, start);
+  int last = first;
+  while (last < num_spans && spans->spans[last].start < end) {
+    last++;
+  }
+  HLSpan head = {0, 0, HL_NORMAL};
+  HLSpan tail = {0, 0, HL_NORMAL};
+  if (first < last && spans->spans[first].start < start) {
+    head = spans->spans[first];
+    head.size = start - head.start;
+  }
+  if (first < last && HS_End(&(spans->spans[last - 1])) > end) {
+    tail = spans->spans[last - 1];
+    tail.size = HS_End(&tail) - end;
+    tail.start = end;
+  }
+
+  // the spans from last on are written after head, with and tail.
+  int num_after = num_spans - last;
+  int num_middle = (head.size > 0) + num_with + (tail.size > 0);
+  int max_spans = first + num_middle + num_after;
+  HLSpans *dest = spans;
+  const HLSpan *after;
+  if (spans == NULL || spans->capacity < max_spans) {
+    int capacity = (spans == NULL) ? 0 : 2 * spans->capacity;
+    if (capacity < max_spans) {
+      capacity = max_spans;
+    }
+    // use up the rest of the block the arena hands out.
+    capacity = (Arena_RoundUp(HS_BlockSize(capacity)) - sizeof(HLSpans)) /
+               sizeof(HLSpan);
+    dest = Arena_Alloc(arena, HS_BlockSize(capacity));
+    dest->capacity = capacity;
+    if (spans != NULL) {
+      memcpy(dest->spans, spans->spans, first * sizeof(HLSpan));
+    }
+    after = (spans == NULL) ? NULL : &(spans->spans[last]);
+  } else {
+    // move the spans after the replaced ones out of the way first.
+    HLSpan *moved = &(spans->spans[first + num_middle]);
+    memmove(moved, &(spans->spans[last]), num_after * sizeof(HLSpan));
+    after = moved;
+  }
+
+  int num = first;
+  if (head.size > 0) {
+    HS_Push(dest->spans, &num, head);
+  }
+  for (int i = 0; i < num_with; i++) {
+    HS_Push(dest->spans, &num, with[i]);
+  }
+  if (tail.size > 0) {
+    HS_Push(dest->spans, &num, tail);
+  }
+  if (num_after > 0) {
+    HLSpan next = after[0];
+    HS_Push(dest->spans, &num, next);
+    memmove(&(dest->spans[num]), &(after[1]),
+            (num_after - 1) * sizeof(HLSpan));
+    num += num_after - 1;
+  }
+  dest->num_spans = num;
+
+  if (dest != spans) {
+    HS_Free(spans, arena);
+  }
+  if (num == 0) {
+    HS_Free(dest, arena);
+    dest = NULL;
+  }
+  *spans_ptr = dest;
+}
+
+void HS_Edit(HLSpans *spans, int start, int num_removed, int num_inserted) {
+  if (spans == NULL) {
+    return;
+  }
+  int removed_end = start + num_removed;
+  int inserted_end = start + num_inserted;
+  int shift = num_inserted - num_removed;
+  // the spans ending before the edit stay as they are.
+  int num = HS_Find(spans, start);
+  for (int i = num; i < spans->num_spans; i++) {
+    int span_start = spans->spans[i].start;
+    int span_end = HS_End(&(spans->spans[i]));
+    if (span_start >= removed_end) {
+      span_start += shift;
+      span_end += shift;
+    } else {
+      // the span overlaps the removed characters. keep its parts before
+      //  and after them. if it has both, it covers the inserted ones
+      //  too, as their codes don't matter.
+      if (span_start >= start) {
+        span_start = inserted_end;
+      }
+      span_end = (span_end > removed_end) ? span_end + shift : start;
+      if (span_end <= span_start) {
+        continue;
+      }
+    }
+    spans->spans[num] = spans->spans[i];
+    spans->spans[num].start = span_start;
+    spans->spans[num].size = span_end - span_start;
+    num++;
+  }
+  spans->num_spans = num;
+}
+
+void HS_Truncate(HLSpans *spans, int size) {
+  if (spans == NULL) {
+    return;
+  }
+  int num = HS_Find(spans, size);
+  if (num < spans->num_spans && spans->spans[num].start < size) {
+    // the span runs past size, so cut it there.
+    spans->spans[num].size = size - spans->spans[num].start;
+    num++;
+  }
+  spans->num_spans = num;
+}
+
+void HS_Free(HLSpans *spans, Arena *arena) {
+  if (spans != NULL) {
+    Arena_Free(arena, spans, HS_BlockSize(spans->capacity));
+  }
+}
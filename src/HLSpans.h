@@ -0,0 +1,89 @@
+#ifndef HL_SPANS_H_
+#define HL_SPANS_H_
+
+// The highlighting of a display line, stored as the runs of characters
+//  that share a highlight code. Only runs of codes other than HL_NORMAL
+//  (0) are kept, so a line of plain text stores nothing, and a line
+//  takes a few bytes per token rather than one per character. A line's
+//  spans live in one block of the open file's arena.
+
+#include "Arena.h"
+
+// a run of characters highlighted alike.
+typedef struct {
+  // the display index of the first character of the run.
+  int start;
+  // the number of characters in the run.
+  int size;
+  // the Highlight_t code of the characters.
+  unsigned char code;
+} HLSpan;
+
+// the spans of a line, in order of start and not overlapping. a line
+//  without any has no HLSpans at all (NULL).
+typedef struct {
+  int num_spans;
+  // the number of spans the block has room for.
+  int capacity;
+  HLSpan spans[];
+} HLSpans;
+
+// a growable list of spans being made, such as the output of the lexer.
+//  reused from line to line, so it is only grown for the longest one.
+typedef struct {
+  HLSpan *spans;
+  int num_spans;
+  int capacity;
+} HSBuilder;
+
+#define EMPTY_HS_BUILDER {NULL, 0, 0}
+
+// reads the codes of a line's spans at increasing (or decreasing)
+//  indices, each in about constant time.
+typedef struct {
+  const HLSpans *spans;
+  // the first span that ends after the index last read.
+  int next;
+} HSReader;
+
+// Empties builder, keeping its memory.
+void HS_BuilderClear(HSBuilder *builder);
+
+// Gives the size characters from display index start the given code.
+//  They must follow every character given a code before. Runs of
+//  HL_NORMAL are skipped, and a run going on from the last span with
+//  the same code is added to it. Calls quit on allocation failure.
+void HS_BuilderAppend(HSBuilder *builder, int start, int size,
+                      unsigned char code);
+
+// Returns the index of the first of spans that ends after display index
+//  idx, or the number of spans if none does. spans may be NULL.
+int HS_Find(const HLSpans *spans, int idx);
+
+// Starts reader at display index idx of spans, which may be NULL.
+void HS_ReaderInit(HSReader *reader, const HLSpans *spans, int idx);
+
+// Returns the code of the character at display index idx.
+unsigned char HS_CodeAt(HSReader *reader, int idx);
+
+// Replaces the highlighting of the characters in [start, end) of the
+//  line with spans with the num_with spans of with, which must lie in
+//  [start, end). Spans running past either end are cut there. The block
+//  is grown from arena if needed, and freed if no span is left.
+void HS_Replace(HLSpans **spans, int start, int end, const HLSpan *with,
+                int num_with, Arena *arena);
+
+// Updates spans after the num_removed characters at display index start
+//  were replaced by num_inserted others: the spans after them are moved
+//  along. The codes of the inserted characters are left unspecified, to
+//  be set again with HS_Replace. spans may be NULL.
+void HS_Edit(HLSpans *spans, int start, int num_removed, int num_inserted);
+
+// Drops the highlighting of the characters at display index size and
+//  after. spans may be NULL.
+void HS_Truncate(HLSpans *spans, int size);
+
+// Returns the block of spans to arena. Does nothing if spans is NULL.
+void HS_Free(HLSpans *spans, Arena *arena);
+
+#endif  // HL_SPANS_H_
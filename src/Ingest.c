@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>  // for memchr
+#include <unistd.h>  // for sysconf
+
+#include "Ingest.h"
+#include "LineTree.h"
+
+// the smallest chunk worth giving its own thread. files smaller than two
+//  chunks are scanned on the calling thread only.
+#define INGEST_MIN_CHUNK (4 * 1024 * 1024)
+// the most chunks a file is split into.
+#define INGEST_MAX_CHUNKS 64
+
+// a part of the file scanned by one thread.
+typedef struct {
+  // the text of the chunk, [start, end). ends right after a newline,
+  //  unless it is the last chunk.
+  const char *start;
+  const char *end;
+  // true if the lines are collected into runs rather than leaves.
+  bool as_runs;
+  // collects the lines of the chunk into leaves allocated from an arena
+  //  of the chunk's own, so threads don't share an allocator.
+  LTBuilder builder;
+} IngestChunk;
+
+// Adds a FileLine for each line of chunk to its builder, or a run for
+//  each LT_LEAF_MAX lines if chunk->as_runs.
+static void Ingest_ScanChunk(IngestChunk *chunk) {
+  const char *pos = chunk->start;
+  const char *end = chunk->end;
+  FileLine f_line;
+  while (pos < end) {
+    if (!chunk->as_runs) {
+      pos = File_MappedLine(pos, end, &f_line);
+      LT_BuilderAppend(&(chunk->builder), &f_line);
+      continue;
+    }
+    const char *run_start = pos;
+    int num_lines = 0;
+    long num_bytes = 0;
+    while (pos < end && num_lines < LT_LEAF_MAX) {
+      pos = File_MappedLine(pos, end, &f_line);
+      num_lines++;
+      num_bytes += f_line.size + 1;
+    }
+    LT_BuilderAppendRun(&(chunk->builder), run_start, pos, num_lines,
+                        num_bytes);
+  }
+}
+
+// The start routine of a worker thread scanning the IngestChunk arg.
+static void *Ingest_Worker(void *arg) {
+  Ingest_ScanChunk(arg);
+  return NULL;
+}
+
+// Returns the number of chunks to split size bytes into.
+static int Ingest_NumChunks(size_t size) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t num_chunks = size / INGEST_MIN_CHUNK;
+  if (num_cpus > 0 && num_chunks > (size_t) num_cpus) {
+    num_chunks = num_cpus;
+  }
+  if (num_chunks > INGEST_MAX_CHUNKS) {
+    num_chunks = INGEST_MAX_CHUNKS;
+  }
+  return (num_chunks < 1) ? 1 : num_chunks;
+}
+
+FileLines *Ingest_MappedLines(const char *text, size_t size, Arena *arena,
+                              bool as_runs) {
+  IngestChunk chunks[INGEST_MAX_CHUNKS];
+  pthread_t threads[INGEST_MAX_CHUNKS];
+  // true for the chunks scanned on a thread of their own.
+  bool on_thread[INGEST_MAX_CHUNKS];
+  int num_chunks = Ingest_NumChunks(size);
+
+  // split the text into chunks of about the same size, each extended
+  //  to the end of the line it would cut in two.
+  const char *end = text + size;
+  const char *pos = text;
+  for (int i = 0; i < num_chunks; i++) {
+    chunks[i].start = pos;
+    if (i == num_chunks - 1) {
+      chunks[i].end = end;
+    } else {
+      const char *split = text + size / num_chunks * (i + 1);
+      if (split < pos) {
+        // the previous chunk ran past this one's share.
+        split = pos;
+      }
+      const char *newline = memchr(split, '\n', end - split);
+      chunks[i].end = (newline == NULL) ? end : newline + 1;
+    }
+    pos = chunks[i].end;
+    chunks[i].as_runs = as_runs;
+    // the first chunk is scanned on this thread, straight into arena.
+    LT_BuilderInit(&(chunks[i].builder), (i == 0) ? arena : Arena_New());
+  }
+
+  for (int i = 1; i < num_chunks; i++) {
+    on_thread[i] = pthread_create(&(threads[i]), NULL, Ingest_Worker,
+                                  &(chunks[i])) == 0;
+  }
+  Ingest_ScanChunk(&(chunks[0]));
+  for (int i = 1; i < num_chunks; i++) {
+    if (on_thread[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      // no thread could be started for the chunk, so scan it here.
+      Ingest_ScanChunk(&(chunks[i]));
+    }
+  }
+
+  // stitch the leaves of all chunks into one tree, and make arena own
+  //  the leaves allocated by the workers.
+  LTBuilder builders[INGEST_MAX_CHUNKS];
+  for (int i = 0; i < num_chunks; i++) {
+    builders[i] = chunks[i].builder;
+  }
+  FileLines *lines = LT_BuilderFinish(builders, num_chunks, arena);
+  for (int i = 1; i < num_chunks; i++) {
+    Arena_Merge(arena, chunks[i].builder.arena);
+  }
+  return lines;
+}
@@ -0,0 +1,24 @@
+#ifndef INGEST_H_
+#define INGEST_H_
+
+// Builds the line index of a memory-mapped file. Large files are split
+//  into chunks that end at newlines, and the chunks are scanned for
+//  newlines on a pool of threads, one per online CPU. Each thread fills
+//  the leaves of the line tree for its chunk, and the leaves are then
+//  stitched into one tree in file order.
+
+#include <stdbool.h>
+#include <stddef.h>  // for size_t
+
+#include "Arena.h"
+#include "FileParser.h"  // for FileLines
+
+// Returns the FileLines of the size bytes of text, delimiting on \n and
+//  removing any \r before it. Each FileLine points into text, so it must
+//  stay mapped as long as the lines are used. The tree and its nodes are
+//  allocated from arena. If as_runs, the lines are left unloaded as runs
+//  (see LineTree.h), and only loaded when they are first reached.
+FileLines *Ingest_MappedLines(const char *text, size_t size, Arena *arena,
+                              bool as_runs);
+
+#endif  // INGEST_H_
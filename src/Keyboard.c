@@ -1,3 +1,8 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>    // for poll
+#include <string.h>  // for memmove, memchr, memcmp, memcpy
 #include <unistd.h>
 #include <ctype.h>  // for isdigit
 
@@ -5,86 +10,285 @@
 #include "Quit.h"
 #include "IOUtils.h"
 #include "ESCCommands.h"
+#include "EventLoop.h"
 
-int Keyboard_ReadKey(void) {
-  int bytes_read;
-  unsigned char key;
-  while ((bytes_read = WrappedRead(STDIN_FILENO, &key, 1)) != 1) {
-    if (bytes_read == -1) quit("Keyboard_ReadKey");
-  }
+// the size of the buffer input is read into. everything the terminal has
+//  sent is read at once, up to this many bytes.
+#define KEY_BUF_SIZE 4096
+// how long to wait for the rest of an escape sequence before taking
+//  the ESC as the esc key, in milliseconds.
+#define KEY_ESC_TIMEOUT_MS 100
+// the largest parameter of an escape sequence that is kept track of.
+#define KEY_MAX_PARAM 1000
+// the sequence that follows pasted text in bracketed paste mode.
+#define KEY_PASTE_END "\x1b[201~"
+// what Keyboard_Decode gives for the terminal's answer to a status
+//  request, ESC[0n, which is not a key.
+#define KEY_STATUS_REPORT (-1)
 
-  // read an escape sequence as 1 character
-  if (key == (unsigned char) ESC) {
-    unsigned char cmd[3];
+// the states of the escape sequence decoder.
+typedef enum {
+  // at the start of a key.
+  DECODE_START,
+  // after an ESC.
+  DECODE_ESC,
+  // in a control sequence: ESC[, then parameters, then a final byte.
+  DECODE_CSI,
+  // after ESC O, which is followed by a single final byte.
+  DECODE_SS3,
+} DecodeState_t;
 
-    // read in '[' and next character to the buffer.
-    if (WrappedRead(STDIN_FILENO, &cmd[0], 1) != 1 ||
-        WrappedRead(STDIN_FILENO, &cmd[1], 1) != 1) {
-      // read timed out, so user probably pressed the esc key.
-      return KEY_ESC;
-    }
+// the bytes read from stdin and not decoded yet, [in_start, in_end).
+static unsigned char in_buf[KEY_BUF_SIZE];
+static int in_start = 0;
+static int in_end = 0;
+// the function called on each answer to a status request, and its arg.
+static LoopFn report_fn = NULL;
+static void *report_arg = NULL;
+
+// Returns the key of the control sequence with the given first parameter
+//  (0 if it has none) and final byte. Unknown sequences give KEY_ESC.
+static int Keyboard_CSIKey(int param, unsigned char final) {
+  switch (final) {
+    // modifiers (e.g., ESC[1;5A for ctrl-up) are in later parameters, and
+    //  ignored.
+    case 'A':
+      return KEY_ARROW_UP;
+    case 'B':
+      return KEY_ARROW_DOWN;
+    case 'C':
+      return KEY_ARROW_RIGHT;
+    case 'D':
+      return KEY_ARROW_LEFT;
+    // other ways for OS to indicate HOME and END:
+    case 'H':
+      return KEY_HOME;
+    case 'F':
+      return KEY_END;
+    case '~':
+      // form: ESC[<number>~
+      switch (param) {
+        case 3:
+          return KEY_DELETE;
+        case 5:  // ESC[5~
+          return KEY_PAGE_UP;
+        case 6:  // ESC[6~
+          return KEY_PAGE_DOWN;
+        case 1:
+        case 7:
+          // both refer to home key press (OS dependent)
+          return KEY_HOME;
+        case 4:
+        case 8:
+          // both refer to end key press (OS dependent)
+          return KEY_END;
+        case 200:
+          return KEY_PASTE;
+      }
+      break;
+    case 'n':
+      // form: ESC[0n, the answer to a status request.
+      if (param == 0) {
+        return KEY_STATUS_REPORT;
+      }
+  }
+  return KEY_ESC;
+}
 
-    if (cmd[0] == (unsigned char) '[') {
-      // cmd has the form: ESC[<...>
-      // if <...> has a 5~ or 5~ as next 1 characters,
-      //  it's a page up or down, respectively.
-      if (isdigit(cmd[1])) {
-        if (WrappedRead(STDIN_FILENO, &cmd[2], 1) != 1) {
-          // timeout, so probably just pressed ESC key
-          return KEY_ESC;
+// Returns the key of the sequence ESC O <final>.
+static int Keyboard_SS3Key(unsigned char final) {
+  // terminals send these for the arrow keys in application cursor mode,
+  //  and as more ways to indicate HOME and END.
+  switch (final) {
+    case 'A':
+    case 'B':
+    case 'C':
+    case 'D':
+    case 'H':
+    case 'F':
+      return Keyboard_CSIKey(0, final);
+  }
+  return KEY_ESC;
+}
+
+// Decodes the key at the start of the size bytes of buf into *key, and
+//  returns the number of bytes it took. Returns 0 if buf ends before the
+//  key does, as in the middle of an escape sequence.
+static int Keyboard_Decode(const unsigned char *buf, int size, int *key) {
+  DecodeState_t state = DECODE_START;
+  // the first parameter of a control sequence, and whether it is still
+  //  being read.
+  int param = 0;
+  bool in_first_param = true;
+  for (int i = 0; i < size; i++) {
+    unsigned char c = buf[i];
+    switch (state) {
+      case DECODE_START:
+        if (c != (unsigned char) ESC) {
+          *key = (c == '\r') ? KEY_RETURN : c;
+          return 1;
         }
-        // form: ESC[<digit><...>
-        if (cmd[2] == '~') {
-        // form: ESC[<digit>~
-          switch (cmd[1]) {
-            case '3':
-              return KEY_DELETE;
-            case '5':  // ESC[5~
-              return KEY_PAGE_UP;
-            case '6':  // ESC[6~
-              return KEY_PAGE_DOWN;
-            case '1':
-            case '7':
-              // both refer to home key press (OS dependent)
-              return KEY_HOME;
-            case '4':
-            case '8':
-              // both refer to end key press (OS dependent)
-              return KEY_END;
-          }
+        state = DECODE_ESC;
+        break;
+      case DECODE_ESC:
+        if (c == '[') {
+          state = DECODE_CSI;
+        } else if (c == 'O') {
+          state = DECODE_SS3;
+        } else {
+          // the ESC key, followed by another key.
+          *key = KEY_ESC;
+          return 1;
         }
-      } else {
-        // map the arrow keys to asdw that can move the cursor.
-        // form: ESC[<...>
-        switch (cmd[1]) {
-          case 'A':
-            return KEY_ARROW_UP;
-          case 'B':
-            return KEY_ARROW_DOWN;
-          case 'C':
-            return KEY_ARROW_RIGHT;
-          case 'D':
-            return KEY_ARROW_LEFT;
-          // other ways for OS to indicate HOME and END:
-          case 'H':
-            return KEY_HOME;
-          case 'F':
-            return KEY_END;
+        break;
+      case DECODE_CSI:
+        if (isdigit(c) && in_first_param) {
+          if (param < KEY_MAX_PARAM) {
+            param = param * 10 + (c - '0');
+          }
+        } else if (c == ';') {
+          in_first_param = false;
+        } else if (c < 0x20 || c > 0x3f) {
+          // anything but a parameter or intermediate byte ends the
+          //  sequence. a final byte is in [0x40, 0x7e].
+          *key = (c >= 0x40 && c <= 0x7e) ? Keyboard_CSIKey(param, c)
+                                           : KEY_ESC;
+          return i + 1;
         }
+        break;
+      case DECODE_SS3:
+        *key = Keyboard_SS3Key(c);
+        return i + 1;
+    }
+  }
+  return 0;
+}
+
+// Reads whatever input is available into in_buf, waiting up to
+//  KEY_ESC_TIMEOUT_MS for some if wait is true. Returns the number of
+//  bytes read. Calls quit if reading fails or stdin was closed.
+static int Keyboard_Fill(bool wait) {
+  if (in_start > 0) {
+    // move the bytes not decoded yet to the front, to make room.
+    memmove(in_buf, &(in_buf[in_start]), in_end - in_start);
+    in_end -= in_start;
+    in_start = 0;
+  }
+  if (in_end == KEY_BUF_SIZE) {
+    return 0;
+  }
+  struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+  int res;
+  do {
+    // a signal (e.g., a resize) must not cut the wait short, or the start
+    //  of an escape sequence would be taken as the esc key.
+    res = poll(&pfd, 1, wait ? KEY_ESC_TIMEOUT_MS : 0);
+  } while (res == -1 && errno == EINTR);
+  if (res <= 0) {
+    return 0;
+  }
+  int bytes_read = WrappedRead(STDIN_FILENO, &(in_buf[in_end]),
+                               KEY_BUF_SIZE - in_end);
+  if (bytes_read == 0) {
+    // stdin was ready but had nothing to read, so the terminal is gone.
+    errno = EIO;
+    bytes_read = -1;
+  }
+  if (bytes_read == -1) {
+    quit("Keyboard_ReadKey");
+  }
+  in_end += bytes_read;
+  return bytes_read;
+}
+
+// Takes the answers to status requests at the start of the input not
+//  decoded yet out of it, calling report_fn on each.
+static void Keyboard_TakeReports(void) {
+  int key;
+  int size;
+  while ((size = Keyboard_Decode(&(in_buf[in_start]), in_end - in_start,
+                                 &key)) > 0 && key == KEY_STATUS_REPORT) {
+    in_start += size;
+    if (report_fn != NULL) {
+      report_fn(report_arg);
+    }
+  }
+}
+
+// Reads the input that arrived on stdin. Called by the event loop.
+static void Keyboard_OnInput(void *arg) {
+  (void) arg;
+  Keyboard_Fill(false);
+}
+
+void Keyboard_Init(void) {
+  Loop_WatchFd(STDIN_FILENO, Keyboard_OnInput, NULL);
+}
+
+void Keyboard_OnStatusReport(LoopFn fn, void *arg) {
+  report_fn = fn;
+  report_arg = arg;
+}
+
+int Keyboard_ReadKey(void) {
+  while (true) {
+    Keyboard_TakeReports();
+    int key;
+    int size = Keyboard_Decode(&(in_buf[in_start]), in_end - in_start, &key);
+    if (size > 0) {
+      in_start += size;
+      return key;
+    }
+    if (in_end == in_start) {
+      // sleep in the event loop, which runs timers and watches other
+      //  descriptors meanwhile, until input arrives.
+      Loop_RunOnce(-1);
+    } else if (Keyboard_Fill(true) == 0) {
+      // nothing followed a cut-off escape sequence before the timeout
+      //  (or it is too long to be one), so the user probably pressed
+      //  the esc key.
+      in_start = in_end;
+      return KEY_ESC;
+    }
+  }
+}
+
+bool Keyboard_KeyPending(void) {
+  Keyboard_TakeReports();
+  if (in_end == in_start && Keyboard_Fill(false) > 0) {
+    Keyboard_TakeReports();
+  }
+  return in_end > in_start;
+}
+
+void Keyboard_ReadPaste(Buffer *paste) {
+  int end_size = sizeof(KEY_PASTE_END) - 1;
+  while (true) {
+    // take the text up to the end of the paste, or up to an ESC that
+    //  may start it but is cut off by the end of the input read so far.
+    int end = in_start;
+    unsigned char *esc;
+    while ((esc = memchr(&(in_buf[end]), ESC, in_end - end)) != NULL) {
+      end = esc - in_buf;
+      int size = (in_end - end < end_size) ? in_end - end : end_size;
+      if (memcmp(esc, KEY_PASTE_END, size) == 0) {
+        break;
       }
-    } else if (cmd[0] == 'O') {
-      // more ways for OS to indicate HOME and END:
-      switch (cmd[1]) {
-        case 'H':
-          return KEY_HOME;
-        case 'F':
-          return KEY_END;
-      }
+      end++;
+    }
+    if (esc == NULL) {
+      end = in_end;
+    }
+    char *dest = WB_Extend(paste, end - in_start);
+    if (dest == NULL) {
+      quit("Keyboard_ReadPaste");
+    }
+    memcpy(dest, &(in_buf[in_start]), end - in_start);
+    in_start = end;
+    if (in_end - in_start >= end_size) {
+      in_start += end_size;
+      return;
     }
-    return KEY_ESC;
-  } else if (key == '\r') {
-    return KEY_RETURN;
-  } else {
-    return key;
+    Keyboard_Fill(true);
   }
 }
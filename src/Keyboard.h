@@ -1,7 +1,14 @@
 #ifndef KEYBOARD_H_
 #define KEYBOARD_H_
 
-// Functions and constants to interface with the keyboard.
+// Functions and constants to interface with the keyboard. Input is read
+//  from stdin as many bytes at a time as are available, when the event
+//  loop finds some, and decoded into keys from a buffer.
+
+#include <stdbool.h>
+
+#include "EventLoop.h"  // for LoopFn
+#include "WriteBuffer.h"
 
 typedef enum {
   // special key-binding codes.
@@ -21,14 +28,35 @@ typedef enum {
   KEY_HOME,  // ESC[1~, ESC[7~, ESC[H, ESC[OH
   KEY_END,  // ESC[4~, ESC[8~, ESC[F, ESC[OF
   // delete key
-  KEY_DELETE  // ESC[3~
+  KEY_DELETE,  // ESC[3~
+  // the start of pasted text, which is read with Keyboard_ReadPaste.
+  //  only sent once bracketed paste mode is on (see ESCCommands.h).
+  KEY_PASTE  // ESC[200~
 } Key_t;
 
-// Reads and returns 1 keypress from stdin. Calls quit if
-//  reading has a fatal error. Converts escape sequences
-//  to single character constants defined in the above enum.
-//  Returns 0 (the null byte '\0') if read times out before
-//  reading 1 keystroke.
+// Has the event loop read stdin whenever input arrives. Must be called
+//  before reading keys.
+void Keyboard_Init(void);
+
+// Reads and returns 1 keypress from stdin, sleeping in the event loop
+//  (see EventLoop.h) until one arrives if none was read yet. Calls quit
+//  if reading has a fatal error. Converts escape sequences to single
+//  character constants defined in the above enum. Unknown escape
+//  sequences are read whole and returned as KEY_ESC.
 int Keyboard_ReadKey(void);
 
+// Returns true if input for another key has already arrived, so
+//  Keyboard_ReadKey won't have to wait for the user.
+bool Keyboard_KeyPending(void);
+
+// Calls fn with arg each time the terminal answers a device status
+//  request (see ESC_CMD_STATUS_REPORT). The answers are taken out of the
+//  input as it is decoded, and never returned as keys.
+void Keyboard_OnStatusReport(LoopFn fn, void *arg);
+
+// Appends the text pasted after Keyboard_ReadKey returned KEY_PASTE to
+//  paste, as is, up to the sequence the terminal ends it with. Calls quit
+//  on allocation failure.
+void Keyboard_ReadPaste(Buffer *paste);
+
 #endif  // KEYBOARD_H_
@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Keywords.h"
+#include "Quit.h"
+
+// the most keywords per slot of the table, kept low so lookups of
+//  tokens that aren't keywords end at an empty slot quickly.
+#define KW_MAX_LOAD 2
+// the size classes are tracked in a 32 bit mask, so keywords must be
+//  shorter than this.
+#define KW_MAX_SIZE 32
+
+// a slot of the table, empty if word is NULL.
+typedef struct {
+  const char *word;
+  // the size of word without any trailing '|'.
+  int size;
+  Keyword_t type;
+} KeywordSlot;
+
+struct KeywordTable {
+  // the size of the longest keyword.
+  int max_size;
+  // bit i is set if there is a keyword of size i, so most tokens that
+  //  aren't keywords are turned down without hashing them.
+  uint32_t sizes;
+  // the number of slots minus 1. the number of slots is a power of 2.
+  uint32_t mask;
+  KeywordSlot slots[];
+};
+
+// Returns the FNV-1a hash of the size characters of word.
+static uint32_t KW_Hash(const char *word, int size) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < size; i++) {
+    hash ^= (unsigned char) word[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+KeywordTable *KW_Compile(char **keywords) {
+  int num_keywords = 0;
+  while (keywords[num_keywords] != NULL) {
+    num_keywords++;
+  }
+  uint32_t num_slots = 1;
+  while (num_slots < (uint32_t) num_keywords * KW_MAX_LOAD) {
+    num_slots *= 2;
+  }
+
+  KeywordTable *table = calloc(1, sizeof(KeywordTable) +
+                                  num_slots * sizeof(KeywordSlot));
+  if (table == NULL) {
+    quit("KW_Compile");
+  }
+  table->mask = num_slots - 1;
+
+  for (int i = 0; i < num_keywords; i++) {
+    int size = strlen(keywords[i]);
+    Keyword_t type = KW_TYPE1;
+    if (size > 0 && keywords[i][size - 1] == '|') {
+      // remove the last char if it is a type 2 keyword.
+      size--;
+      type = KW_TYPE2;
+    }
+    if (size == 0 || size >= KW_MAX_SIZE) {
+      continue;
+    }
+    // probe linearly for the keyword or the first empty slot.
+    uint32_t slot = KW_Hash(keywords[i], size) & table->mask;
+    while (table->slots[slot].word != NULL &&
+           !(table->slots[slot].size == size &&
+             !memcmp(table->slots[slot].word, keywords[i], size))) {
+      slot = (slot + 1) & table->mask;
+    }
+    if (table->slots[slot].word != NULL) {
+      // listed before, so keep the first entry.
+      continue;
+    }
+    table->slots[slot] = (KeywordSlot) {keywords[i], size, type};
+    table->sizes |= (uint32_t) 1 << size;
+    if (size > table->max_size) {
+      table->max_size = size;
+    }
+  }
+  return table;
+}
+
+Keyword_t KW_Lookup(const KeywordTable *table, const char *word, int size) {
+  if (size <= 0 || size > table->max_size ||
+      !(table->sizes & ((uint32_t) 1 << size))) {
+    return KW_NONE;
+  }
+  uint32_t slot = KW_Hash(word, size) & table->mask;
+  while (table->slots[slot].word != NULL) {
+    if (table->slots[slot].size == size &&
+        !memcmp(table->slots[slot].word, word, size)) {
+      return table->slots[slot].type;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+  return KW_NONE;
+}
+
+int KW_MaxSize(const KeywordTable *table) {
+  return table->max_size;
+}
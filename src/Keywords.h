@@ -0,0 +1,31 @@
+#ifndef KEYWORDS_H_
+#define KEYWORDS_H_
+
+// A hash table of the keywords of a language, compiled once from its
+//  keyword list so the lexer can tell if a token is a keyword with a
+//  single lookup instead of comparing it against every keyword. Tables
+//  are never freed, as they live as long as the languages they belong to.
+
+// the kinds of keywords. type 2 keywords are listed with a trailing '|'.
+typedef enum {
+  KW_NONE = 0,
+  KW_TYPE1,
+  KW_TYPE2,
+} Keyword_t;
+
+typedef struct KeywordTable KeywordTable;
+
+// Returns a table of the NULL-terminated list of keywords. Where a
+//  keyword is listed more than once, the first entry wins. Calls quit on
+//  allocation failure.
+KeywordTable *KW_Compile(char **keywords);
+
+// Returns the kind of the keyword made up of the size characters of word,
+//  or KW_NONE if it is not a keyword.
+Keyword_t KW_Lookup(const KeywordTable *table, const char *word, int size);
+
+// Returns the size of the longest keyword of table, so tokens longer
+//  than this don't have to be read to their end.
+int KW_MaxSize(const KeywordTable *table);
+
+#endif  // KEYWORDS_H_
@@ -0,0 +1,971 @@
+#include <stddef.h>  // for offsetof
+#include <stdlib.h>
+#include <string.h>  // for memmove, memcpy
+
+#include "LineTree.h"
+#include "Quit.h"
+
+// the size of a run, which only has the fields before the entries.
+#define RUN_SIZE offsetof(LTNode, entries)
+
+// Returns a new empty node from arena.
+static LTNode *LT_NewNode(Arena *arena, bool is_leaf) {
+  LTNode *node = Arena_Alloc(arena, sizeof(LTNode));
+  node->is_leaf = is_leaf;
+  node->is_run = false;
+  node->num_entries = 0;
+  node->num_lines = 0;
+  node->num_loaded = is_leaf ? 1 : 0;
+  node->num_bytes = 0;
+  node->num_rows = 0;
+  node->rows_cols = 0;
+  node->text_start = NULL;
+  node->text_end = NULL;
+  return node;
+}
+
+// Returns a new run of num_lines lines taking num_bytes bytes and
+//  num_rows rows as counted with the lines unwrapped, whose text is
+//  [start, end).
+static LTNode *LT_NewRun(Arena *arena, const char *start, const char *end,
+                         int num_lines, long num_bytes, long num_rows) {
+  LTNode *run = Arena_Alloc(arena, RUN_SIZE);
+  run->is_leaf = true;
+  run->is_run = true;
+  run->num_entries = num_lines;
+  run->num_lines = num_lines;
+  run->num_loaded = 0;
+  run->num_bytes = num_bytes;
+  run->num_rows = num_rows;
+  run->rows_cols = 0;
+  run->text_start = start;
+  run->text_end = end;
+  return run;
+}
+
+// the following helpers let leaves and inner nodes share the code that
+//  shifts, splits and merges their entries.
+
+static char *LT_Entries(LTNode *node) {
+  return node->is_leaf ? (char *) node->entries.lines :
+                         (char *) node->entries.children;
+}
+
+static size_t LT_EntrySize(LTNode *node) {
+  return node->is_leaf ? sizeof(FileLine) : sizeof(LTNode *);
+}
+
+static int LT_MaxEntries(LTNode *node) {
+  return node->is_leaf ? LT_LEAF_MAX : LT_NODE_MAX;
+}
+
+// Returns the number of rows f_line takes when wrapped at the wrap width
+//  of tree, counting them only if the line has not been counted since it
+//  was last edited. A line takes one more row than it fills, so there is
+//  room for the cursor after its last column.
+static int LT_LineRows(LineTree *tree, FileLine *f_line) {
+  if (tree->wrap_cols == 0) {
+    return 1;
+  }
+  if (f_line->num_rows == 0) {
+    f_line->num_rows = File_LineWidth(f_line) / tree->wrap_cols + 1;
+  }
+  return f_line->num_rows;
+}
+
+// Forgets the rows the lines of leaf were counted to take if that was at
+//  another wrap width than tree's, so they are counted again.
+static void LT_ClearRows(LineTree *tree, LTNode *leaf) {
+  if (leaf->rows_cols == tree->wrap_cols) {
+    return;
+  }
+  for (int i = 0; i < leaf->num_entries; i++) {
+    leaf->entries.lines[i].num_rows = 0;
+  }
+  leaf->rows_cols = tree->wrap_cols;
+}
+
+// Recounts the lines, bytes, rows and loaded leaves in node's subtree
+//  from its direct entries. The bytes and rows of a run are known from
+//  when it was made. The rows of a leaf are counted at the wrap width.
+static void LT_Recount(LineTree *tree, LTNode *node) {
+  if (node->is_run) {
+    node->num_lines = node->num_entries;
+    node->num_loaded = 0;
+    return;
+  }
+  if (node->is_leaf) {
+    LT_ClearRows(tree, node);
+    node->num_lines = node->num_entries;
+    node->num_loaded = 1;
+    node->num_bytes = 0;
+    node->num_rows = 0;
+    for (int i = 0; i < node->num_entries; i++) {
+      node->num_bytes += node->entries.lines[i].size + 1;
+      node->num_rows += LT_LineRows(tree, &(node->entries.lines[i]));
+    }
+    return;
+  }
+  node->num_lines = 0;
+  node->num_loaded = 0;
+  node->num_bytes = 0;
+  node->num_rows = 0;
+  node->rows_cols = tree->wrap_cols;
+  for (int i = 0; i < node->num_entries; i++) {
+    LTNode *child = node->entries.children[i];
+    node->num_lines += child->num_lines;
+    node->num_loaded += child->num_loaded;
+    node->num_bytes += child->num_bytes;
+    node->num_rows += child->num_rows;
+    if (child->rows_cols != tree->wrap_cols) {
+      node->rows_cols = -1;
+    }
+  }
+}
+
+// Returns the index of the child of inner node that holds line *idx,
+//  and makes *idx relative to that child. Scans from whichever end of
+//  the node is closer, so appending at the end is O(1) per level.
+static int LT_ChildFor(LTNode *node, int *idx) {
+  LTNode **children = node->entries.children;
+  int i;
+  if (*idx < node->num_lines / 2) {
+    i = 0;
+    while (i < node->num_entries - 1 && *idx >= children[i]->num_lines) {
+      *idx -= children[i]->num_lines;
+      i++;
+    }
+  } else {
+    i = node->num_entries - 1;
+    // the index of the first line in children[i].
+    int start = node->num_lines - children[i]->num_lines;
+    while (i > 0 && *idx < start) {
+      i--;
+      start -= children[i]->num_lines;
+    }
+    *idx -= start;
+  }
+  return i;
+}
+
+// Returns child child_idx of inner node parent, or the root if parent is
+//  NULL. If it is a run, it is first replaced by a leaf holding its
+//  lines. The counts of loaded leaves above the child are not updated.
+static LTNode *LT_Load(LineTree *tree, LTNode *parent, int child_idx) {
+  LTNode **slot = (parent == NULL) ? &(tree->root) :
+                                     &(parent->entries.children[child_idx]);
+  LTNode *run = *slot;
+  if (!run->is_run) {
+    return run;
+  }
+  LTNode *leaf = LT_NewNode(tree->arena, true);
+  const char *pos = run->text_start;
+  while (pos < run->text_end) {
+    pos = File_MappedLine(pos, run->text_end,
+                          &(leaf->entries.lines[leaf->num_entries++]));
+  }
+  LT_Recount(tree, leaf);
+  if (run->rows_cols != tree->wrap_cols) {
+    // the rows above the run add up to the rows it was counted at, so the
+    //  leaf keeps those until the rows above it are counted again.
+    leaf->num_rows = run->num_rows;
+    leaf->rows_cols = run->rows_cols;
+  }
+  // the leaf holds the run's text unchanged, so it can become a run again.
+  leaf->text_start = run->text_start;
+  leaf->text_end = run->text_end;
+  Arena_Free(tree->arena, run, RUN_SIZE);
+  *slot = leaf;
+  return leaf;
+}
+
+// Copies count entries of e_size bytes, starting at index first of the
+//  entries of the num_parts parts taken in order, to dest. Each part is
+//  an array of entries and their number.
+static void LT_CopyParts(char *dest, const char **parts, const int *sizes,
+                         int num_parts, int first, size_t e_size,
+                         int count) {
+  for (int i = 0; i < num_parts && count > 0; i++) {
+    if (first >= sizes[i]) {
+      first -= sizes[i];
+      continue;
+    }
+    int num = sizes[i] - first;
+    if (num > count) {
+      num = count;
+    }
+    memcpy(dest, parts[i] + first * e_size, num * e_size);
+    dest += num * e_size;
+    count -= num;
+    first = 0;
+  }
+}
+
+// Inserts the num entries (FileLines or LTNode pointers) of new_entries
+//  at position pos of node. If they don't all fit, node's entries are
+//  divided between node and as many new right siblings as needed, which
+//  are returned in order in *siblings (to be freed by the caller), and
+//  their number is returned. Otherwise returns 0.
+static int LT_InsertEntries(LineTree *tree, LTNode *node, int pos,
+                            const void *new_entries, int num,
+                            LTNode ***siblings) {
+  size_t e_size = LT_EntrySize(node);
+  int max = LT_MaxEntries(node);
+  char *entries = LT_Entries(node);
+  // the node no longer holds just the text it was loaded from.
+  node->text_start = NULL;
+  *siblings = NULL;
+  if (node->is_leaf) {
+    // the rows of its lines are counted at one width wherever they go.
+    LT_ClearRows(tree, node);
+  }
+
+  if (node->num_entries + num <= max) {
+    // make room for the new entries.
+    memmove(entries + (pos + num) * e_size, entries + pos * e_size,
+            (node->num_entries - pos) * e_size);
+    memcpy(entries + pos * e_size, new_entries, num * e_size);
+    node->num_entries += num;
+    LT_Recount(tree, node);
+    return 0;
+  }
+
+  // set the entries after pos aside, then deal all of the entries out to
+  //  node and its new siblings in order. the entries before pos are
+  //  already in place, and node only ever takes entries from after them
+  //  into slots that were set aside.
+  char scratch[sizeof(((LTNode *) NULL)->entries)];
+  int num_tail = node->num_entries - pos;
+  memcpy(scratch, entries + pos * e_size, num_tail * e_size);
+  const char *parts[] = {entries, new_entries, scratch};
+  int sizes[] = {pos, num, num_tail};
+  int total = node->num_entries + num;
+  int num_nodes = (total + max - 1) / max;
+  *siblings = malloc((num_nodes - 1) * sizeof(LTNode *));
+  if (*siblings == NULL) {
+    quit("LT_InsertEntries");
+  }
+
+  int first = 0;
+  for (int i = 0; i < num_nodes; i++) {
+    int count;
+    if (num_tail == 0) {
+      // when appending at the end (the common case while loading a
+      //  file), fill the nodes rather than leaving half-empty ones behind.
+      count = (i < num_nodes - 1) ? max : total - first;
+    } else {
+      count = total / num_nodes + (i >= num_nodes - total % num_nodes);
+    }
+    LTNode *dest = node;
+    if (i > 0) {
+      dest = LT_NewNode(tree->arena, node->is_leaf);
+      dest->rows_cols = node->rows_cols;
+      (*siblings)[i - 1] = dest;
+    }
+    if (i > 0 || first + count > pos) {
+      int skip = (i == 0) ? pos : 0;
+      LT_CopyParts(LT_Entries(dest) + skip * e_size, parts, sizes, 3,
+                   first + skip, e_size, count - skip);
+    }
+    dest->num_entries = count;
+    LT_Recount(tree, dest);
+    first += count;
+  }
+  return num_nodes - 1;
+}
+
+// Inserts the num lines of lines at index idx of node's subtree. Returns
+//  the number of new right siblings node was split into, which are
+//  returned in *siblings as by LT_InsertEntries.
+static int LT_InsertAt(LineTree *tree, LTNode *node, int idx,
+                       const FileLine *lines, int num, LTNode ***siblings) {
+  if (node->is_leaf) {
+    return LT_InsertEntries(tree, node, idx, lines, num, siblings);
+  }
+
+  int child_idx = LT_ChildFor(node, &idx);
+  LTNode **split;
+  int num_split = LT_InsertAt(tree, LT_Load(tree, node, child_idx), idx,
+                              lines, num, &split);
+  if (num_split == 0) {
+    LT_Recount(tree, node);
+    *siblings = NULL;
+    return 0;
+  }
+  // the child was split, so add its new siblings right after it.
+  int res = LT_InsertEntries(tree, node, child_idx + 1, split, num_split,
+                             siblings);
+  free(split);
+  return res;
+}
+
+// Fixes up children[child_idx] of node after a removal if it has too
+//  few entries, by merging it with or borrowing from a neighbour.
+static void LT_Rebalance(LineTree *tree, LTNode *node, int child_idx) {
+  LTNode **children = node->entries.children;
+  LTNode *child = children[child_idx];
+  int max = LT_MaxEntries(child);
+  if (child->num_entries >= max / 4 || node->num_entries < 2) {
+    return;
+  }
+
+  // work on the pair (left, right) formed with a neighbour, which has to
+  //  be loaded if it is a run.
+  int left_idx = (child_idx > 0) ? child_idx - 1 : child_idx;
+  LTNode *left = LT_Load(tree, node, left_idx);
+  LTNode *right = LT_Load(tree, node, left_idx + 1);
+  left->text_start = NULL;
+  right->text_start = NULL;
+  if (left->is_leaf) {
+    // lines moved between the two keep rows counted at one width.
+    LT_ClearRows(tree, left);
+    LT_ClearRows(tree, right);
+  }
+  size_t e_size = LT_EntrySize(child);
+  int total = left->num_entries + right->num_entries;
+
+  if (total <= max) {
+    // merge right into left and drop right from node.
+    memcpy(LT_Entries(left) + left->num_entries * e_size, LT_Entries(right),
+           right->num_entries * e_size);
+    left->num_entries = total;
+    LT_Recount(tree, left);
+    Arena_Free(tree->arena, right, sizeof(LTNode));
+    memmove(&children[left_idx + 1], &children[left_idx + 2],
+            (node->num_entries - left_idx - 2) * sizeof(LTNode *));
+    node->num_entries--;
+    return;
+  }
+
+  // too many entries to merge, so split them evenly between the two.
+  int num_left = total / 2;
+  if (left->num_entries > num_left) {
+    // shift the tail of left to the front of right.
+    int moved = left->num_entries - num_left;
+    memmove(LT_Entries(right) + moved * e_size, LT_Entries(right),
+            right->num_entries * e_size);
+    memcpy(LT_Entries(right), LT_Entries(left) + num_left * e_size,
+           moved * e_size);
+  } else {
+    // shift the front of right to the tail of left.
+    int moved = num_left - left->num_entries;
+    memcpy(LT_Entries(left) + left->num_entries * e_size, LT_Entries(right),
+           moved * e_size);
+    memmove(LT_Entries(right), LT_Entries(right) + moved * e_size,
+            (right->num_entries - moved) * e_size);
+  }
+  left->num_entries = num_left;
+  right->num_entries = total - num_left;
+  LT_Recount(tree, left);
+  LT_Recount(tree, right);
+}
+
+// Removes the line at index idx of node's subtree into removed.
+static void LT_RemoveAt(LineTree *tree, LTNode *node, int idx,
+                        FileLine *removed) {
+  if (node->is_leaf) {
+    *removed = node->entries.lines[idx];
+    memmove(&(node->entries.lines[idx]), &(node->entries.lines[idx + 1]),
+            (node->num_entries - idx - 1) * sizeof(FileLine));
+    node->num_entries--;
+    LT_Recount(tree, node);
+    node->text_start = NULL;
+    return;
+  }
+
+  int child_idx = LT_ChildFor(node, &idx);
+  LT_RemoveAt(tree, LT_Load(tree, node, child_idx), idx, removed);
+  LT_Rebalance(tree, node, child_idx);
+  LT_Recount(tree, node);
+}
+
+// Turns the leaf children[child_idx] of node back into a run, freeing
+//  the display buffers of its lines, if it still holds just the text it
+//  was loaded from and none of its lines were edited.
+static void LT_UnloadLeaf(LineTree *tree, LTNode *node, int child_idx) {
+  LTNode *leaf = node->entries.children[child_idx];
+  if (leaf->text_start == NULL) {
+    return;
+  }
+  for (int i = 0; i < leaf->num_entries; i++) {
+    if (leaf->entries.lines[i].is_owned) {
+      return;
+    }
+  }
+  for (int i = 0; i < leaf->num_entries; i++) {
+    File_FreeFileLineBufs(&(leaf->entries.lines[i]));
+  }
+  LTNode *run = LT_NewRun(tree->arena, leaf->text_start, leaf->text_end,
+                          leaf->num_entries, leaf->num_bytes,
+                          leaf->num_rows);
+  run->rows_cols = leaf->rows_cols;
+  node->entries.children[child_idx] = run;
+  Arena_Free(tree->arena, leaf, sizeof(LTNode));
+}
+
+// Unloads the leaves of node's subtree, whose first line has index base,
+//  that lie entirely outside of the lines [first, last).
+static void LT_UnloadIn(LineTree *tree, LTNode *node, int base, int first,
+                        int last) {
+  for (int i = 0; i < node->num_entries; i++) {
+    LTNode *child = node->entries.children[i];
+    int end = base + child->num_lines;
+    if (child->num_loaded > 0 && (base < first || end > last)) {
+      if (!child->is_leaf) {
+        LT_UnloadIn(tree, child, base, first, last);
+      } else if (end <= first || base >= last) {
+        LT_UnloadLeaf(tree, node, i);
+      }
+    }
+    base = end;
+  }
+  LT_Recount(tree, node);
+}
+
+// Sets sizes to the sizes of the lines of leaf, which may be a run.
+//  The lines of a run are measured in its text rather than loaded.
+static void LT_LineSizes(LTNode *leaf, int *sizes) {
+  if (!leaf->is_run) {
+    for (int i = 0; i < leaf->num_entries; i++) {
+      sizes[i] = leaf->entries.lines[i].size;
+    }
+    return;
+  }
+  FileLine f_line;
+  const char *pos = leaf->text_start;
+  for (int i = 0; i < leaf->num_entries; i++) {
+    pos = File_MappedLine(pos, leaf->text_end, &f_line);
+    sizes[i] = f_line.size;
+  }
+}
+
+// Sets rows to the number of wrapped rows each line of leaf takes, which
+//  may be a run. The lines of a run are measured in its text rather than
+//  loaded.
+static void LT_LineRowCounts(LineTree *tree, LTNode *leaf, int *rows) {
+  if (!leaf->is_run) {
+    for (int i = 0; i < leaf->num_entries; i++) {
+      rows[i] = LT_LineRows(tree, &(leaf->entries.lines[i]));
+    }
+    return;
+  }
+  FileLine f_line;
+  const char *pos = leaf->text_start;
+  for (int i = 0; i < leaf->num_entries; i++) {
+    pos = File_MappedLine(pos, leaf->text_end, &f_line);
+    rows[i] = LT_LineRows(tree, &f_line);
+  }
+}
+
+// Counts the rows of the lines of leaf, which may be a run, at the wrap
+//  width of tree, if they were counted at another. The lines of a run are
+//  measured in its text rather than loaded.
+static void LT_CountLeafRows(LineTree *tree, LTNode *leaf) {
+  if (leaf->rows_cols == tree->wrap_cols) {
+    return;
+  }
+  if (!leaf->is_run) {
+    LT_Recount(tree, leaf);
+    return;
+  }
+  int rows[LT_LEAF_MAX];
+  LT_LineRowCounts(tree, leaf, rows);
+  leaf->num_rows = 0;
+  for (int i = 0; i < leaf->num_entries; i++) {
+    leaf->num_rows += rows[i];
+  }
+  leaf->rows_cols = tree->wrap_cols;
+}
+
+// Counts the rows of the lines [first, last) of node's subtree, whose
+//  first line has index base, at the wrap width of tree (see
+//  LT_CountRows).
+static void LT_CountRowsIn(LineTree *tree, LTNode *node, int base,
+                           int first, int last) {
+  if (node->rows_cols == tree->wrap_cols) {
+    return;
+  }
+  if (node->is_leaf) {
+    LT_CountLeafRows(tree, node);
+    return;
+  }
+  for (int i = 0; i < node->num_entries && base < last; i++) {
+    LTNode *child = node->entries.children[i];
+    int end = base + child->num_lines;
+    if (end > first) {
+      LT_CountRowsIn(tree, child, base, first, last);
+    }
+    base = end;
+  }
+  LT_Recount(tree, node);
+}
+
+// Counts the rows of the first leaves of node's subtree not yet counted
+//  at the wrap width of tree, until *num_lines lines have been counted.
+static void LT_CountSomeRowsIn(LineTree *tree, LTNode *node,
+                               int *num_lines) {
+  if (node->rows_cols == tree->wrap_cols) {
+    return;
+  }
+  if (node->is_leaf) {
+    LT_CountLeafRows(tree, node);
+    *num_lines -= node->num_entries;
+    return;
+  }
+  for (int i = 0; i < node->num_entries && *num_lines > 0; i++) {
+    LT_CountSomeRowsIn(tree, node->entries.children[i], num_lines);
+  }
+  LT_Recount(tree, node);
+}
+
+// Recounts the loaded leaves below each node on the path of iter, after
+//  it loaded a leaf.
+static void LT_IterRecount(LTIter *iter) {
+  for (int depth = iter->depth - 2; depth >= 0; depth--) {
+    LT_Recount(iter->tree, iter->path[depth]);
+  }
+}
+
+LineTree *LT_New(Arena *arena) {
+  LineTree *tree = Arena_Alloc(arena, sizeof(LineTree));
+  tree->arena = arena;
+  tree->root = LT_NewNode(tree->arena, true);
+  tree->num_lines = 0;
+  tree->wrap_cols = 0;
+  return tree;
+}
+
+FileLine *LT_Get(LineTree *tree, int idx) {
+  if (idx < 0 || idx >= tree->num_lines) {
+    return NULL;
+  }
+  LTNode *path[LT_MAX_HEIGHT];
+  int depth = 0;
+  LTNode *node = LT_Load(tree, NULL, 0);
+  while (!node->is_leaf) {
+    path[depth++] = node;
+    int child_idx = LT_ChildFor(node, &idx);
+    LTNode *child = node->entries.children[child_idx];
+    if (child->is_run) {
+      child = LT_Load(tree, node, child_idx);
+      // one more leaf is loaded below each node on the path.
+      for (int i = 0; i < depth; i++) {
+        path[i]->num_loaded++;
+      }
+    }
+    node = child;
+  }
+  return &(node->entries.lines[idx]);
+}
+
+void LT_Insert(LineTree *tree, int idx, const FileLine *f_line) {
+  LT_InsertLines(tree, idx, f_line, 1);
+}
+
+void LT_InsertLines(LineTree *tree, int idx, const FileLine *lines,
+                    int num) {
+  if (idx < 0 || idx > tree->num_lines || num <= 0) {
+    return;
+  }
+  LTNode **split;
+  int num_split = LT_InsertAt(tree, LT_Load(tree, NULL, 0), idx, lines, num,
+                              &split);
+  while (num_split > 0) {
+    // the root was split, so the tree grows by a level, whose root may
+    //  have to be split in turn.
+    LTNode *root = LT_NewNode(tree->arena, false);
+    root->entries.children[0] = tree->root;
+    root->num_entries = 1;
+    LTNode **above;
+    int num_above = LT_InsertEntries(tree, root, 1, split, num_split,
+                                     &above);
+    free(split);
+    tree->root = root;
+    split = above;
+    num_split = num_above;
+  }
+  tree->num_lines += num;
+}
+
+void LT_Append(LineTree *tree, const FileLine *f_line) {
+  LT_Insert(tree, tree->num_lines, f_line);
+}
+
+void LT_Remove(LineTree *tree, int idx, FileLine *removed) {
+  if (idx < 0 || idx >= tree->num_lines) {
+    return;
+  }
+  FileLine line;
+  LT_RemoveAt(tree, LT_Load(tree, NULL, 0), idx, &line);
+  if (removed != NULL) {
+    *removed = line;
+  }
+  while (!tree->root->is_leaf && tree->root->num_entries == 1) {
+    // the root has a single child, so the tree shrinks by one level.
+    LTNode *old_root = tree->root;
+    tree->root = old_root->entries.children[0];
+    Arena_Free(tree->arena, old_root, sizeof(LTNode));
+  }
+  tree->num_lines--;
+}
+
+void LT_Resized(LineTree *tree, int idx) {
+  if (idx < 0 || idx >= tree->num_lines) {
+    return;
+  }
+  LTNode *path[LT_MAX_HEIGHT];
+  int depth = 0;
+  LTNode *node = tree->root;
+  while (!node->is_leaf) {
+    path[depth++] = node;
+    node = node->entries.children[LT_ChildFor(node, &idx)];
+  }
+  // the line's rows are counted again from its new size.
+  node->entries.lines[idx].num_rows = 0;
+  LT_Recount(tree, node);
+  while (depth > 0) {
+    LT_Recount(tree, path[--depth]);
+  }
+}
+
+long LT_OffsetOf(LineTree *tree, int idx) {
+  if (idx <= 0) {
+    return 0;
+  }
+  if (idx >= tree->num_lines) {
+    return tree->root->num_bytes;
+  }
+  long offset = 0;
+  LTNode *node = tree->root;
+  while (!node->is_leaf) {
+    LTNode **children = node->entries.children;
+    int i = 0;
+    while (idx >= children[i]->num_lines) {
+      idx -= children[i]->num_lines;
+      offset += children[i]->num_bytes;
+      i++;
+    }
+    node = children[i];
+  }
+  int sizes[LT_LEAF_MAX];
+  LT_LineSizes(node, sizes);
+  for (int i = 0; i < idx; i++) {
+    offset += sizes[i] + 1;
+  }
+  return offset;
+}
+
+int LT_LineAt(LineTree *tree, long offset) {
+  if (tree->num_lines == 0 || offset <= 0) {
+    return 0;
+  }
+  if (offset >= tree->root->num_bytes) {
+    return tree->num_lines - 1;
+  }
+  int idx = 0;
+  LTNode *node = tree->root;
+  while (!node->is_leaf) {
+    LTNode **children = node->entries.children;
+    int i = 0;
+    while (offset >= children[i]->num_bytes) {
+      offset -= children[i]->num_bytes;
+      idx += children[i]->num_lines;
+      i++;
+    }
+    node = children[i];
+  }
+  int sizes[LT_LEAF_MAX];
+  LT_LineSizes(node, sizes);
+  for (int i = 0; offset >= sizes[i] + 1; i++) {
+    offset -= sizes[i] + 1;
+    idx++;
+  }
+  return idx;
+}
+
+void LT_SetWrap(LineTree *tree, int num_cols) {
+  if (num_cols < 0) {
+    num_cols = 0;
+  }
+  if (num_cols == tree->wrap_cols) {
+    return;
+  }
+  tree->wrap_cols = num_cols;
+}
+
+void LT_CountRows(LineTree *tree, int first, int last) {
+  if (first < 0) {
+    first = 0;
+  }
+  if (first < last) {
+    LT_CountRowsIn(tree, tree->root, 0, first, last);
+  }
+}
+
+bool LT_CountSomeRows(LineTree *tree, int num_lines) {
+  LT_CountSomeRowsIn(tree, tree->root, &num_lines);
+  return tree->root->rows_cols == tree->wrap_cols;
+}
+
+long LT_RowOf(LineTree *tree, int idx) {
+  if (idx <= 0) {
+    return 0;
+  }
+  if (idx >= tree->num_lines) {
+    return tree->root->num_rows;
+  }
+  LT_CountRows(tree, idx, idx + 1);
+  long row = 0;
+  LTNode *node = tree->root;
+  while (!node->is_leaf) {
+    LTNode **children = node->entries.children;
+    int i = 0;
+    while (idx >= children[i]->num_lines) {
+      idx -= children[i]->num_lines;
+      row += children[i]->num_rows;
+      i++;
+    }
+    node = children[i];
+  }
+  int rows[LT_LEAF_MAX];
+  LT_LineRowCounts(tree, node, rows);
+  for (int i = 0; i < idx; i++) {
+    row += rows[i];
+  }
+  return row;
+}
+
+int LT_LineAtRow(LineTree *tree, long row) {
+  if (row <= 0) {
+    return 0;
+  }
+  int idx;
+  LTNode *node;
+  while (true) {
+    if (row >= tree->root->num_rows) {
+      return tree->num_lines;
+    }
+    idx = 0;
+    long leaf_row = row;
+    node = tree->root;
+    while (!node->is_leaf) {
+      LTNode **children = node->entries.children;
+      int i = 0;
+      while (leaf_row >= children[i]->num_rows) {
+        leaf_row -= children[i]->num_rows;
+        idx += children[i]->num_lines;
+        i++;
+      }
+      node = children[i];
+    }
+    if (node->rows_cols == tree->wrap_cols) {
+      row = leaf_row;
+      break;
+    }
+    // the leaf was counted at another width, so count it and look again,
+    //  as the rows after it moved.
+    LT_CountRows(tree, idx, idx + 1);
+  }
+  int rows[LT_LEAF_MAX];
+  LT_LineRowCounts(tree, node, rows);
+  for (int i = 0; row >= rows[i]; i++) {
+    row -= rows[i];
+    idx++;
+  }
+  return idx;
+}
+
+void LT_Unload(LineTree *tree, int first, int last) {
+  if (!tree->root->is_leaf) {
+    LT_UnloadIn(tree, tree->root, 0, first, last);
+  }
+}
+
+int LT_NumLoaded(LineTree *tree) {
+  return tree->root->num_loaded;
+}
+
+// Calls line_fn on each line of node's subtree, and returns false as
+//  soon as it does. The lines of runs are passed as temporary FileLines.
+static bool LT_WalkNode(LTNode *node, LTLineFn line_fn, LTRunFn run_fn,
+                        void *arg) {
+  if (node->is_run && run_fn != NULL) {
+    return run_fn(node->text_start, node->text_end, node->num_lines, arg);
+  } else if (node->is_run) {
+    FileLine f_line;
+    const char *pos = node->text_start;
+    while (pos < node->text_end) {
+      pos = File_MappedLine(pos, node->text_end, &f_line);
+      if (!line_fn(&f_line, arg)) {
+        return false;
+      }
+    }
+  } else if (node->is_leaf) {
+    for (int i = 0; i < node->num_entries; i++) {
+      if (!line_fn(&(node->entries.lines[i]), arg)) {
+        return false;
+      }
+    }
+  } else {
+    for (int i = 0; i < node->num_entries; i++) {
+      if (!LT_WalkNode(node->entries.children[i], line_fn, run_fn, arg)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool LT_Walk(LineTree *tree, LTLineFn line_fn, void *arg) {
+  return LT_WalkNode(tree->root, line_fn, NULL, arg);
+}
+
+bool LT_WalkRuns(LineTree *tree, LTLineFn line_fn, LTRunFn run_fn,
+                 void *arg) {
+  return LT_WalkNode(tree->root, line_fn, run_fn, arg);
+}
+
+void LT_IterInit(LineTree *tree, LTIter *iter, int idx) {
+  iter->depth = 0;
+  if (idx < 0 || idx >= tree->num_lines) {
+    // nothing to iterate over.
+    return;
+  }
+  iter->tree = tree;
+  LTNode *node = LT_Load(tree, NULL, 0);
+  while (!node->is_leaf) {
+    int child_idx = LT_ChildFor(node, &idx);
+    iter->path[iter->depth] = node;
+    iter->pos[iter->depth] = child_idx;
+    iter->depth++;
+    node = LT_Load(tree, node, child_idx);
+  }
+  iter->path[iter->depth] = node;
+  iter->pos[iter->depth] = idx;
+  iter->depth++;
+  LT_IterRecount(iter);
+}
+
+FileLine *LT_IterNext(LTIter *iter) {
+  if (iter->depth == 0) {
+    return NULL;
+  }
+  int leaf_depth = iter->depth - 1;
+  LTNode *leaf = iter->path[leaf_depth];
+  FileLine *f_line = &(leaf->entries.lines[iter->pos[leaf_depth]++]);
+  if (iter->pos[leaf_depth] < leaf->num_entries) {
+    return f_line;
+  }
+
+  // the leaf is exhausted, so climb to the nearest ancestor with a
+  //  next child and descend to that child's first leaf, loading the
+  //  runs on the way.
+  int depth = leaf_depth - 1;
+  while (depth >= 0 &&
+         iter->pos[depth] + 1 >= iter->path[depth]->num_entries) {
+    depth--;
+  }
+  if (depth < 0) {
+    // that was the last line.
+    iter->depth = 0;
+    return f_line;
+  }
+  iter->pos[depth]++;
+  for (; depth < leaf_depth; depth++) {
+    iter->path[depth + 1] = LT_Load(iter->tree, iter->path[depth],
+                                    iter->pos[depth]);
+    iter->pos[depth + 1] = 0;
+  }
+  LT_IterRecount(iter);
+  return f_line;
+}
+
+void LT_BuilderInit(LTBuilder *builder, Arena *arena) {
+  builder->arena = arena;
+  builder->leaves = NULL;
+  builder->num_leaves = 0;
+  builder->capacity = 0;
+}
+
+// Adds leaf after the last leaf of builder.
+static void LT_BuilderPush(LTBuilder *builder, LTNode *leaf) {
+  if (builder->num_leaves == builder->capacity) {
+    int capacity = (builder->capacity == 0) ? 64 : builder->capacity * 2;
+    LTNode **leaves = realloc(builder->leaves, capacity * sizeof(LTNode *));
+    if (leaves == NULL) {
+      quit("LT_BuilderPush");
+    }
+    builder->leaves = leaves;
+    builder->capacity = capacity;
+  }
+  builder->leaves[builder->num_leaves++] = leaf;
+}
+
+void LT_BuilderAppend(LTBuilder *builder, const FileLine *f_line) {
+  LTNode *leaf = (builder->num_leaves == 0) ? NULL :
+                 builder->leaves[builder->num_leaves - 1];
+  if (leaf == NULL || leaf->is_run || leaf->num_entries == LT_LEAF_MAX) {
+    // the last leaf is full, so start a new one.
+    leaf = LT_NewNode(builder->arena, true);
+    LT_BuilderPush(builder, leaf);
+  }
+  leaf->entries.lines[leaf->num_entries++] = *f_line;
+  leaf->num_lines++;
+  leaf->num_bytes += f_line->size + 1;
+  // the tree is built unwrapped, with a row per line.
+  leaf->num_rows++;
+}
+
+void LT_BuilderAppendRun(LTBuilder *builder, const char *start,
+                         const char *end, int num_lines, long num_bytes) {
+  LT_BuilderPush(builder, LT_NewRun(builder->arena, start, end, num_lines,
+                                    num_bytes, num_lines));
+}
+
+LineTree *LT_BuilderFinish(LTBuilder *builders, int num_builders,
+                           Arena *arena) {
+  // gather the leaves of all builders in order.
+  int count = 0;
+  for (int i = 0; i < num_builders; i++) {
+    count += builders[i].num_leaves;
+  }
+  LTNode **level = malloc((count > 0 ? count : 1) * sizeof(LTNode *));
+  if (level == NULL) {
+    quit("LT_BuilderFinish");
+  }
+  LineTree *tree = Arena_Alloc(arena, sizeof(LineTree));
+  tree->arena = arena;
+  tree->num_lines = 0;
+  tree->wrap_cols = 0;
+  count = 0;
+  for (int i = 0; i < num_builders; i++) {
+    for (int j = 0; j < builders[i].num_leaves; j++) {
+      tree->num_lines += builders[i].leaves[j]->num_lines;
+      level[count++] = builders[i].leaves[j];
+    }
+    free(builders[i].leaves);
+    LT_BuilderInit(&(builders[i]), builders[i].arena);
+  }
+
+  // build the tree bottom up, one level of inner nodes at a time.
+  while (count > 1) {
+    int num_parents = (count + LT_NODE_MAX - 1) / LT_NODE_MAX;
+    int child = 0;
+    for (int i = 0; i < num_parents; i++) {
+      // spread the children evenly, so no parent is left with just one.
+      int num_children = count / num_parents + (i < count % num_parents);
+      LTNode *parent = LT_NewNode(arena, false);
+      memcpy(parent->entries.children, &(level[child]),
+             num_children * sizeof(LTNode *));
+      parent->num_entries = num_children;
+      LT_Recount(tree, parent);
+      // parents are stored over children that were already used.
+      level[i] = parent;
+      child += num_children;
+    }
+    count = num_parents;
+  }
+  tree->root = (count == 0) ? LT_NewNode(arena, true) : level[0];
+  free(level);
+  return tree;
+}
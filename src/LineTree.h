@@ -0,0 +1,224 @@
+#ifndef LINE_TREE_H_
+#define LINE_TREE_H_
+
+// A balanced tree of line chunks (a B+ tree indexed by line number).
+//  Leaves hold up to LT_LEAF_MAX FileLines in file order, and every
+//  node records how many lines its subtree holds, so finding, inserting
+//  and removing the line at a given index all cost O(log n). Nodes also
+//  record how many bytes their lines take in the saved file, so the
+//  tree doubles as an index of line offsets, and how many screen rows
+//  their lines take when soft-wrapped, so it is an index of wrapped rows
+//  as well. Each line caches its own row count until it is edited, so an
+//  edit only recounts the nodes above the lines it touched. When the wrap
+//  width changes, the rows are only counted again as lines are reached
+//  (see LT_CountRows): until then, a node keeps the rows counted at the
+//  old width, which still add up, so rows stay a consistent index.
+//
+// A leaf may also be left unloaded as a run: just the range of mapped
+//  text its lines come from. Runs are loaded into leaves when their
+//  lines are first reached, and clean leaves far from the lines in use
+//  can be turned back into runs by LT_Unload, so only the index of a
+//  huge file has to stay in memory.
+
+#include <stdbool.h>
+
+#include "Arena.h"
+#include "FileParser.h"  // for FileLine
+
+// the maximum number of FileLines in a leaf.
+#define LT_LEAF_MAX 64
+// the maximum number of children of an inner node.
+#define LT_NODE_MAX 32
+// the maximum height of a tree. enough for far more than INT_MAX lines.
+#define LT_MAX_HEIGHT 16
+
+typedef struct LTNode LTNode;
+
+struct LTNode {
+  // true if this node holds lines; false if it holds child nodes.
+  bool is_leaf;
+  // true if this leaf is a run, whose lines are not loaded yet. a run is
+  //  allocated without its entries.
+  bool is_run;
+  // the number of lines or children held directly by this node. for a
+  //  run, the number of lines in its text.
+  int num_entries;
+  // the total number of lines in this node's subtree.
+  int num_lines;
+  // the number of loaded leaves in this node's subtree.
+  int num_loaded;
+  // the number of bytes the lines of this node's subtree take when
+  //  saved, counting a newline after each line.
+  long num_bytes;
+  // the number of screen rows the lines of this node's subtree take when
+  //  wrapped at rows_cols columns; one per line if it is 0.
+  long num_rows;
+  // the wrap width num_rows was counted at. for an inner node, the tree's
+  //  wrap_cols if all of its children were counted at it, or -1.
+  int rows_cols;
+  // the mapped text of a run, [text_start, text_end). a leaf loaded from
+  //  a run keeps it until its lines are inserted or removed, and text_start
+  //  is NULL otherwise.
+  const char *text_start;
+  const char *text_end;
+  union {
+    // the child nodes of an inner node, in file order.
+    LTNode *children[LT_NODE_MAX];
+    // the lines of a leaf, in file order.
+    FileLine lines[LT_LEAF_MAX];
+  } entries;
+};
+
+struct LineTree {
+  // the root of the tree. never NULL; an empty tree has an empty leaf.
+  LTNode *root;
+  // the number of lines in the tree.
+  int num_lines;
+  // the number of columns lines are wrapped at when counting their rows,
+  //  or 0 if they are not wrapped.
+  int wrap_cols;
+  // the arena the tree and its nodes are allocated from.
+  Arena *arena;
+};
+
+typedef struct LineTree LineTree;
+
+// a function called on each line by LT_Walk. returns false to stop.
+typedef bool (*LTLineFn)(FileLine *f_line, void *arg);
+// a function called on the mapped text [start, end) of each run, which
+//  holds num_lines lines, by LT_WalkRuns. returns false to stop.
+typedef bool (*LTRunFn)(const char *start, const char *end, int num_lines,
+                        void *arg);
+
+// collects lines appended in file order into full leaves, so a tree can
+//  be built from them all at once by LT_BuilderFinish. several builders,
+//  each over its own arena, can fill in parts of a file in parallel.
+typedef struct {
+  // the arena the leaves are allocated from.
+  Arena *arena;
+  // the leaves filled so far, in order. all but the last are full.
+  LTNode **leaves;
+  int num_leaves;
+  // the number of leaf pointers allocated in leaves.
+  int capacity;
+} LTBuilder;
+
+// an in-order cursor over the lines of a tree. only valid until the
+//  next insertion or removal.
+typedef struct {
+  // the tree iterated over, whose runs are loaded as they are reached.
+  LineTree *tree;
+  // the nodes on the path from the root to the current leaf.
+  LTNode *path[LT_MAX_HEIGHT];
+  // the index of the entry taken in each node along the path.
+  int pos[LT_MAX_HEIGHT];
+  // the number of nodes in the path.
+  int depth;
+} LTIter;
+
+// Returns a new, empty tree allocated from arena. The tree and its nodes
+//  are freed along with the arena; see File_FreeLines.
+LineTree *LT_New(Arena *arena);
+
+// Returns a pointer to the line at index idx, or NULL if idx is out
+//  of range. The pointer is valid until the next insertion or removal.
+FileLine *LT_Get(LineTree *tree, int idx);
+
+// Inserts a copy of f_line so that it becomes the line at index idx.
+void LT_Insert(LineTree *tree, int idx, const FileLine *f_line);
+
+// Inserts copies of the num lines of lines so that the first becomes the
+//  line at index idx. The lines are spliced in at once, filling new
+//  leaves as needed, rather than shifting the lines after them num times.
+void LT_InsertLines(LineTree *tree, int idx, const FileLine *lines,
+                    int num);
+
+// Appends a copy of f_line after the last line of the tree. Cheaper
+//  than LT_Insert when building a tree in file order.
+void LT_Append(LineTree *tree, const FileLine *f_line);
+
+// Removes the line at index idx, copying it to removed if not NULL.
+void LT_Remove(LineTree *tree, int idx, FileLine *removed);
+
+// Updates the byte counts of the nodes above the line at index idx after
+//  its size changed.
+void LT_Resized(LineTree *tree, int idx);
+
+// Returns the byte offset in the saved file of the line at index idx,
+//  or the size of the whole file if idx is num_lines.
+long LT_OffsetOf(LineTree *tree, int idx);
+
+// Returns the index of the line holding the byte at offset in the saved
+//  file (its newline included). Offsets past the end give the last line.
+int LT_LineAt(LineTree *tree, long offset);
+
+// Wraps the lines of tree at num_cols columns, or gives them a row per
+//  line if num_cols is 0. Costs O(1): the rows of the lines are counted
+//  again once they are reached (see LT_CountRows).
+void LT_SetWrap(LineTree *tree, int num_cols);
+
+// Counts the rows of the lines [first, last) at the wrap width, if they
+//  were counted at another, along with the leaves holding them. The rows
+//  of the lines after them move by as many rows as those lines gained.
+void LT_CountRows(LineTree *tree, int first, int last);
+
+// Counts the rows of the first leaves not yet counted at the wrap width,
+//  about num_lines lines in all, so the whole tree can be counted a bit
+//  at a time. Returns true once all of its rows are counted.
+bool LT_CountSomeRows(LineTree *tree, int num_lines);
+
+// Returns the first wrapped row of the line at index idx, or the number
+//  of rows of the whole tree if idx is num_lines. Counts the rows of the
+//  leaf holding the line first (see LT_CountRows).
+long LT_RowOf(LineTree *tree, int idx);
+
+// Returns the index of the line shown on wrapped row row, or num_lines
+//  if row is past the rows of the last line. Counts the rows of the leaf
+//  it finds the row in first (see LT_CountRows).
+int LT_LineAtRow(LineTree *tree, long row);
+
+// Turns the clean leaves that lie entirely outside of the lines
+//  [first, last) back into runs, freeing their display buffers. Leaves
+//  with owned (edited) lines are kept. Pointers to lines are invalid
+//  afterwards.
+void LT_Unload(LineTree *tree, int first, int last);
+
+// Returns the number of leaves of tree that are loaded.
+int LT_NumLoaded(LineTree *tree);
+
+// Calls line_fn with arg on each line of tree in order, until it
+//  returns false. Returns false if it was stopped. Lines of runs are
+//  passed as temporary FileLines without loading the runs.
+bool LT_Walk(LineTree *tree, LTLineFn line_fn, void *arg);
+
+// Like LT_Walk, but calls run_fn with arg on the text of each run as a
+//  whole instead of splitting it into lines.
+bool LT_WalkRuns(LineTree *tree, LTLineFn line_fn, LTRunFn run_fn,
+                 void *arg);
+
+// Initializes builder to allocate leaves from arena.
+void LT_BuilderInit(LTBuilder *builder, Arena *arena);
+
+// Appends a copy of f_line after the last line given to builder.
+void LT_BuilderAppend(LTBuilder *builder, const FileLine *f_line);
+
+// Appends a run of the num_lines lines in the mapped text [start, end),
+//  which take num_bytes bytes when saved, after the last line given to
+//  builder.
+void LT_BuilderAppendRun(LTBuilder *builder, const char *start,
+                         const char *end, int num_lines, long num_bytes);
+
+// Returns a new tree allocated from arena holding the lines of the
+//  num_builders builders in order, and resets the builders. The leaves
+//  of builders with other arenas stay in those arenas, which must live
+//  as long as the tree (see Arena_Merge).
+LineTree *LT_BuilderFinish(LTBuilder *builders, int num_builders,
+                           Arena *arena);
+
+// Positions iter on the line at index idx.
+void LT_IterInit(LineTree *tree, LTIter *iter, int idx);
+
+// Returns the line under iter and advances it, or NULL past the end.
+FileLine *LT_IterNext(LTIter *iter);
+
+#endif  // LINE_TREE_H_
@@ -0,0 +1,120 @@
+#include <stdbool.h>
+#include <stddef.h>  // for NULL
+
+#include "OutputPacer.h"
+#include "ESCCommands.h"
+#include "EventLoop.h"
+#include "Keyboard.h"
+#include "TerminalUtils.h"
+
+// the most bytes of frames the terminal may not have shown yet before
+//  new frames are held off. a frame of any size is written when nothing
+//  is on the wire.
+#define PACER_BUDGET 4096
+// how long the terminal may take to show a frame, in milliseconds,
+//  before it counts as lagging.
+#define PACER_LAG_MS 50
+// how long to wait for the answer to a status request, in milliseconds.
+//  a terminal that doesn't answer in time is taken to have shown the
+//  frames.
+#define PACER_ANSWER_TIMEOUT_MS 5000
+// the most frames kept track of on the wire.
+#define PACER_MAX_FRAMES 32
+
+// a frame written that the terminal has not shown yet.
+typedef struct {
+  // when the frame was written, by the clock of the event loop.
+  long long time_ms;
+  // the number of bytes written.
+  long size;
+} SentFrame;
+
+// the frames on the wire, oldest first, in a ring starting at
+//  first_frame.
+static SentFrame frames[PACER_MAX_FRAMES];
+static int first_frame = 0;
+static int num_frames = 0;
+// the total size of the frames on the wire.
+static long bytes_on_wire = 0;
+// true if the terminal answers status requests, so frames are paced.
+static bool sends_requests = false;
+
+// Takes the oldest frame off the wire.
+static void Pacer_PopFrame(void) {
+  bytes_on_wire -= frames[first_frame].size;
+  first_frame = (first_frame + 1) % PACER_MAX_FRAMES;
+  num_frames--;
+}
+
+// Takes the oldest frame off the wire when the terminal answers the
+//  status request that followed it. Called by the keyboard.
+static void Pacer_OnAnswer(void *arg) {
+  (void) arg;
+  if (num_frames > 0) {
+    Pacer_PopFrame();
+  }
+}
+
+// Forgets the frames on the wire if the oldest has gone unanswered for
+//  too long.
+static void Pacer_CheckTimeout(void) {
+  if (num_frames == 0 ||
+      Loop_Now() - frames[first_frame].time_ms < PACER_ANSWER_TIMEOUT_MS) {
+    return;
+  }
+  while (num_frames > 0) {
+    Pacer_PopFrame();
+  }
+}
+
+void Pacer_Init(void) {
+  sends_requests = Term_AnswersStatus();
+  Keyboard_OnStatusReport(Pacer_OnAnswer, NULL);
+}
+
+bool Pacer_CanWrite(void) {
+  if (Term_OutputBlocked()) {
+    return false;
+  }
+  Pacer_CheckTimeout();
+  return bytes_on_wire < PACER_BUDGET;
+}
+
+bool Pacer_IsLagging(void) {
+  Pacer_CheckTimeout();
+  return num_frames > 0 &&
+         Loop_Now() - frames[first_frame].time_ms > PACER_LAG_MS;
+}
+
+void Pacer_WriteFrame(Buffer *wbuf) {
+  if (wbuf->size == 0) {
+    return;
+  }
+  if (sends_requests && num_frames < PACER_MAX_FRAMES) {
+    WB_AppendESCCmd(wbuf, ESC_CMD_STATUS_REPORT);
+    int last = (first_frame + num_frames) % PACER_MAX_FRAMES;
+    frames[last] = (SentFrame) {Loop_Now(), wbuf->size};
+    num_frames++;
+    bytes_on_wire += wbuf->size;
+  } else if (sends_requests) {
+    // past the most frames kept track of, the frame is counted with the
+    //  last one, and shown when it is.
+    int last = (first_frame + num_frames - 1) % PACER_MAX_FRAMES;
+    frames[last].size += wbuf->size;
+    bytes_on_wire += wbuf->size;
+  }
+  WB_Write(wbuf);
+}
+
+void Pacer_Drain(long timeout_ms) {
+  long long deadline = Loop_Now() + timeout_ms;
+  while (num_frames > 0) {
+    long long left = deadline - Loop_Now();
+    if (left <= 0) {
+      break;
+    }
+    Loop_RunOnce(left);
+    // the answers are taken out of the input as keys are looked for.
+    Keyboard_KeyPending();
+  }
+}
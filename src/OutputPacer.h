@@ -0,0 +1,44 @@
+#ifndef OUTPUT_PACER_H_
+#define OUTPUT_PACER_H_
+
+// Keeps the output of frames from piling up between the editor and the
+//  terminal, e.g., over a slow ssh link, where the bytes queue up in the
+//  link rather than in the terminal's own queue. Each frame is followed
+//  by a device status request, which the terminal answers only once it
+//  has shown everything before it. Until those answers come back, the
+//  bytes of a frame are counted as on the wire, and once they exceed a
+//  budget the editor holds off on new frames, drawing one frame with
+//  all that changed meanwhile when the terminal catches up. Keys are
+//  read and applied all the while, so typing stays responsive.
+
+#include <stdbool.h>
+
+#include "WriteBuffer.h"
+
+// Asks the terminal whether it answers status requests, and if so, has
+//  the answers taken by the keyboard (see Keyboard_OnStatusReport).
+//  Frames are not paced for a terminal that doesn't answer. Must be
+//  called in raw mode, before the first frame is written or any input
+//  is read.
+void Pacer_Init(void);
+
+// Returns true if a frame can be written without adding to a backlog:
+//  the terminal is taking in output, and the frames it has not shown
+//  yet are within the budget.
+bool Pacer_CanWrite(void);
+
+// Returns true if the terminal is lagging: the oldest frame it has not
+//  shown yet was written a while ago. Parts of frames that can wait
+//  (e.g., the status bar) are then put off.
+bool Pacer_IsLagging(void);
+
+// Appends a status request to the frame in wbuf, unless it is empty,
+//  then writes it to stdout and counts it as on the wire.
+void Pacer_WriteFrame(Buffer *wbuf);
+
+// Waits up to timeout_ms milliseconds for the terminal to answer the
+//  status requests sent, so no answer comes in after the editor has
+//  exited (and is shown by the shell).
+void Pacer_Drain(long timeout_ms);
+
+#endif  // OUTPUT_PACER_H_
@@ -0,0 +1,1195 @@
+#include <ctype.h>  // for isalnum, isdigit, isupper, tolower
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Regex.h"
+#include "Quit.h"
+
+// the most NFA states a pattern may compile to. each byte a DFA reads
+//  for the first time from a state costs up to this much.
+#define RE_MAX_INSTS 10000
+// how many bytes the forward reads from the starts of matches in a line
+//  may take per byte of it, and how many more, before the ends of the
+//  rest of its matches are found with the NFA (see RE_FindEnds).
+#define RE_READS_PER_BYTE 2
+#define RE_READS_MIN 256
+// the number of DFA states first allocated for.
+#define RE_MIN_STATES 16
+
+// where the input is, for the NFA states past which RE_OP_BOL and
+//  RE_OP_EOL go on.
+#define RE_AT_BOL 1
+#define RE_AT_EOL 2
+
+// the transitions of a DFA not built yet, and to the state with no NFA
+//  states left, which can't match.
+#define RE_UNKNOWN -1
+#define RE_DEAD -2
+
+// the kinds of nodes of the tree a pattern is parsed into.
+typedef enum {
+  // matches the empty string, e.g., "()".
+  RE_NODE_EMPTY,
+  // matches one byte of a set.
+  RE_NODE_SET,
+  // match the start and end of the line.
+  RE_NODE_BOL,
+  RE_NODE_EOL,
+  // matches left followed by right.
+  RE_NODE_CAT,
+  // matches left or right.
+  RE_NODE_ALT,
+  // matches min to max copies of left.
+  RE_NODE_REPEAT
+} RENodeType;
+
+// a node of the tree a pattern is parsed into.
+typedef struct {
+  RENodeType type;
+  // the operands, as indices of nodes, in the order they are written.
+  int left;
+  int right;
+  // the least and most copies of a repeat. max is -1 if unbounded.
+  int min;
+  int max;
+  // the index of the set of bytes of a RE_NODE_SET.
+  int set;
+} RENode;
+
+// a set of bytes, one bit per byte.
+typedef struct {
+  uint64_t bits[4];
+} REByteSet;
+
+// the kinds of NFA states.
+typedef enum {
+  // reads a byte of the set at index arg, and goes on to out.
+  RE_OP_SET,
+  // goes on to both out and arg without reading.
+  RE_OP_SPLIT,
+  // go on to out at the start or the end of the input.
+  RE_OP_BOL,
+  RE_OP_EOL,
+  // the input read so far matches.
+  RE_OP_MATCH
+} REOp;
+
+// an NFA state, as an instruction of a program.
+typedef struct {
+  REOp op;
+  int out;
+  int arg;
+} REInst;
+
+// an NFA, whose states are instructions. the first is the RE_OP_MATCH.
+typedef struct {
+  REInst *insts;
+  int size;
+  int start;
+} REProgram;
+
+struct Regex {
+  // the sets of bytes read by the RE_OP_SET instructions.
+  REByteSet *sets;
+  int num_sets;
+  // the NFA of the pattern, and of the pattern reversed, which reads its
+  //  matches backward, with the start and end of the input swapped.
+  REProgram forward;
+  REProgram reverse;
+  // the bytes split into the classes that no set tells apart, so a DFA
+  //  only keeps one transition per class. the class of each byte, and
+  //  one byte of each class.
+  unsigned char byte_class[256];
+  unsigned char class_byte[256];
+  int num_classes;
+  // see RE_Literal.
+  char *literal;
+  int literal_size;
+};
+
+// the state of parsing a pattern.
+typedef struct {
+  // the next character of the pattern.
+  const char *pos;
+  // why the pattern is invalid, once it's found to be.
+  const char *error;
+  RENode *nodes;
+  int num_nodes;
+  int nodes_capacity;
+  REByteSet *sets;
+  int num_sets;
+  int sets_capacity;
+} REParser;
+
+// a set of NFA states, in the order added, each with a tag. a sparse
+//  set, so it's emptied in O(1).
+typedef struct {
+  int *dense;
+  int *tags;
+  int *sparse;
+  int size;
+} REStateList;
+
+// a state of a DFA: the NFA states the input read so far can be in.
+typedef struct {
+  // the NFA states that read a byte, match or wait for the end of the
+  //  input, as [first, first + size) of the DFA's insts, in order.
+  int first;
+  int size;
+  unsigned hash;
+  // true if the input read so far matches, and if it does should the
+  //  input end here.
+  bool is_match;
+  bool is_match_at_end;
+} REState;
+
+// a DFA over a program, built as the input reaches its states.
+typedef struct {
+  const REProgram *prog;
+  // true if a match may start anywhere, rather than only where the input
+  //  starts to be read.
+  bool is_unanchored;
+  REState *states;
+  int num_states;
+  int states_capacity;
+  // the state reached from state s by a byte of class c is at index
+  //  s * num_classes + c, or RE_UNKNOWN or RE_DEAD. the cache bounds the
+  //  number of states, so the index fits in an int.
+  int *next;
+  // the NFA states of the states.
+  int *insts;
+  int num_insts;
+  int insts_capacity;
+  // the states by their NFA states, as an open-addressed hash table of
+  //  state indices, with -1 in the empty slots. table_size is a power
+  //  of 2.
+  int *table;
+  int table_size;
+  // the memory the states take, counted against RE_CACHE_MAX.
+  long cache_size;
+  // the number of times the states were dropped to make room.
+  long num_flushes;
+  // the start state when not at, and at, the start of the input, or
+  //  RE_UNKNOWN.
+  int start[2];
+} REDfa;
+
+struct REMatcher {
+  const Regex *re;
+  // reads the line forward from where a match starts, and backward for
+  //  where matches start.
+  REDfa forward;
+  REDfa backward;
+  // the NFA states being gathered into a DFA state, the NFA states of
+  //  the reversed NFA run over a line and those reached from them (see
+  //  RE_FindEnds), the stack of NFA states left to walk, and a key of
+  //  NFA states looked up in a DFA.
+  REStateList work;
+  REStateList lists[2];
+  int *stack;
+  int *key;
+  // the line set, and where the next match is looked for from.
+  const char *line;
+  int size;
+  int pos;
+  // 1 at the indices of the line matches start at, else 0.
+  char *starts;
+  int starts_capacity;
+  // if has_ends, the end of the longest match starting at each index of
+  //  the line from pos on, or -1.
+  int *ends;
+  int ends_capacity;
+  bool has_ends;
+  // how many bytes the forward reads may take before has_ends is set.
+  long reads_left;
+};
+
+// --- PARSING --- //
+
+static void RE_SetAdd(REByteSet *set, int lo, int hi) {
+  for (int c = lo; c <= hi; c++) {
+    set->bits[c >> 6] |= (uint64_t) 1 << (c & 63);
+  }
+}
+
+static bool RE_SetHas(const REByteSet *set, int c) {
+  return (set->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+// Returns the only byte in set, or -1 if it holds none or more than one.
+static int RE_SetSingle(const REByteSet *set) {
+  int num = 0;
+  int byte = -1;
+  for (int i = 0; i < 4; i++) {
+    num += __builtin_popcountll(set->bits[i]);
+    if (set->bits[i] != 0) {
+      byte = i * 64 + __builtin_ctzll(set->bits[i]);
+    }
+  }
+  return (num == 1) ? byte : -1;
+}
+
+// Adds the bytes the escape "\c" stands for to set and returns true, if
+//  c is one of the classes d, w and s, or D, W and S for the bytes not in
+//  them.
+static bool RE_AddClass(REByteSet *set, char c) {
+  REByteSet class = {{0}};
+  switch (tolower((unsigned char) c)) {
+    case 'd':
+      RE_SetAdd(&class, '0', '9');
+      break;
+    case 'w':
+      RE_SetAdd(&class, '0', '9');
+      RE_SetAdd(&class, 'A', 'Z');
+      RE_SetAdd(&class, 'a', 'z');
+      RE_SetAdd(&class, '_', '_');
+      break;
+    case 's':
+      RE_SetAdd(&class, ' ', ' ');
+      RE_SetAdd(&class, '\t', '\r');
+      break;
+    default:
+      return false;
+  }
+  for (int i = 0; i < 4; i++) {
+    set->bits[i] |= isupper((unsigned char) c) ? ~class.bits[i]
+                                                : class.bits[i];
+  }
+  return true;
+}
+
+// Returns the byte the escape "\c" stands for, or -1 if it stands for a
+//  class, or nothing.
+static int RE_EscapedByte(char c) {
+  switch (c) {
+    case 't':
+      return '\t';
+    case 'r':
+      return '\r';
+    case 'f':
+      return '\f';
+    case 'v':
+      return '\v';
+  }
+  return (c == '\0' || isalnum((unsigned char) c)) ? -1 : (unsigned char) c;
+}
+
+// Adds a node to the tree and returns its index. Calls quit on
+//  allocation failure.
+static int RE_AddNode(REParser *parser, RENodeType type, int left,
+                      int right) {
+  if (parser->num_nodes == parser->nodes_capacity) {
+    parser->nodes_capacity = (parser->nodes_capacity == 0) ?
+        RE_MIN_STATES : parser->nodes_capacity * 2;
+    RENode *grown = realloc(parser->nodes,
+                            parser->nodes_capacity * sizeof(*grown));
+    if (grown == NULL) {
+      quit("RE_AddNode");
+    }
+    parser->nodes = grown;
+  }
+  parser->nodes[parser->num_nodes] = (RENode) {type, left, right, 0, 0, 0};
+  return parser->num_nodes++;
+}
+
+// Adds a node matching a byte of set and returns its index. Calls quit
+//  on allocation failure.
+static int RE_AddSetNode(REParser *parser, const REByteSet *set) {
+  if (parser->num_sets == parser->sets_capacity) {
+    parser->sets_capacity = (parser->sets_capacity == 0) ?
+        RE_MIN_STATES : parser->sets_capacity * 2;
+    REByteSet *grown = realloc(parser->sets,
+                               parser->sets_capacity * sizeof(*grown));
+    if (grown == NULL) {
+      quit("RE_AddSetNode");
+    }
+    parser->sets = grown;
+  }
+  parser->sets[parser->num_sets] = *set;
+  int node = RE_AddNode(parser, RE_NODE_SET, -1, -1);
+  parser->nodes[node].set = parser->num_sets++;
+  return node;
+}
+
+// Returns -1 after noting why the pattern is invalid.
+static int RE_Fail(REParser *parser, const char *error) {
+  parser->error = error;
+  return -1;
+}
+
+// Parses the set of bytes of a bracket expression, after its '['.
+//  Returns the index of its node, or -1 if it's invalid.
+static int RE_ParseSet(REParser *parser) {
+  REByteSet set = {{0}};
+  bool is_negated = (*(parser->pos) == '^');
+  if (is_negated) {
+    parser->pos++;
+  }
+  // a ']' first is a byte of the set rather than its end.
+  bool is_first = true;
+  while (*(parser->pos) != ']' || is_first) {
+    is_first = false;
+    int lo = (unsigned char) *(parser->pos)++;
+    if (lo == '\0') {
+      return RE_Fail(parser, "unmatched [");
+    }
+    if (lo == '\\') {
+      char c = *(parser->pos)++;
+      if (RE_AddClass(&set, c)) {
+        continue;
+      }
+      lo = RE_EscapedByte(c);
+      if (lo == -1) {
+        return RE_Fail(parser, "bad escape");
+      }
+    }
+    int hi = lo;
+    if (parser->pos[0] == '-' && parser->pos[1] != ']' &&
+        parser->pos[1] != '\0') {
+      // a range, unless the '-' is last.
+      parser->pos++;
+      hi = (unsigned char) *(parser->pos)++;
+      if (hi == '\\') {
+        hi = RE_EscapedByte(*(parser->pos)++);
+        if (hi == -1) {
+          return RE_Fail(parser, "bad escape");
+        }
+      }
+      if (hi < lo) {
+        return RE_Fail(parser, "bad range");
+      }
+    }
+    RE_SetAdd(&set, lo, hi);
+  }
+  parser->pos++;
+  if (is_negated) {
+    for (int i = 0; i < 4; i++) {
+      set.bits[i] = ~set.bits[i];
+    }
+  }
+  return RE_AddSetNode(parser, &set);
+}
+
+static int RE_ParseAlt(REParser *parser);
+
+// Parses a single byte, set, anchor or group. Returns the index of its
+//  node, or -1 if it's invalid.
+static int RE_ParseAtom(REParser *parser) {
+  REByteSet set = {{0}};
+  char c = *(parser->pos)++;
+  switch (c) {
+    case '(': {
+      int node = RE_ParseAlt(parser);
+      if (node == -1) {
+        return -1;
+      }
+      if (*(parser->pos) != ')') {
+        return RE_Fail(parser, "unmatched (");
+      }
+      parser->pos++;
+      return node;
+    }
+    case '[':
+      return RE_ParseSet(parser);
+    case '.':
+      RE_SetAdd(&set, 0, 255);
+      return RE_AddSetNode(parser, &set);
+    case '^':
+      return RE_AddNode(parser, RE_NODE_BOL, -1, -1);
+    case '$':
+      return RE_AddNode(parser, RE_NODE_EOL, -1, -1);
+    case '*':
+    case '+':
+    case '?':
+      return RE_Fail(parser, "nothing to repeat");
+    case '{':
+      // only a repeat if followed by its count.
+      if (isdigit((unsigned char) *(parser->pos))) {
+        return RE_Fail(parser, "nothing to repeat");
+      }
+      break;
+    case '\\':
+      c = *(parser->pos)++;
+      if (c == '\0') {
+        return RE_Fail(parser, "trailing \\");
+      }
+      if (RE_AddClass(&set, c)) {
+        return RE_AddSetNode(parser, &set);
+      }
+      if (RE_EscapedByte(c) == -1) {
+        return RE_Fail(parser, "bad escape");
+      }
+      c = RE_EscapedByte(c);
+      break;
+  }
+  RE_SetAdd(&set, (unsigned char) c, (unsigned char) c);
+  return RE_AddSetNode(parser, &set);
+}
+
+// Parses the count of a repeat. Returns it, or -1 if it's too large.
+static int RE_ParseCount(REParser *parser) {
+  int count = 0;
+  while (isdigit((unsigned char) *(parser->pos))) {
+    count = count * 10 + (*(parser->pos)++ - '0');
+    if (count > RE_MAX_REPEAT) {
+      return RE_Fail(parser, "repeat too large");
+    }
+  }
+  return count;
+}
+
+// Parses an atom and the repeats that follow it. Returns the index of
+//  its node, or -1 if it's invalid.
+static int RE_ParseRepeat(REParser *parser) {
+  int node = RE_ParseAtom(parser);
+  while (node != -1) {
+    int min = 0;
+    int max = -1;
+    char c = *(parser->pos);
+    if (c == '+') {
+      min = 1;
+    } else if (c == '?') {
+      max = 1;
+    } else if (c == '{' && isdigit((unsigned char) parser->pos[1])) {
+      parser->pos++;
+      min = RE_ParseCount(parser);
+      max = min;
+      if (min != -1 && *(parser->pos) == ',') {
+        parser->pos++;
+        max = (*(parser->pos) == '}') ? -1 : RE_ParseCount(parser);
+      }
+      if (parser->error != NULL) {
+        return -1;
+      }
+      if (*(parser->pos) != '}' || (max != -1 && max < min)) {
+        return RE_Fail(parser, "bad repeat");
+      }
+    } else if (c != '*') {
+      break;
+    }
+    parser->pos++;
+    node = RE_AddNode(parser, RE_NODE_REPEAT, node, -1);
+    parser->nodes[node].min = min;
+    parser->nodes[node].max = max;
+  }
+  return node;
+}
+
+// Parses a concatenation, up to a '|' or ')' or the end. Returns the
+//  index of its node, or -1 if it's invalid.
+static int RE_ParseCat(REParser *parser) {
+  int node = -1;
+  while (*(parser->pos) != '\0' && *(parser->pos) != '|' &&
+         *(parser->pos) != ')') {
+    int factor = RE_ParseRepeat(parser);
+    if (factor == -1) {
+      return -1;
+    }
+    node = (node == -1) ? factor
+                        : RE_AddNode(parser, RE_NODE_CAT, node, factor);
+  }
+  return (node == -1) ? RE_AddNode(parser, RE_NODE_EMPTY, -1, -1) : node;
+}
+
+// Parses alternatives separated by '|'. Returns the index of its node,
+//  or -1 if it's invalid.
+static int RE_ParseAlt(REParser *parser) {
+  int node = RE_ParseCat(parser);
+  while (node != -1 && *(parser->pos) == '|') {
+    parser->pos++;
+    int right = RE_ParseCat(parser);
+    node = (right == -1) ? -1 : RE_AddNode(parser, RE_NODE_ALT, node, right);
+  }
+  return node;
+}
+
+// --- COMPILING --- //
+
+// Returns the number of NFA states the node at index idx compiles to, or
+//  RE_MAX_INSTS + 1 if it's more.
+static long RE_Size(const REParser *parser, int idx) {
+  const RENode *node = &(parser->nodes[idx]);
+  long size = 0;
+  switch (node->type) {
+    case RE_NODE_EMPTY:
+      break;
+    case RE_NODE_SET:
+    case RE_NODE_BOL:
+    case RE_NODE_EOL:
+      size = 1;
+      break;
+    case RE_NODE_CAT:
+    case RE_NODE_ALT:
+      size = (node->type == RE_NODE_ALT) + RE_Size(parser, node->left) +
+             RE_Size(parser, node->right);
+      break;
+    case RE_NODE_REPEAT: {
+      long copy = RE_Size(parser, node->left);
+      size = node->min * copy +
+             ((node->max == -1) ? copy + 1 : (node->max - node->min) *
+                                             (copy + 1));
+      break;
+    }
+  }
+  return (size > RE_MAX_INSTS) ? RE_MAX_INSTS + 1 : size;
+}
+
+// Appends an instruction to prog, which has room for it, and returns
+//  its index.
+static int RE_Emit(REProgram *prog, REOp op, int out, int arg) {
+  prog->insts[prog->size] = (REInst) {op, out, arg};
+  return prog->size++;
+}
+
+// Compiles the node at index idx into prog, going on to the instruction
+//  at index next after it, and returns the index of its first
+//  instruction. If is_reverse, the node reads its matches backward.
+static int RE_CompileNode(const REParser *parser, int idx, int next,
+                          bool is_reverse, REProgram *prog) {
+  const RENode *node = &(parser->nodes[idx]);
+  switch (node->type) {
+    case RE_NODE_EMPTY:
+      return next;
+    case RE_NODE_SET:
+      return RE_Emit(prog, RE_OP_SET, next, node->set);
+    case RE_NODE_BOL:
+    case RE_NODE_EOL:
+      return RE_Emit(prog, ((node->type == RE_NODE_BOL) != is_reverse) ?
+                               RE_OP_BOL : RE_OP_EOL,
+                     next, 0);
+    case RE_NODE_CAT: {
+      // the operand read second is compiled first, to know where the
+      //  other goes on to.
+      int first = is_reverse ? node->right : node->left;
+      int second = is_reverse ? node->left : node->right;
+      next = RE_CompileNode(parser, second, next, is_reverse, prog);
+      return RE_CompileNode(parser, first, next, is_reverse, prog);
+    }
+    case RE_NODE_ALT: {
+      int left = RE_CompileNode(parser, node->left, next, is_reverse, prog);
+      int right = RE_CompileNode(parser, node->right, next, is_reverse,
+                                 prog);
+      return RE_Emit(prog, RE_OP_SPLIT, left, right);
+    }
+    case RE_NODE_REPEAT: {
+      // x{m,} is m copies of x, then x*. x{m,n} is m copies of x, then
+      //  n - m optional ones, each only if the one before matched.
+      int start = next;
+      if (node->max == -1) {
+        start = RE_Emit(prog, RE_OP_SPLIT, -1, next);
+        prog->insts[start].out = RE_CompileNode(parser, node->left, start,
+                                                is_reverse, prog);
+      }
+      for (int i = node->min; i < node->max; i++) {
+        int copy = RE_CompileNode(parser, node->left, start, is_reverse,
+                                  prog);
+        start = RE_Emit(prog, RE_OP_SPLIT, copy, next);
+      }
+      for (int i = 0; i < node->min; i++) {
+        start = RE_CompileNode(parser, node->left, start, is_reverse, prog);
+      }
+      return start;
+    }
+  }
+  return next;
+}
+
+// Compiles the tree from the node at index root, of size NFA states,
+//  into prog. Calls quit on allocation failure.
+static void RE_CompileProgram(const REParser *parser, int root, long size,
+                              bool is_reverse, REProgram *prog) {
+  prog->insts = malloc((size + 1) * sizeof(*(prog->insts)));
+  if (prog->insts == NULL) {
+    quit("RE_CompileProgram");
+  }
+  prog->size = 0;
+  int match = RE_Emit(prog, RE_OP_MATCH, -1, 0);
+  prog->start = RE_CompileNode(parser, root, match, is_reverse, prog);
+}
+
+// the state of a walk over the tree for the longest run of bytes every
+//  match holds.
+typedef struct {
+  // the run being walked, and the longest one found.
+  char *run;
+  int run_size;
+  char *best;
+  int best_size;
+} RELiteralWalk;
+
+// Walks the node at index idx, which every match goes through, in the
+//  order of the text.
+static void RE_WalkLiteral(const REParser *parser, int idx,
+                           RELiteralWalk *walk) {
+  const RENode *node = &(parser->nodes[idx]);
+  int byte;
+  switch (node->type) {
+    case RE_NODE_CAT:
+      RE_WalkLiteral(parser, node->left, walk);
+      RE_WalkLiteral(parser, node->right, walk);
+      return;
+    case RE_NODE_EMPTY:
+    case RE_NODE_BOL:
+    case RE_NODE_EOL:
+      // takes no bytes, so the run goes on after it.
+      return;
+    case RE_NODE_SET:
+      byte = RE_SetSingle(&(parser->sets[node->set]));
+      if (byte == -1) {
+        break;
+      }
+      walk->run[walk->run_size++] = byte;
+      if (walk->run_size > walk->best_size) {
+        walk->best_size = walk->run_size;
+        memcpy(walk->best, walk->run, walk->run_size);
+      }
+      return;
+    case RE_NODE_REPEAT:
+      // a repeat that can't be skipped holds what its operand holds.
+      if (node->min > 0) {
+        walk->run_size = 0;
+        RE_WalkLiteral(parser, node->left, walk);
+      }
+      break;
+    case RE_NODE_ALT:
+      break;
+  }
+  // the node may match more than one run of bytes, so the run ends here.
+  walk->run_size = 0;
+}
+
+// Splits the bytes into the classes no set of re tells apart.
+static void RE_MakeClasses(Regex *re) {
+  int class = 0;
+  re->class_byte[0] = 0;
+  for (int c = 0; c < 256; c++) {
+    for (int i = 0; c > 0 && i < re->num_sets; i++) {
+      if (RE_SetHas(&(re->sets[i]), c) != RE_SetHas(&(re->sets[i]), c - 1)) {
+        re->class_byte[++class] = c;
+        break;
+      }
+    }
+    re->byte_class[c] = class;
+  }
+  re->num_classes = class + 1;
+}
+
+Regex *RE_Compile(const char *pattern, const char **error) {
+  size_t length = strlen(pattern);
+  if (length > RE_MAX_PATTERN) {
+    *error = "pattern too long";
+    return NULL;
+  }
+  REParser parser = {pattern, NULL, NULL, 0, 0, NULL, 0, 0};
+  int root = RE_ParseAlt(&parser);
+  if (root != -1 && *(parser.pos) == ')') {
+    root = RE_Fail(&parser, "unmatched )");
+  }
+  long size = (root == -1) ? 0 : RE_Size(&parser, root);
+  if (size > RE_MAX_INSTS) {
+    root = RE_Fail(&parser, "pattern too large");
+  }
+  if (root == -1) {
+    *error = parser.error;
+    free(parser.nodes);
+    free(parser.sets);
+    return NULL;
+  }
+
+  Regex *re = malloc(sizeof(*re));
+  char *run = malloc(length + 1);
+  if (re == NULL || run == NULL) {
+    quit("RE_Compile");
+  }
+  re->sets = parser.sets;
+  re->num_sets = parser.num_sets;
+  RE_CompileProgram(&parser, root, size, false, &(re->forward));
+  RE_CompileProgram(&parser, root, size, true, &(re->reverse));
+  RE_MakeClasses(re);
+  re->literal = malloc(length + 1);
+  if (re->literal == NULL) {
+    quit("RE_Compile");
+  }
+  RELiteralWalk walk = {run, 0, re->literal, 0};
+  RE_WalkLiteral(&parser, root, &walk);
+  re->literal_size = walk.best_size;
+  free(run);
+  free(parser.nodes);
+  return re;
+}
+
+void RE_Free(Regex *re) {
+  if (re == NULL) {
+    return;
+  }
+  free(re->sets);
+  free(re->forward.insts);
+  free(re->reverse.insts);
+  free(re->literal);
+  free(re);
+}
+
+const char *RE_Literal(const Regex *re, int *size) {
+  *size = re->literal_size;
+  return re->literal;
+}
+
+// --- MATCHING --- //
+
+// Allocates list for NFA states of a program of size instructions.
+//  Calls quit on allocation failure.
+static void RE_InitList(REStateList *list, int size) {
+  list->dense = malloc(size * sizeof(*(list->dense)));
+  list->tags = malloc(size * sizeof(*(list->tags)));
+  // zeroed so no index is read uninitialized.
+  list->sparse = calloc(size, sizeof(*(list->sparse)));
+  if (list->dense == NULL || list->tags == NULL || list->sparse == NULL) {
+    quit("RE_InitList");
+  }
+  list->size = 0;
+}
+
+static void RE_FreeList(REStateList *list) {
+  free(list->dense);
+  free(list->tags);
+  free(list->sparse);
+}
+
+static bool RE_ListHas(const REStateList *list, int inst) {
+  int idx = list->sparse[inst];
+  return idx < list->size && list->dense[idx] == inst;
+}
+
+// Adds inst to list with tag, along with the NFA states reached from it
+//  without reading, going past a RE_OP_BOL or RE_OP_EOL only if anchors
+//  has RE_AT_BOL or RE_AT_EOL. The states in list already are skipped,
+//  with those reached from them.
+static void RE_AddClosure(REMatcher *matcher, const REProgram *prog,
+                          REStateList *list, int inst, int tag,
+                          int anchors) {
+  int num = 0;
+  matcher->stack[num++] = inst;
+  while (num > 0) {
+    inst = matcher->stack[--num];
+    if (RE_ListHas(list, inst)) {
+      continue;
+    }
+    list->sparse[inst] = list->size;
+    list->dense[list->size] = inst;
+    list->tags[list->size++] = tag;
+    const REInst *in = &(prog->insts[inst]);
+    if (in->op == RE_OP_SPLIT) {
+      matcher->stack[num++] = in->arg;
+      matcher->stack[num++] = in->out;
+    } else if ((in->op == RE_OP_BOL && (anchors & RE_AT_BOL)) ||
+               (in->op == RE_OP_EOL && (anchors & RE_AT_EOL))) {
+      matcher->stack[num++] = in->out;
+    }
+  }
+}
+
+// Returns true if the input ending after the size NFA states of insts
+//  can match: if they hold the RE_OP_MATCH, or a RE_OP_EOL leading to
+//  it. Uses the matcher's work list.
+static bool RE_MatchesAtEnd(REMatcher *matcher, const REProgram *prog,
+                            const int *insts, int size) {
+  REStateList *work = &(matcher->work);
+  work->size = 0;
+  for (int i = 0; i < size; i++) {
+    if (prog->insts[insts[i]].op == RE_OP_EOL) {
+      RE_AddClosure(matcher, prog, work, insts[i], 0, RE_AT_EOL);
+    } else if (insts[i] == 0) {
+      return true;
+    }
+  }
+  return RE_ListHas(work, 0);
+}
+
+static int RE_CompareInts(const void *a, const void *b) {
+  int x = *(const int *) a;
+  int y = *(const int *) b;
+  return (x > y) - (x < y);
+}
+
+// Drops all the states of dfa.
+static void RE_FlushDfa(REDfa *dfa) {
+  dfa->num_states = 0;
+  dfa->num_insts = 0;
+  dfa->cache_size = 0;
+  dfa->num_flushes++;
+  dfa->start[0] = RE_UNKNOWN;
+  dfa->start[1] = RE_UNKNOWN;
+  for (int i = 0; i < dfa->table_size; i++) {
+    dfa->table[i] = -1;
+  }
+}
+
+// Returns the slot of dfa's table holding the state of the size NFA
+//  states of key, whose hash is given, or the empty slot it would go in.
+static int RE_FindSlot(const REDfa *dfa, const int *key, int size,
+                       unsigned hash) {
+  int mask = dfa->table_size - 1;
+  int slot = hash & mask;
+  while (dfa->table[slot] != -1) {
+    const REState *state = &(dfa->states[dfa->table[slot]]);
+    if (state->hash == hash && state->size == size &&
+        memcmp(&(dfa->insts[state->first]), key, size * sizeof(*key)) == 0) {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+// Makes room in dfa for a state of size NFA states. Calls quit on
+//  allocation failure.
+static void RE_GrowDfa(REDfa *dfa, int num_classes, int size) {
+  if (dfa->num_states == dfa->states_capacity) {
+    int capacity = (dfa->states_capacity == 0) ? RE_MIN_STATES
+                                               : dfa->states_capacity * 2;
+    REState *states = realloc(dfa->states, capacity * sizeof(*states));
+    int *next = realloc(dfa->next,
+                        (long) capacity * num_classes * sizeof(*next));
+    if (states == NULL || next == NULL) {
+      quit("RE_GrowDfa");
+    }
+    dfa->states = states;
+    dfa->next = next;
+    dfa->states_capacity = capacity;
+  }
+  if (dfa->num_insts + size > dfa->insts_capacity) {
+    int capacity = (dfa->insts_capacity == 0) ? RE_MIN_STATES
+                                              : dfa->insts_capacity;
+    while (capacity < dfa->num_insts + size) {
+      capacity *= 2;
+    }
+    int *insts = realloc(dfa->insts, capacity * sizeof(*insts));
+    if (insts == NULL) {
+      quit("RE_GrowDfa");
+    }
+    dfa->insts = insts;
+    dfa->insts_capacity = capacity;
+  }
+  if ((dfa->num_states + 1) * 2 > dfa->table_size) {
+    // keep the table at most half full, so lookups stay short.
+    free(dfa->table);
+    dfa->table_size = (dfa->table_size == 0) ? RE_MIN_STATES * 2
+                                             : dfa->table_size * 2;
+    dfa->table = malloc(dfa->table_size * sizeof(*(dfa->table)));
+    if (dfa->table == NULL) {
+      quit("RE_GrowDfa");
+    }
+    for (int i = 0; i < dfa->table_size; i++) {
+      dfa->table[i] = -1;
+    }
+    for (int i = 0; i < dfa->num_states; i++) {
+      const REState *state = &(dfa->states[i]);
+      dfa->table[RE_FindSlot(dfa, &(dfa->insts[state->first]), state->size,
+                             state->hash)] = i;
+    }
+  }
+}
+
+// Returns the state of dfa for the NFA states in the matcher's work
+//  list, adding it if it's new, or RE_DEAD if none of them reads a byte
+//  or matches. Drops the other states first if the cache is full. Calls
+//  quit on allocation failure.
+static int RE_AddState(REMatcher *matcher, REDfa *dfa) {
+  const REProgram *prog = dfa->prog;
+  REStateList *work = &(matcher->work);
+  int *key = matcher->key;
+  int size = 0;
+  for (int i = 0; i < work->size; i++) {
+    REOp op = prog->insts[work->dense[i]].op;
+    if (op == RE_OP_SET || op == RE_OP_EOL || op == RE_OP_MATCH) {
+      key[size++] = work->dense[i];
+    }
+  }
+  if (size == 0) {
+    return RE_DEAD;
+  }
+  qsort(key, size, sizeof(*key), RE_CompareInts);
+  unsigned hash = 2166136261u;
+  for (int i = 0; i < size; i++) {
+    hash = (hash ^ key[i]) * 16777619u;
+  }
+  if (dfa->table_size > 0) {
+    int slot = RE_FindSlot(dfa, key, size, hash);
+    if (dfa->table[slot] != -1) {
+      return dfa->table[slot];
+    }
+  }
+
+  int num_classes = matcher->re->num_classes;
+  long cost = sizeof(REState) + (num_classes + size + 4) * sizeof(int);
+  if (dfa->num_states > 0 && dfa->cache_size + cost > RE_CACHE_MAX) {
+    RE_FlushDfa(dfa);
+  }
+  RE_GrowDfa(dfa, num_classes, size);
+  int idx = dfa->num_states++;
+  REState *state = &(dfa->states[idx]);
+  state->first = dfa->num_insts;
+  state->size = size;
+  state->hash = hash;
+  state->is_match = (key[0] == 0);
+  state->is_match_at_end = RE_MatchesAtEnd(matcher, prog, key, size);
+  memcpy(&(dfa->insts[dfa->num_insts]), key, size * sizeof(*key));
+  dfa->num_insts += size;
+  dfa->table[RE_FindSlot(dfa, key, size, hash)] = idx;
+  for (int i = 0; i < num_classes; i++) {
+    dfa->next[(long) idx * num_classes + i] = RE_UNKNOWN;
+  }
+  dfa->cache_size += cost;
+  return idx;
+}
+
+// Returns the start state of dfa, at the start of the input if is_bol,
+//  building it if it's not known.
+static int RE_Start(REMatcher *matcher, REDfa *dfa, bool is_bol) {
+  if (dfa->start[is_bol] == RE_UNKNOWN) {
+    matcher->work.size = 0;
+    RE_AddClosure(matcher, dfa->prog, &(matcher->work), dfa->prog->start, 0,
+                  is_bol ? RE_AT_BOL : 0);
+    int start = RE_AddState(matcher, dfa);
+    dfa->start[is_bol] = start;
+  }
+  return dfa->start[is_bol];
+}
+
+// Returns the state dfa goes to from state by a byte of class cls,
+//  building it, and the transition if the states aren't dropped.
+static int RE_Step(REMatcher *matcher, REDfa *dfa, int state, int cls) {
+  const Regex *re = matcher->re;
+  const REProgram *prog = dfa->prog;
+  int byte = re->class_byte[cls];
+  REStateList *work = &(matcher->work);
+  work->size = 0;
+  const REState *from = &(dfa->states[state]);
+  for (int i = 0; i < from->size; i++) {
+    const REInst *in = &(prog->insts[dfa->insts[from->first + i]]);
+    if (in->op == RE_OP_SET && RE_SetHas(&(re->sets[in->arg]), byte)) {
+      RE_AddClosure(matcher, prog, work, in->out, 0, 0);
+    }
+  }
+  if (dfa->is_unanchored) {
+    RE_AddClosure(matcher, prog, work, prog->start, 0, 0);
+  }
+  long num_flushes = dfa->num_flushes;
+  int to = RE_AddState(matcher, dfa);
+  if (dfa->num_flushes == num_flushes) {
+    dfa->next[(long) state * re->num_classes + cls] = to;
+  }
+  return to;
+}
+
+static void RE_InitDfa(REDfa *dfa, const REProgram *prog,
+                       bool is_unanchored) {
+  *dfa = (REDfa) {0};
+  dfa->prog = prog;
+  dfa->is_unanchored = is_unanchored;
+  dfa->start[0] = RE_UNKNOWN;
+  dfa->start[1] = RE_UNKNOWN;
+}
+
+static void RE_FreeDfa(REDfa *dfa) {
+  free(dfa->states);
+  free(dfa->next);
+  free(dfa->insts);
+  free(dfa->table);
+}
+
+REMatcher *RE_NewMatcher(const Regex *re) {
+  REMatcher *matcher = calloc(1, sizeof(*matcher));
+  if (matcher == NULL) {
+    quit("RE_NewMatcher");
+  }
+  matcher->re = re;
+  RE_InitDfa(&(matcher->forward), &(re->forward), false);
+  RE_InitDfa(&(matcher->backward), &(re->reverse), true);
+  int size = re->forward.size;
+  RE_InitList(&(matcher->work), size);
+  RE_InitList(&(matcher->lists[0]), size);
+  RE_InitList(&(matcher->lists[1]), size);
+  // each state walked pushes at most the two it goes on to.
+  matcher->stack = malloc((2 * size + 1) * sizeof(*(matcher->stack)));
+  matcher->key = malloc(size * sizeof(*(matcher->key)));
+  if (matcher->stack == NULL || matcher->key == NULL) {
+    quit("RE_NewMatcher");
+  }
+  return matcher;
+}
+
+void RE_FreeMatcher(REMatcher *matcher) {
+  if (matcher == NULL) {
+    return;
+  }
+  RE_FreeDfa(&(matcher->forward));
+  RE_FreeDfa(&(matcher->backward));
+  RE_FreeList(&(matcher->work));
+  RE_FreeList(&(matcher->lists[0]));
+  RE_FreeList(&(matcher->lists[1]));
+  free(matcher->stack);
+  free(matcher->key);
+  free(matcher->starts);
+  free(matcher->ends);
+  free(matcher);
+}
+
+void RE_SetLine(REMatcher *matcher, const char *line, int size) {
+  matcher->line = line;
+  matcher->size = size;
+  matcher->pos = size;
+  matcher->has_ends = false;
+  matcher->reads_left = (long) size * RE_READS_PER_BYTE + RE_READS_MIN;
+  if (size == 0) {
+    // no match is empty.
+    return;
+  }
+  if (size > matcher->starts_capacity) {
+    free(matcher->starts);
+    matcher->starts = malloc(size);
+    if (matcher->starts == NULL) {
+      quit("RE_SetLine");
+    }
+    matcher->starts_capacity = size;
+  }
+  memset(matcher->starts, 0, size);
+
+  // read the line backward with the reversed pattern, which may match
+  //  from anywhere: it's in a matching state after reading the byte at
+  //  index i if a match starts there.
+  REDfa *dfa = &(matcher->backward);
+  const unsigned char *byte_class = matcher->re->byte_class;
+  int num_classes = matcher->re->num_classes;
+  char *starts = matcher->starts;
+  int state = RE_Start(matcher, dfa, true);
+  int i = size - 1;
+  for (; i >= 0 && state != RE_DEAD; i--) {
+    int cls = byte_class[(unsigned char) line[i]];
+    int next = dfa->next[state * num_classes + cls];
+    state = (next == RE_UNKNOWN) ? RE_Step(matcher, dfa, state, cls) : next;
+    if (state != RE_DEAD && dfa->states[state].is_match) {
+      starts[i] = 1;
+    }
+  }
+  if (i < 0 && state != RE_DEAD && dfa->states[state].is_match_at_end) {
+    // a match held back by a '^' starts at the start of the line.
+    starts[0] = 1;
+  }
+  const char *first = memchr(matcher->starts, 1, size);
+  if (first != NULL) {
+    matcher->pos = first - matcher->starts;
+  }
+}
+
+// Returns the end of the longest match starting at index start of the
+//  line, or -1 if there is none but an empty one. Counts the bytes read
+//  against reads_left.
+static int RE_LongestFrom(REMatcher *matcher, int start) {
+  REDfa *dfa = &(matcher->forward);
+  const unsigned char *byte_class = matcher->re->byte_class;
+  int num_classes = matcher->re->num_classes;
+  const char *line = matcher->line;
+  int state = RE_Start(matcher, dfa, start == 0);
+  int end = -1;
+  int i = start;
+  while (i < matcher->size && state != RE_DEAD) {
+    int cls = byte_class[(unsigned char) line[i++]];
+    int next = dfa->next[state * num_classes + cls];
+    state = (next == RE_UNKNOWN) ? RE_Step(matcher, dfa, state, cls) : next;
+    if (state != RE_DEAD && dfa->states[state].is_match) {
+      end = i;
+    }
+  }
+  if (i == matcher->size && state != RE_DEAD &&
+      dfa->states[state].is_match_at_end) {
+    end = i;
+  }
+  matcher->reads_left -= i - start + 1;
+  return end;
+}
+
+// Sets ends to the end of the longest match starting at each index of
+//  the line from pos on, all at once, by running the reversed NFA
+//  backward from the end of the line. Each of its states is tagged with
+//  where the match it's on ends, and a state reached with two ends keeps
+//  the furthest, as the input left for both is the same. Calls quit on
+//  allocation failure.
+static void RE_FindEnds(REMatcher *matcher) {
+  if (matcher->size > matcher->ends_capacity) {
+    free(matcher->ends);
+    matcher->ends = malloc(matcher->size * sizeof(*(matcher->ends)));
+    if (matcher->ends == NULL) {
+      quit("RE_FindEnds");
+    }
+    matcher->ends_capacity = matcher->size;
+  }
+  const Regex *re = matcher->re;
+  const REProgram *prog = &(re->reverse);
+  REStateList *list = &(matcher->lists[0]);
+  REStateList *next = &(matcher->lists[1]);
+  list->size = 0;
+  for (int j = matcher->size; ; j--) {
+    // a match may end here. the states of the ends further on are in the
+    //  list first, so they keep the NFA states both reach.
+    RE_AddClosure(matcher, prog, list, prog->start, j,
+                  (j == matcher->size) ? RE_AT_BOL : 0);
+    if (j < matcher->size) {
+      int end = RE_ListHas(list, 0) ? list->tags[list->sparse[0]] : -1;
+      for (int i = 0; j == 0 && i < list->size; i++) {
+        if (list->tags[i] > end &&
+            RE_MatchesAtEnd(matcher, prog, &(list->dense[i]), 1)) {
+          end = list->tags[i];
+        }
+      }
+      matcher->ends[j] = (end > j) ? end : -1;
+    }
+    if (j == matcher->pos) {
+      break;
+    }
+    int byte = (unsigned char) matcher->line[j - 1];
+    next->size = 0;
+    for (int i = 0; i < list->size; i++) {
+      const REInst *in = &(prog->insts[list->dense[i]]);
+      if (in->op == RE_OP_SET && RE_SetHas(&(re->sets[in->arg]), byte)) {
+        RE_AddClosure(matcher, prog, next, in->out, list->tags[i], 0);
+      }
+    }
+    REStateList *swap = list;
+    list = next;
+    next = swap;
+  }
+  matcher->has_ends = true;
+}
+
+bool RE_NextMatch(REMatcher *matcher, int *col, int *size) {
+  while (matcher->pos < matcher->size) {
+    int start = matcher->pos;
+    int end = -1;
+    if (matcher->has_ends) {
+      end = matcher->ends[start];
+    } else if (!matcher->starts[start]) {
+      const char *next = memchr(&(matcher->starts[start]), 1,
+                                matcher->size - start);
+      matcher->pos = (next == NULL) ? matcher->size : next - matcher->starts;
+      continue;
+    } else if (matcher->reads_left < 0) {
+      // the reads ran on far past the ends of the matches, so find the
+      //  rest of them at once.
+      RE_FindEnds(matcher);
+      continue;
+    } else {
+      end = RE_LongestFrom(matcher, start);
+    }
+    if (end > start) {
+      *col = start;
+      *size = end - start;
+      matcher->pos = end;
+      return true;
+    }
+    matcher->pos = start + 1;
+  }
+  return false;
+}
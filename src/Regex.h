@@ -0,0 +1,81 @@
+#ifndef REGEX_H_
+#define REGEX_H_
+
+// Regular expressions matched a line at a time, in time linear in the
+//  size of the line (times the size of the pattern), however the pattern
+//  is written: there is no backtracking. A pattern is parsed into an NFA
+//  (a Thompson construction), and lines are read by DFAs whose states,
+//  sets of NFA states, are only built as the text reaches them. The
+//  states built are cached with their transitions, so most bytes cost a
+//  table lookup, and the cache is bounded (see RE_CACHE_MAX): once full,
+//  it is dropped and built again from the state reached.
+//
+// A line is read backward once to find where matches start, then each
+//  match is read forward from its start to its longest end. Should those
+//  forward reads go on far past the ends found (e.g., "a|a.*b" on a line
+//  of a's), the ends of the rest of the line are all found at once by
+//  running the reversed NFA instead, which keeps the bound.
+//
+// Matches are the leftmost-longest ones (as in POSIX), don't overlap,
+//  and are never empty. The syntax is that of POSIX extended regular
+//  expressions, with a few common escapes:
+//  - c: the byte c, unless it is one of the characters below.
+//  - \c: the byte c, if it isn't a letter or digit.
+//  - \t, \r, \f, \v: a tab, carriage return, form feed or vertical tab.
+//  - \d, \w, \s: a digit, word character ([0-9A-Za-z_]) or space; \D,
+//    \W and \S match any other byte.
+//  - .: any byte.
+//  - [abc], [a-z], [^abc]: any byte in (or not in) the set; a ']' first
+//    in the set and a '-' first or last stand for themselves.
+//  - ^ and $: the start and end of the line.
+//  - x*, x+, x?, x{m}, x{m,}, x{m,n}: repeats of x, up to RE_MAX_REPEAT.
+//  - xy, x|y, (x): concatenation, alternation and grouping.
+
+#include <stdbool.h>
+
+// the longest pattern compiled.
+#define RE_MAX_PATTERN 4096
+// the largest count in a repeat (e.g., x{m,n}).
+#define RE_MAX_REPEAT 1000
+// the most memory, in bytes, the states cached by one DFA may take.
+#define RE_CACHE_MAX (1024 * 1024)
+
+// a compiled pattern. only read once compiled, so it may be shared by
+//  threads, each with its own REMatcher.
+typedef struct Regex Regex;
+
+// the DFAs of a pattern as built so far, and the line being matched.
+//  must only be used by one thread at a time.
+typedef struct REMatcher REMatcher;
+
+// Compiles the null-terminated pattern. Returns NULL if it isn't a valid
+//  pattern, and sets *error to a message saying why. Calls quit on
+//  allocation failure.
+Regex *RE_Compile(const char *pattern, const char **error);
+
+// Frees re. Does nothing if re is NULL.
+void RE_Free(Regex *re);
+
+// Returns the longest run of bytes every match of re holds, and sets
+//  *size to its size, which is 0 if there is none. Lines without it
+//  can't match, so they can be skipped with a fast substring search.
+const char *RE_Literal(const Regex *re, int *size);
+
+// Returns a new matcher for re, which must outlive it. Calls quit on
+//  allocation failure.
+REMatcher *RE_NewMatcher(const Regex *re);
+
+// Frees matcher. Does nothing if matcher is NULL.
+void RE_FreeMatcher(REMatcher *matcher);
+
+// Starts finding the matches in the size bytes of line, without its
+//  newline, which must stay unchanged until the last match is found.
+//  Calls quit on allocation failure.
+void RE_SetLine(REMatcher *matcher, const char *line, int size);
+
+// Finds the next match in the line set: returns true and sets *col to
+//  its index in the line and *size to its size, or returns false if
+//  there are no more. Calls quit on allocation failure.
+bool RE_NextMatch(REMatcher *matcher, int *col, int *size);
+
+#endif  // REGEX_H_
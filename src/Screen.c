@@ -0,0 +1,365 @@
+#include <limits.h>  // for CHAR_BIT
+#include <stdio.h>   // for snprintf
+#include <stdlib.h>  // for malloc, free, abs
+#include <string.h>  // for memcmp, memcpy, memmove
+
+#include "ESCCommands.h"
+#include "Quit.h"
+#include "Screen.h"
+#include "SyntaxHL.h"  // for File_GetHighlightCode
+
+// the size of a buffer for a cursor movement or text format command.
+#define BUF_SIZE_CMD 32
+// the most unchanged cells between two changed ones that are written
+//  over again rather than moved past, as a move takes about this many
+//  bytes.
+#define SCREEN_MERGE_GAP 4
+
+// a character on the screen and its attributes.
+typedef struct {
+  unsigned char c;
+  unsigned char attr;
+} Cell;
+
+// the frame last sent to the terminal, and the frame being drawn. each
+//  holds screen_rows rows of screen_cols cells.
+static Cell *front = NULL;
+static Cell *back = NULL;
+static int screen_rows = 0;
+static int screen_cols = 0;
+// the number of cells front and back have room for. they are only
+//  reallocated when the screen grows past it.
+static size_t screen_capacity = 0;
+// false if what the terminal shows is unknown, so front can't be used.
+static bool front_valid = false;
+// where the terminal's cursor is, and the attributes it writes text
+//  with, as left by the last output. -1 where unknown; term_col is also
+//  unknown after writing the last column, where the cursor waits to wrap.
+static int term_row = -1;
+static int term_col = -1;
+static int term_attr = -1;
+// the scroll of rows [scroll_top, scroll_bottom) by scroll_count rows
+//  made to front in this frame and not yet sent. none if scroll_count is 0.
+static int scroll_top = 0;
+static int scroll_bottom = 0;
+static int scroll_count = 0;
+// true if frames are sent as synchronized updates.
+static bool use_sync_mode = false;
+
+// the command that sets the attributes of text to each attribute, and
+//  its size. a size of 0 marks a command not made yet.
+static char sgr_cmds[1 << CHAR_BIT][BUF_SIZE_CMD];
+static unsigned char sgr_sizes[1 << CHAR_BIT];
+
+// a blank cell.
+static const Cell blank_cell = {' ', SCREEN_PLAIN};
+
+// Returns true if the cells a and b look the same.
+static bool Cell_Equal(Cell a, Cell b) {
+  return a.c == b.c && a.attr == b.attr;
+}
+
+// Returns true if any of the size cells is not a single ASCII character.
+//  such a cell may be part of a character the terminal shows in another
+//  number of columns, so the columns of the row can't be trusted.
+static bool Screen_HasWide(const Cell *cells, int size) {
+  for (int i = 0; i < size; i++) {
+    if (cells[i].c >= 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Appends the command that moves the cursor to (row, col), unless it is
+//  there already. Picks the shortest of the movements that get there.
+static void Screen_MoveTo(Buffer *wbuf, int row, int col) {
+  if (term_row == row && term_col == col) {
+    return;
+  }
+  char cmd[BUF_SIZE_CMD];
+  if (term_row == row && col == 0) {
+    WB_Append(wbuf, "\r", 1);
+  } else if (term_row >= 0 && term_row + 1 == row && col == 0) {
+    // the cursor is never on the last row here, so this can't scroll.
+    WB_Append(wbuf, "\r\n", 2);
+  } else if (term_row == row && term_col >= 0 && col > term_col) {
+    int size = snprintf(cmd, BUF_SIZE_CMD, ESC_SEQ "%dC", col - term_col);
+    WB_Append(wbuf, cmd, size);
+  } else {
+    // screen rows and columns are 1 indexed.
+    Get_ESCCmd_Move(cmd, BUF_SIZE_CMD, col + 1, row + 1);
+    WB_AppendESCCmd(wbuf, cmd);
+  }
+  term_row = row;
+  term_col = col;
+}
+
+// Appends the command that makes text be written with attr.
+static void Screen_SetAttr(Buffer *wbuf, unsigned char attr) {
+  if (term_attr == attr) {
+    return;
+  }
+  if (sgr_sizes[attr] == 0) {
+    // the command for attr is made the first time it is used.
+    int color = File_GetHighlightCode(attr & ~SCREEN_INVERT);
+    const char *invert = (attr & SCREEN_INVERT) ? ";" INVERT : "";
+    if (color == 0) {
+      sgr_sizes[attr] = snprintf(sgr_cmds[attr], BUF_SIZE_CMD,
+                                 ESC_SEQ DEFAULT "%sm", invert);
+    } else {
+      sgr_sizes[attr] = snprintf(sgr_cmds[attr], BUF_SIZE_CMD,
+                                 ESC_SEQ DEFAULT ";%d%sm", color, invert);
+    }
+  }
+  WB_Append(wbuf, sgr_cmds[attr], sgr_sizes[attr]);
+  term_attr = attr;
+}
+
+// Appends the size cells, which start at the cursor. each run of cells
+//  with the same attributes is appended at once.
+static void Screen_Write(Buffer *wbuf, const Cell *cells, int size) {
+  int start = 0;
+  while (start < size) {
+    int end = start + 1;
+    while (end < size && cells[end].attr == cells[start].attr) {
+      end++;
+    }
+    Screen_SetAttr(wbuf, cells[start].attr);
+    char *text = WB_Extend(wbuf, end - start);
+    if (text != NULL) {
+      for (int i = start; i < end; i++) {
+        text[i - start] = cells[i].c;
+      }
+    }
+    start = end;
+  }
+  term_col += size;
+  if (term_col >= screen_cols) {
+    // the cursor waits past the last column to wrap.
+    term_col = -1;
+  }
+}
+
+// Appends the command that clears the rest of the row from the cursor.
+static void Screen_ClearToEnd(Buffer *wbuf) {
+  // the cleared cells take the current attributes.
+  Screen_SetAttr(wbuf, SCREEN_PLAIN);
+  WB_AppendESCCmd(wbuf, ESC_CMD_CLEAR(LINE, END));
+}
+
+// Appends the commands that scroll the terminal as front was scrolled.
+static void Screen_FlushScroll(Buffer *wbuf) {
+  char cmd[BUF_SIZE_CMD];
+  // the rows uncovered take the current attributes.
+  Screen_SetAttr(wbuf, SCREEN_PLAIN);
+  int size = snprintf(cmd, BUF_SIZE_CMD, ESC_SEQ "%d;%d" SCROLL_REGION,
+                      scroll_top + 1, scroll_bottom);
+  WB_Append(wbuf, cmd, size);
+  if (scroll_count > 0) {
+    // line feeds on the last row of the region scroll it up.
+    Get_ESCCmd_Move(cmd, BUF_SIZE_CMD, 1, scroll_bottom);
+    WB_AppendESCCmd(wbuf, cmd);
+    for (int i = 0; i < scroll_count; i++) {
+      WB_Append(wbuf, "\n", 1);
+    }
+  } else {
+    // the region was just set, so the cursor is on its first row.
+    for (int i = 0; i < -scroll_count; i++) {
+      WB_AppendESCCmd(wbuf, ESC_CMD_REVERSE_INDEX);
+    }
+  }
+  WB_AppendESCCmd(wbuf, ESC_CMD_SCROLL_RESET);
+  term_row = 0;
+  term_col = 0;
+  scroll_count = 0;
+}
+
+// Appends what turns row of the last frame sent into row of the new one.
+static void Screen_FlushRow(Buffer *wbuf, int row) {
+  const Cell *new_row = &(back[row * screen_cols]);
+  const Cell *old_row = &(front[row * screen_cols]);
+  // the new row is blank from column used on.
+  int used = screen_cols;
+  while (used > 0 && Cell_Equal(new_row[used - 1], blank_cell)) {
+    used--;
+  }
+
+  if (!front_valid || Screen_HasWide(new_row, screen_cols) ||
+      Screen_HasWide(old_row, screen_cols)) {
+    // write the whole row, and clear the rest from wherever the terminal
+    //  left the cursor after it.
+    Screen_MoveTo(wbuf, row, 0);
+    Screen_Write(wbuf, new_row, used);
+    if (Screen_HasWide(new_row, used)) {
+      term_col = -1;
+      Screen_ClearToEnd(wbuf);
+    } else if (used < screen_cols) {
+      Screen_ClearToEnd(wbuf);
+    }
+    return;
+  }
+
+  int col = 0;
+  while (col < screen_cols) {
+    if (Cell_Equal(new_row[col], old_row[col])) {
+      col++;
+      continue;
+    }
+    Screen_MoveTo(wbuf, row, col);
+    if (col >= used) {
+      // the rest of the new row is blank.
+      Screen_ClearToEnd(wbuf);
+      return;
+    }
+    // write the run of changed cells, along with any short stretches of
+    //  unchanged ones between them.
+    int last_changed = col;
+    for (int i = col + 1; i < used && i - last_changed <= SCREEN_MERGE_GAP;
+         i++) {
+      if (!Cell_Equal(new_row[i], old_row[i])) {
+        last_changed = i;
+      }
+    }
+    Screen_Write(wbuf, &(new_row[col]), last_changed + 1 - col);
+    col = last_changed + 1;
+  }
+}
+
+void Screen_Resize(int num_rows, int num_cols) {
+  size_t num_cells = (size_t) num_rows * num_cols;
+  if (num_cells > screen_capacity) {
+    // the frames are drawn in full before being read, so their contents
+    //  don't have to survive.
+    free(front);
+    free(back);
+    front = malloc(num_cells * sizeof(Cell));
+    back = malloc(num_cells * sizeof(Cell));
+    if (front == NULL || back == NULL) {
+      quit("Screen_Resize");
+    }
+    screen_capacity = num_cells;
+  }
+  screen_rows = num_rows;
+  screen_cols = num_cols;
+  Screen_Invalidate();
+}
+
+void Screen_SetSync(bool use_sync) {
+  use_sync_mode = use_sync;
+}
+
+void Screen_Invalidate(void) {
+  front_valid = false;
+  term_row = -1;
+  term_col = -1;
+  term_attr = -1;
+  scroll_count = 0;
+}
+
+void Screen_Scroll(int top, int bottom, int count) {
+  int height = bottom - top;
+  if (!front_valid || count == 0 || count >= height || -count >= height) {
+    return;
+  }
+  if (scroll_count != 0) {
+    // only scrolls the same way over the same rows add up to one scroll.
+    if (top != scroll_top || bottom != scroll_bottom ||
+        (count > 0) != (scroll_count > 0)) {
+      return;
+    }
+    if (scroll_count + count >= height || -(scroll_count + count) >= height) {
+      return;
+    }
+  }
+  Cell *region = &(front[top * screen_cols]);
+  int num_kept = (height - abs(count)) * screen_cols;
+  Cell *uncovered;
+  if (count > 0) {
+    memmove(region, &(region[count * screen_cols]), num_kept * sizeof(Cell));
+    uncovered = &(region[num_kept]);
+  } else {
+    memmove(&(region[-count * screen_cols]), region, num_kept * sizeof(Cell));
+    uncovered = region;
+  }
+  for (int i = 0; i < abs(count) * screen_cols; i++) {
+    uncovered[i] = blank_cell;
+  }
+  scroll_top = top;
+  scroll_bottom = bottom;
+  scroll_count += count;
+}
+
+void Screen_BeginFrame(void) {
+  if (screen_rows == 0) {
+    return;
+  }
+  // blank the first row, then copy it over the others.
+  for (int i = 0; i < screen_cols; i++) {
+    back[i] = blank_cell;
+  }
+  for (int row = 1; row < screen_rows; row++) {
+    memcpy(&(back[row * screen_cols]), back, screen_cols * sizeof(Cell));
+  }
+}
+
+void Screen_PutText(int row, int col, const char *str, int size,
+                    unsigned char attr) {
+  if (row < 0 || row >= screen_rows || col < 0) {
+    return;
+  }
+  if (size > screen_cols - col) {
+    size = screen_cols - col;
+  }
+  Cell *cells = &(back[row * screen_cols + col]);
+  for (int i = 0; i < size; i++) {
+    cells[i] = (Cell) {str[i], attr};
+  }
+}
+
+void Screen_PutCell(int row, int col, char c, unsigned char attr) {
+  Screen_PutText(row, col, &c, 1, attr);
+}
+
+bool Screen_KeepRow(int row) {
+  if (!front_valid || row < 0 || row >= screen_rows) {
+    return false;
+  }
+  memcpy(&(back[row * screen_cols]), &(front[row * screen_cols]),
+         screen_cols * sizeof(Cell));
+  return true;
+}
+
+void Screen_Flush(Buffer *wbuf, int cursor_row, int cursor_col) {
+  bool changed = !front_valid || scroll_count != 0 ||
+                 memcmp(front, back, (size_t) screen_rows * screen_cols *
+                                     sizeof(Cell)) != 0;
+  if (changed) {
+    if (use_sync_mode) {
+      WB_AppendESCCmd(wbuf, ESC_CMD_SYNC_MODE(SHOW));
+    }
+    // hide the cursor while rendering.
+    WB_AppendESCCmd(wbuf, ESC_CMD_CUR_MODE(HIDE));
+    if (scroll_count != 0) {
+      Screen_FlushScroll(wbuf);
+    }
+    for (int row = 0; row < screen_rows; row++) {
+      Screen_FlushRow(wbuf, row);
+    }
+    // leave the terminal writing plain text.
+    Screen_SetAttr(wbuf, SCREEN_PLAIN);
+  }
+  Screen_MoveTo(wbuf, cursor_row, cursor_col);
+  if (changed) {
+    WB_AppendESCCmd(wbuf, ESC_CMD_CUR_MODE(SHOW));
+    if (use_sync_mode) {
+      WB_AppendESCCmd(wbuf, ESC_CMD_SYNC_MODE(HIDE));
+    }
+  }
+
+  // the new frame is now on the terminal.
+  Cell *sent = back;
+  back = front;
+  front = sent;
+  front_valid = true;
+}
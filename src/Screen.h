@@ -0,0 +1,69 @@
+#ifndef SCREEN_H_
+#define SCREEN_H_
+
+// A shadow copy of the terminal screen. Each frame is drawn into a grid
+//  of cells (a character and its attributes), which is compared against
+//  the cells of the last frame sent. Only the runs of cells that changed
+//  are written, each after the shortest cursor movement that reaches it,
+//  so small edits send a few bytes instead of the whole screen. Rows
+//  that only moved are scrolled on the terminal rather than written.
+
+#include <stdbool.h>
+
+#include "WriteBuffer.h"
+
+// the attribute bit of a cell shown in inverted colors. the other bits
+//  of an attribute hold the cell's Highlight_t code (see SyntaxHL.h).
+#define SCREEN_INVERT 0x80
+// the attribute of a plain cell.
+#define SCREEN_PLAIN 0
+
+// Sets the size of the screen and forgets what is shown on it, so the
+//  next frame is drawn in full, as a terminal may move or rewrap its text
+//  when resized. Memory is only allocated when the screen grows. Calls
+//  quit on allocation failure.
+void Screen_Resize(int num_rows, int num_cols);
+
+// Sets whether each frame that changes anything is sent as one
+//  synchronized update (see ESC_CMD_SYNC_MODE), so a frame that takes a
+//  while to arrive is not shown half drawn. Off at first; only for
+//  terminals that support the mode (see Term_QueryMode).
+void Screen_SetSync(bool use_sync);
+
+// Forgets what is shown on the terminal, so the next frame is drawn in
+//  full. Used after anything else has written to the terminal.
+void Screen_Invalidate(void);
+
+// Moves the content of rows [top, bottom) up by count rows, or down by
+//  -count rows if count is negative, leaving blank rows behind. The
+//  terminal is told to scroll the same rows at the next flush, so only
+//  the rows uncovered have to be written. Does nothing if the scroll
+//  uncovers every row, or if it can't be combined with a scroll already
+//  made in this frame.
+void Screen_Scroll(int top, int bottom, int count);
+
+// Starts a new frame with every cell blank.
+void Screen_BeginFrame(void);
+
+// Sets the cells of row starting at column col to the size characters
+//  of str, all with attribute attr. Characters past the last column are
+//  cut off.
+void Screen_PutText(int row, int col, const char *str, int size,
+                    unsigned char attr);
+
+// Sets the cell at row and col to c with attribute attr.
+void Screen_PutCell(int row, int col, char c, unsigned char attr);
+
+// Sets the cells of row to what the terminal shows there already, so
+//  the row is not written at the next flush. Used to put off drawing it.
+//  Returns false, leaving the row as it was, if what the terminal shows
+//  is unknown.
+bool Screen_KeepRow(int row);
+
+// Appends to wbuf what has to be written to turn the last frame sent into
+//  the new frame, followed by moving the cursor to (cursor_row,
+//  cursor_col), then makes the new frame the last one sent. Appends
+//  nothing if neither the cells nor the cursor changed.
+void Screen_Flush(Buffer *wbuf, int cursor_row, int cursor_col);
+
+#endif  // SCREEN_H_
@@ -0,0 +1,992 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>  // for fcntl
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>  // for pipe, read, write, sysconf
+
+#include "Search.h"
+#include "LineTree.h"
+#include "Quit.h"
+#include "Regex.h"
+#include "StrScan.h"
+
+// the least text, in bytes, searched on worker threads rather than right
+//  away.
+#define SEARCH_WORKER_MIN (4 * 1024 * 1024)
+// the most bytes of consecutive lines put in one piece of the text.
+#define SEARCH_PIECE_MAX (1024 * 1024)
+// the least bytes of text in a chunk (see SearchChunk), unless it is the
+//  last. small enough that the workers stop soon after they are asked
+//  to, and share the work out evenly.
+#define SEARCH_CHUNK_MIN (1024 * 1024)
+// the most threads searching at once.
+#define SEARCH_MAX_WORKERS 16
+// how often each worker reports how many matches were found, in
+//  milliseconds.
+#define SEARCH_PROGRESS_MS 100
+// the number of matches or pieces first allocated for.
+#define SEARCH_MIN_ITEMS 64
+// a search stops taking chunks once it has found this many matches, so
+//  a short query on a huge file doesn't fill the memory.
+#define SEARCH_MAX_MATCHES (4 * 1024 * 1024)
+// the most runs of lines with matches kept for a longer query to search.
+//  past that, the longer query searches all of the text.
+#define SEARCH_MAX_LINES (1024 * 1024)
+
+// a piece of the text searched: consecutive lines separated by "\n" or
+//  "\r\n", of which the first is the line at index first_row.
+typedef struct {
+  // the text of the piece, [start, end).
+  const char *start;
+  const char *end;
+  int first_row;
+} SearchPiece;
+
+// a growable array of pieces, in file order.
+typedef struct {
+  SearchPiece *items;
+  int size;
+  int capacity;
+} PieceList;
+
+// a growable array of matches, in file order.
+typedef struct {
+  SearchResult *items;
+  int size;
+  int capacity;
+} MatchList;
+
+// the matches of a query.
+typedef struct {
+  // the query searched for, of query_size bytes.
+  char *query;
+  int query_size;
+  // if is_regex, the query is a regular expression, compiled into regex,
+  //  or if it isn't valid, NULL, and error says why.
+  bool is_regex;
+  Regex *regex;
+  const char *error;
+  // the query as prepared for searching, or for a regular expression, the
+  //  bytes each of its matches holds (see RE_Literal).
+  SSPattern pattern;
+  // the matches found.
+  MatchList matches;
+  // if has_lines, the runs of lines with matches, followed by the pieces
+  //  of the text not searched when the search stopped. a longer query
+  //  starting with this one can only match there.
+  PieceList lines;
+  bool has_lines;
+  // true if the search stopped at SEARCH_MAX_MATCHES matches.
+  bool is_capped;
+} SearchSet;
+
+// consecutive pieces of scan, [first_piece, end_piece), searched by one
+//  worker in one go, and what was found in them.
+typedef struct {
+  int first_piece;
+  int end_piece;
+  // the matches in the pieces, and the runs of lines they are on. only
+  //  read by other threads once is_done.
+  MatchList matches;
+  PieceList lines;
+  // set under lock once the pieces are searched.
+  bool is_done;
+} SearchChunk;
+
+// a thread searching chunks.
+typedef struct {
+  // the chunks left to the worker, as positions [next, end) in the order
+  //  the chunks are visited (see Search_ChunkAt). a worker out of chunks
+  //  takes the back half of the most left to another. set under lock.
+  int next;
+  int end;
+  pthread_t thread;
+  bool on_thread;
+  // the DFAs the worker builds for a regular expression, or NULL.
+  REMatcher *matcher;
+} SearchWorker;
+
+// the states of the last search.
+typedef enum {
+  // no query was searched for.
+  SEARCH_NONE,
+  // the workers are finding the matches.
+  SEARCH_RUNNING,
+  // all the matches are found.
+  SEARCH_DONE
+} SearchState_t;
+
+// the text of the lines as it was when first searched, in pieces, with a
+//  copy of the edited lines. kept for the next searches until an edit.
+static PieceList text = {NULL, 0, 0};
+static char *text_copy = NULL;
+static bool has_text = false;
+
+// the last search done.
+static SearchSet kept;
+// the search being done, over the pieces in scan, split into chunks.
+static SearchSet pending;
+static PieceList scan = {NULL, 0, 0};
+static SearchChunk *chunks = NULL;
+static int num_chunks = 0;
+static SearchState_t state = SEARCH_NONE;
+// the chunk visited first, and whether the chunks are visited backwards
+//  from it rather than forwards.
+static int first_chunk;
+static bool is_backward;
+// the threads searching the chunks.
+static SearchWorker workers[SEARCH_MAX_WORKERS];
+static int num_workers = 0;
+// where the match found first is looked for from, and which way (see
+//  Search_Start).
+static int near_row;
+static int near_col;
+static int near_direction;
+// guards the fields below, the workers' chunks left, and whether each
+//  chunk is done: whether the workers were asked to stop, the number of
+//  them still running, the number of matches in the chunks done, and
+//  whether the match looked for first was found.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool is_cancelled;
+static int num_running;
+static int num_found;
+static bool is_near_found;
+// written to by the workers to wake the event loop, which reads from it.
+static int wake_pipe[2] = {-1, -1};
+// called from the event loop when the workers have news.
+static LoopFn progress_fn = NULL;
+static void *progress_arg = NULL;
+
+// Makes room in list for num more matches. Calls quit on allocation
+//  failure.
+static void Search_GrowMatches(MatchList *list, int num) {
+  if (list->size + num <= list->capacity) {
+    return;
+  }
+  int capacity = (list->capacity == 0) ? SEARCH_MIN_ITEMS : list->capacity;
+  while (capacity < list->size + num) {
+    capacity *= 2;
+  }
+  SearchResult *grown = realloc(list->items, capacity * sizeof(*grown));
+  if (grown == NULL) {
+    quit("Search_GrowMatches");
+  }
+  list->items = grown;
+  list->capacity = capacity;
+}
+
+// Appends the match of size raw characters at raw column col of the line
+//  at index row to list. Calls quit on allocation failure.
+static void Search_AddMatch(MatchList *list, int row, int col, int size) {
+  Search_GrowMatches(list, 1);
+  list->items[list->size++] = (SearchResult) {row, col, size};
+}
+
+// Appends the num pieces at pieces to list. Calls quit on allocation
+//  failure.
+static void Search_AddPieces(PieceList *list, const SearchPiece *pieces,
+                             int num) {
+  if (list->size + num > list->capacity) {
+    int capacity = (list->capacity == 0) ? SEARCH_MIN_ITEMS
+                                         : list->capacity;
+    while (capacity < list->size + num) {
+      capacity *= 2;
+    }
+    SearchPiece *grown = realloc(list->items, capacity * sizeof(*grown));
+    if (grown == NULL) {
+      quit("Search_AddPieces");
+    }
+    list->items = grown;
+    list->capacity = capacity;
+  }
+  if (num > 0) {
+    memcpy(&(list->items[list->size]), pieces, num * sizeof(*pieces));
+  }
+  list->size += num;
+}
+
+// Frees the pieces of list and empties it.
+static void Search_FreePieces(PieceList *list) {
+  free(list->items);
+  *list = (PieceList) {NULL, 0, 0};
+}
+
+// Frees the query, matches and lines of set, and empties it.
+static void Search_FreeSet(SearchSet *set) {
+  free(set->query);
+  RE_Free(set->regex);
+  free(set->matches.items);
+  Search_FreePieces(&(set->lines));
+  *set = (SearchSet) {0};
+}
+
+// Appends to matches the matches of pattern in the text [start, end),
+//  whose first line is the line at index row, and to lines, unless it is
+//  NULL, the runs of lines they are on.
+static void Search_ScanText(const SSPattern *pattern, const char *start,
+                            const char *end, int row, MatchList *matches,
+                            PieceList *lines) {
+  // the start of the line holding pos.
+  const char *line = start;
+  const char *pos = start;
+  // the row of the last line added to lines, or none yet, so the first
+  //  line added can't be joined to the run before.
+  int last_row = -2;
+  while (end - pos >= pattern->size) {
+    const char *hit = SS_Find(pattern, pos, end - pos);
+    if (hit == NULL) {
+      break;
+    }
+    // count the lines up to the one holding the match.
+    const char *newline;
+    while ((newline = memchr(line, '\n', hit - line)) != NULL) {
+      line = newline + 1;
+      row++;
+    }
+    Search_AddMatch(matches, row, hit - line, pattern->size);
+    pos = hit + pattern->size;
+    if (lines == NULL || row == last_row) {
+      continue;
+    }
+
+    // add the line, without its newline, joining it to the run of lines
+    //  added last if it comes right after them.
+    newline = memchr(pos, '\n', end - pos);
+    const char *line_end = (newline == NULL) ? end : newline;
+    if (newline != NULL && line_end > pos && line_end[-1] == '\r') {
+      line_end--;
+    }
+    if (row == last_row + 1) {
+      lines->items[lines->size - 1].end = line_end;
+    } else {
+      SearchPiece piece = {line, line_end, row};
+      Search_AddPieces(lines, &piece, 1);
+    }
+    last_row = row;
+  }
+}
+
+// Appends to matches the matches of the regular expression of set in the
+//  text [start, end), whose first line is the line at index row, found
+//  with matcher. Only the lines holding the bytes every match holds are
+//  matched, and those are skipped to with SS_Find.
+static void Search_ScanRegex(const SearchSet *set, REMatcher *matcher,
+                             const char *start, const char *end, int row,
+                             MatchList *matches) {
+  const char *line = start;
+  while (true) {
+    // where the newline ending the line is looked for from.
+    const char *pos = line;
+    if (set->pattern.size > 0) {
+      pos = SS_Find(&(set->pattern), line, end - line);
+      if (pos == NULL) {
+        break;
+      }
+      const char *newline;
+      while ((newline = memchr(line, '\n', pos - line)) != NULL) {
+        line = newline + 1;
+        row++;
+      }
+    }
+    const char *newline = memchr(pos, '\n', end - pos);
+    const char *line_end = (newline == NULL) ? end : newline;
+    if (newline != NULL && line_end > line && line_end[-1] == '\r') {
+      line_end--;
+    }
+    RE_SetLine(matcher, line, line_end - line);
+    int col;
+    int size;
+    while (RE_NextMatch(matcher, &col, &size)) {
+      Search_AddMatch(matches, row, col, size);
+    }
+    if (newline == NULL) {
+      break;
+    }
+    line = newline + 1;
+    row++;
+  }
+}
+
+// Appends to matches the matches of set in the text [start, end), as
+//  Search_ScanText or Search_ScanRegex does, with matcher for a regular
+//  expression. The runs of lines with matches are only kept for a query
+//  that isn't one, so lines is NULL otherwise.
+static void Search_ScanSet(const SearchSet *set, REMatcher *matcher,
+                           const char *start, const char *end, int row,
+                           MatchList *matches, PieceList *lines) {
+  if (set->regex != NULL) {
+    Search_ScanRegex(set, matcher, start, end, row, matches);
+  } else {
+    Search_ScanText(&(set->pattern), start, end, row, matches, lines);
+  }
+}
+
+// Returns the index of the first of the matches of list at or after raw
+//  column col of the line at index row, or the size of list if there is
+//  none.
+static int Search_LowerBound(const MatchList *list, int row, int col) {
+  int low = 0;
+  int high = list->size;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    const SearchResult *match = &(list->items[mid]);
+    if (match->cur_row < row ||
+        (match->cur_row == row && match->cur_col < col)) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// Returns the index of the chunk holding the line at index row, or at
+//  least the last one starting before it (or the first chunk, if none
+//  does).
+static int Search_ChunkOf(int row) {
+  int low = 0;
+  int high = num_chunks;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (scan.items[chunks[mid].first_piece].first_row <= row) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return (low == 0) ? 0 : low - 1;
+}
+
+// Returns the index of the chunk at position pos in the order the chunks
+//  are visited: outward from first_chunk, wrapping around at the end.
+static int Search_ChunkAt(int pos) {
+  return is_backward ? (first_chunk + num_chunks - pos) % num_chunks
+                     : (first_chunk + pos) % num_chunks;
+}
+
+// Returns the index of the next chunk for worker self to search, or -1
+//  if there are none left, or the workers are to stop. A worker out of
+//  chunks takes the back half of those left to the worker with the most.
+static int Search_TakeChunk(int self) {
+  SearchWorker *worker = &(workers[self]);
+  int idx = -1;
+  pthread_mutex_lock(&lock);
+  if (!is_cancelled && num_found < SEARCH_MAX_MATCHES) {
+    if (worker->next == worker->end) {
+      SearchWorker *victim = worker;
+      for (int i = 0; i < num_workers; i++) {
+        if (workers[i].end - workers[i].next >
+            victim->end - victim->next) {
+          victim = &(workers[i]);
+        }
+      }
+      int num_taken = (victim->end - victim->next + 1) / 2;
+      worker->next = victim->end - num_taken;
+      worker->end = victim->end;
+      victim->end = worker->next;
+    }
+    if (worker->next < worker->end) {
+      idx = Search_ChunkAt(worker->next++);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return idx;
+}
+
+// Wakes the event loop to take in the workers' news.
+static void Search_Wake(void) {
+  // the pipe may be full, which already wakes the loop.
+  ssize_t res = write(wake_pipe[1], "", 1);
+  (void) res;
+}
+
+// Searches the chunks for worker self until none are left. Wakes the
+//  event loop every so often if on a worker thread, and as soon as a
+//  chunk with matches is done while the match looked for first is not
+//  found.
+static void Search_Work(int self, bool on_worker) {
+  long long reported = Loop_Now();
+  int idx;
+  while ((idx = Search_TakeChunk(self)) != -1) {
+    SearchChunk *chunk = &(chunks[idx]);
+    for (int i = chunk->first_piece; i < chunk->end_piece; i++) {
+      const SearchPiece *piece = &(scan.items[i]);
+      Search_ScanSet(&pending, workers[self].matcher, piece->start,
+                     piece->end, piece->first_row, &(chunk->matches),
+                     pending.has_lines ? &(chunk->lines) : NULL);
+    }
+    pthread_mutex_lock(&lock);
+    chunk->is_done = true;
+    num_found += chunk->matches.size;
+    bool is_news = !is_near_found && chunk->matches.size > 0;
+    pthread_mutex_unlock(&lock);
+    if (on_worker &&
+        (is_news || Loop_Now() - reported >= SEARCH_PROGRESS_MS)) {
+      Search_Wake();
+      reported = Loop_Now();
+    }
+  }
+}
+
+// The start routine of a worker thread, whose SearchWorker is arg.
+static void *Search_Worker(void *arg) {
+  Search_Work((SearchWorker *) arg - workers, true);
+  pthread_mutex_lock(&lock);
+  bool is_last = (--num_running == 0);
+  pthread_mutex_unlock(&lock);
+  if (is_last) {
+    Search_Wake();
+  }
+  return NULL;
+}
+
+// Splits scan into chunks of at least SEARCH_CHUNK_MIN bytes. Calls quit
+//  on allocation failure.
+static void Search_MakeChunks(void) {
+  int capacity = 0;
+  long size = 0;
+  for (int i = 0; i < scan.size; i++) {
+    if (size == 0) {
+      if (num_chunks == capacity) {
+        capacity = (capacity == 0) ? SEARCH_MIN_ITEMS : capacity * 2;
+        SearchChunk *grown = realloc(chunks, capacity * sizeof(*grown));
+        if (grown == NULL) {
+          quit("Search_MakeChunks");
+        }
+        chunks = grown;
+      }
+      chunks[num_chunks++] = (SearchChunk) {0};
+      chunks[num_chunks - 1].first_piece = i;
+    }
+    size += scan.items[i].end - scan.items[i].start;
+    chunks[num_chunks - 1].end_piece = i + 1;
+    if (size >= SEARCH_CHUNK_MIN) {
+      size = 0;
+    }
+  }
+}
+
+// Frees the chunks and what was found in them.
+static void Search_FreeChunks(void) {
+  for (int i = 0; i < num_chunks; i++) {
+    free(chunks[i].matches.items);
+    free(chunks[i].lines.items);
+  }
+  free(chunks);
+  chunks = NULL;
+  num_chunks = 0;
+}
+
+// Gathers what was found in the chunks into the pending search, in file
+//  order: the matches up to the first chunk not searched, and the runs
+//  of lines with matches, with the pieces of the chunks not searched in
+//  their place. Then frees the chunks.
+static void Search_Merge(void) {
+  int num_matches = 0;
+  for (int i = 0; i < num_chunks && chunks[i].is_done; i++) {
+    num_matches += chunks[i].matches.size;
+  }
+  Search_GrowMatches(&(pending.matches), num_matches);
+  for (int i = 0; i < num_chunks; i++) {
+    SearchChunk *chunk = &(chunks[i]);
+    if (!chunk->is_done) {
+      // the search stopped before all of the text was searched.
+      pending.is_capped = true;
+    } else if (!pending.is_capped && chunk->matches.size > 0) {
+      memcpy(&(pending.matches.items[pending.matches.size]),
+             chunk->matches.items,
+             chunk->matches.size * sizeof(*(chunk->matches.items)));
+      pending.matches.size += chunk->matches.size;
+    }
+    if (!pending.has_lines) {
+      continue;
+    }
+    if (chunk->is_done) {
+      Search_AddPieces(&(pending.lines), chunk->lines.items,
+                       chunk->lines.size);
+    } else {
+      Search_AddPieces(&(pending.lines), &(scan.items[chunk->first_piece]),
+                       chunk->end_piece - chunk->first_piece);
+    }
+    if (pending.lines.size > SEARCH_MAX_LINES) {
+      Search_FreePieces(&(pending.lines));
+      pending.has_lines = false;
+    }
+  }
+  Search_FreeChunks();
+}
+
+// Waits until the worker threads have ended.
+static void Search_JoinWorkers(void) {
+  for (int i = 0; i < num_workers; i++) {
+    if (workers[i].on_thread) {
+      pthread_join(workers[i].thread, NULL);
+    }
+    RE_FreeMatcher(workers[i].matcher);
+    workers[i].matcher = NULL;
+  }
+  num_workers = 0;
+}
+
+// Asks the workers to stop, waits until they have, and gathers what they
+//  found (see Search_Merge).
+static void Search_Cancel(void) {
+  pthread_mutex_lock(&lock);
+  is_cancelled = true;
+  pthread_mutex_unlock(&lock);
+  Search_JoinWorkers();
+  Search_Merge();
+}
+
+// Makes the pending search, whose chunks are merged, the last one done.
+static void Search_Finish(void) {
+  Search_FreeSet(&kept);
+  kept = pending;
+  pending = (SearchSet) {0};
+  Search_FreePieces(&scan);
+  state = SEARCH_DONE;
+}
+
+// Takes in the news of the workers. Called by the event loop when a
+//  worker writes to the wake pipe.
+static void Search_OnWake(void *arg) {
+  (void) arg;
+  char buf[64];
+  while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {
+    // drain the pipe; one wake up is enough for all writes.
+  }
+  if (state == SEARCH_RUNNING) {
+    pthread_mutex_lock(&lock);
+    bool is_finished = (num_running == 0);
+    pthread_mutex_unlock(&lock);
+    if (is_finished) {
+      Search_JoinWorkers();
+      Search_Merge();
+      Search_Finish();
+    }
+  }
+  if (progress_fn != NULL) {
+    progress_fn(progress_arg);
+  }
+}
+
+// Creates the wake pipe and has the event loop watch it, if that isn't
+//  done yet. Both ends are non-blocking, so a worker never blocks on a
+//  full pipe and the loop never blocks draining it.
+static void Search_OpenWakePipe(void) {
+  if (wake_pipe[0] != -1) {
+    return;
+  }
+  if (pipe(wake_pipe) == -1) {
+    quit("Search_OpenWakePipe");
+  }
+  for (int i = 0; i < 2; i++) {
+    int flags = fcntl(wake_pipe[i], F_GETFL);
+    if (flags == -1 ||
+        fcntl(wake_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1 ||
+        fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC) == -1) {
+      quit("Search_OpenWakePipe");
+    }
+  }
+  Loop_WatchFd(wake_pipe[0], Search_OnWake, NULL);
+}
+
+// Returns the number of threads to search num chunks on.
+static int Search_NumWorkers(int num) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cpus > 0 && num > num_cpus) {
+    num = num_cpus;
+  }
+  if (num > SEARCH_MAX_WORKERS) {
+    num = SEARCH_MAX_WORKERS;
+  }
+  return (num < 1) ? 1 : num;
+}
+
+// Searches the chunks of scan for the pending search, on worker threads
+//  if use_threads, and otherwise (or if none could be started) right
+//  away.
+static void Search_Run(bool use_threads) {
+  Search_MakeChunks();
+  first_chunk = (num_chunks == 0) ? 0 : Search_ChunkOf(near_row);
+  is_backward = (near_direction < 0);
+  is_cancelled = false;
+  num_found = 0;
+  // share the chunks out evenly, in the order they are visited.
+  num_workers = use_threads ? Search_NumWorkers(num_chunks) : 1;
+  for (int i = 0; i < num_workers; i++) {
+    workers[i].next = num_chunks * i / num_workers;
+    workers[i].end = num_chunks * (i + 1) / num_workers;
+    workers[i].on_thread = false;
+    workers[i].matcher = (pending.regex == NULL) ? NULL
+                                                 : RE_NewMatcher(pending.regex);
+  }
+  num_running = 0;
+  if (use_threads) {
+    Search_OpenWakePipe();
+    int num_started = 0;
+    for (int i = 0; i < num_workers; i++) {
+      // count the worker as running first, as it may end right away.
+      pthread_mutex_lock(&lock);
+      num_running++;
+      pthread_mutex_unlock(&lock);
+      workers[i].on_thread = pthread_create(&(workers[i].thread), NULL,
+                                            Search_Worker,
+                                            &(workers[i])) == 0;
+      if (workers[i].on_thread) {
+        num_started++;
+      } else {
+        // the chunks left to it are taken by the others.
+        pthread_mutex_lock(&lock);
+        num_running--;
+        pthread_mutex_unlock(&lock);
+      }
+    }
+    if (num_started > 0) {
+      state = SEARCH_RUNNING;
+      return;
+    }
+    // no thread could be started, so search here.
+  }
+  Search_Work(0, false);
+  Search_JoinWorkers();
+  Search_Merge();
+  Search_Finish();
+}
+
+// the state of a walk taking the text of the lines.
+typedef struct {
+  // the index of the next line taken.
+  int row;
+  // where the next edited line is copied to in text_copy, or NULL on the
+  //  first walk, which only counts the size of the copy.
+  char *copy_end;
+  long copy_size;
+} TextWalk;
+
+// Adds the num_lines lines of [start, end) to the text, extending the
+//  last piece if its text is followed by just a newline.
+static void Search_TakeText(TextWalk *walk, const char *start,
+                            const char *end, int num_lines) {
+  SearchPiece *last = (text.size > 0) ? &(text.items[text.size - 1]) : NULL;
+  if (last != NULL &&
+      last->end - last->start + (end - start) <= SEARCH_PIECE_MAX &&
+      ((start == last->end + 1 && last->end[0] == '\n') ||
+       (start == last->end + 2 && last->end[0] == '\r' &&
+        last->end[1] == '\n'))) {
+    last->end = end;
+  } else {
+    SearchPiece piece = {start, end, walk->row};
+    Search_AddPieces(&text, &piece, 1);
+  }
+  walk->row += num_lines;
+}
+
+// Adds a loaded line to the text, copying it if it was edited. Called by
+//  LT_WalkRuns.
+static bool Search_TakeLine(FileLine *f_line, void *arg) {
+  TextWalk *walk = arg;
+  if (walk->copy_end == NULL) {
+    if (f_line->is_owned) {
+      walk->copy_size += f_line->size + 1;
+    }
+  } else if (f_line->is_owned) {
+    // a newline before each line copied lets the lines copied one after
+    //  the other be joined into one piece.
+    *(walk->copy_end)++ = '\n';
+    memcpy(walk->copy_end, File_LineText(f_line), f_line->size);
+    Search_TakeText(walk, walk->copy_end, walk->copy_end + f_line->size, 1);
+    walk->copy_end += f_line->size;
+  } else {
+    Search_TakeText(walk, f_line->line, f_line->line + f_line->size, 1);
+  }
+  return true;
+}
+
+// Adds the lines of a run to the text. Called by LT_WalkRuns.
+static bool Search_TakeRun(const char *start, const char *end,
+                           int num_lines, void *arg) {
+  TextWalk *walk = arg;
+  if (walk->copy_end == NULL) {
+    return true;
+  }
+  // leave out the newline after the last line, so the next line can be
+  //  joined to the run like to any other.
+  if (end > start && end[-1] == '\n') {
+    end--;
+    if (end > start && end[-1] == '\r') {
+      end--;
+    }
+  }
+  Search_TakeText(walk, start, end, num_lines);
+  return true;
+}
+
+// Takes the text of the lines of f_lines as it is now, unless it was
+//  taken since the last edit. The edited lines are counted first, so
+//  their copy is allocated once and doesn't move as it is filled in.
+//  Calls quit on allocation failure.
+static void Search_TakeLines(FileLines *f_lines) {
+  if (has_text) {
+    return;
+  }
+  TextWalk walk = {0, NULL, 0};
+  LT_WalkRuns(f_lines, Search_TakeLine, Search_TakeRun, &walk);
+  text_copy = malloc(walk.copy_size + 1);
+  if (text_copy == NULL) {
+    quit("Search_TakeLines");
+  }
+  walk.copy_end = text_copy;
+  LT_WalkRuns(f_lines, Search_TakeLine, Search_TakeRun, &walk);
+  has_text = true;
+}
+
+// Drops the text taken, and the lines of the last search, which are in
+//  it.
+static void Search_DropText(void) {
+  Search_FreePieces(&text);
+  free(text_copy);
+  text_copy = NULL;
+  has_text = false;
+  Search_FreePieces(&(kept.lines));
+  kept.has_lines = false;
+}
+
+// Returns true if set is the search for query, as a regular expression
+//  if is_regex.
+static bool Search_IsSame(const SearchSet *set, const char *query,
+                          bool is_regex) {
+  return set->is_regex == is_regex && strcmp(query, set->query) == 0;
+}
+
+// Returns true if the query of size bytes is longer than the query of
+//  set and starts with it, and set kept its lines, so the matches of the
+//  query are all on those lines. Regular expressions are never narrowed
+//  down, so set doesn't keep its lines for one.
+static bool Search_Narrows(const char *query, int size, bool is_regex,
+                           const SearchSet *set) {
+  return !is_regex && set->has_lines && size > set->query_size &&
+         memcmp(query, set->query, set->query_size) == 0;
+}
+
+void Search_Start(FileLines *f_lines, const char *query, bool is_regex,
+                  int row, int col, int direction) {
+  pthread_mutex_lock(&lock);
+  near_row = row;
+  near_col = col;
+  near_direction = direction;
+  is_near_found = false;
+  pthread_mutex_unlock(&lock);
+  SearchSet *current = (state == SEARCH_RUNNING) ? &pending : &kept;
+  if (state != SEARCH_NONE && Search_IsSame(current, query, is_regex)) {
+    return;
+  }
+  int size = strlen(query);
+  bool is_narrowed = false;
+  if (state == SEARCH_RUNNING) {
+    Search_Cancel();
+    Search_FreePieces(&scan);
+    if (Search_Narrows(query, size, is_regex, &pending)) {
+      // go on from the lines the workers found matches on, and the
+      //  pieces they didn't get to.
+      scan = pending.lines;
+      pending.lines = (PieceList) {NULL, 0, 0};
+      is_narrowed = true;
+    }
+    Search_FreeSet(&pending);
+    state = (kept.query == NULL) ? SEARCH_NONE : SEARCH_DONE;
+    if (state == SEARCH_DONE && Search_IsSame(&kept, query, is_regex)) {
+      // back to the query of the last search done, e.g., after deleting
+      //  the characters typed since.
+      Search_FreePieces(&scan);
+      return;
+    }
+  }
+  if (!is_narrowed && Search_Narrows(query, size, is_regex, &kept)) {
+    Search_AddPieces(&scan, kept.lines.items, kept.lines.size);
+    is_narrowed = true;
+  }
+
+  pending.query_size = size;
+  pending.query = malloc(size + 1);
+  if (pending.query == NULL) {
+    quit("Search_Start");
+  }
+  memcpy(pending.query, query, size + 1);
+  pending.is_regex = is_regex;
+  if (is_regex && size > 0) {
+    pending.regex = RE_Compile(query, &(pending.error));
+  }
+  if (pending.regex != NULL) {
+    int literal_size;
+    const char *literal = RE_Literal(pending.regex, &literal_size);
+    SS_Prepare(&(pending.pattern), literal, literal_size);
+  } else {
+    SS_Prepare(&(pending.pattern), pending.query, size);
+  }
+  if (f_lines == NULL || size == 0 || pending.error != NULL) {
+    Search_Finish();
+    return;
+  }
+  pending.has_lines = !is_regex;
+  if (!is_narrowed) {
+    Search_TakeLines(f_lines);
+    Search_AddPieces(&scan, text.items, text.size);
+  }
+
+  long scan_size = 0;
+  for (int i = 0; i < scan.size; i++) {
+    scan_size += scan.items[i].end - scan.items[i].start;
+  }
+  Search_Run(scan_size >= SEARCH_WORKER_MIN);
+}
+
+void Search_OnProgress(LoopFn fn, void *arg) {
+  progress_fn = fn;
+  progress_arg = arg;
+}
+
+const char *Search_Query(void) {
+  SearchSet *current = (state == SEARCH_RUNNING) ? &pending : &kept;
+  return (current->query_size > 0) ? current->query : NULL;
+}
+
+bool Search_IsDone(void) {
+  return state == SEARCH_DONE;
+}
+
+bool Search_IsCapped(void) {
+  return state == SEARCH_DONE && kept.is_capped;
+}
+
+int Search_NumMatches(void) {
+  if (state != SEARCH_RUNNING) {
+    return kept.matches.size;
+  }
+  pthread_mutex_lock(&lock);
+  int found = num_found;
+  pthread_mutex_unlock(&lock);
+  return found;
+}
+
+const char *Search_Error(void) {
+  return (state == SEARCH_RUNNING) ? pending.error : kept.error;
+}
+
+const SearchResult *Search_GetMatch(int idx) {
+  return &(kept.matches.items[idx]);
+}
+
+int Search_FindNext(int row, int col) {
+  if (kept.matches.size == 0) {
+    return -1;
+  }
+  int idx = Search_LowerBound(&(kept.matches), row, col);
+  // past the last match, wrap around to the first.
+  return (idx == kept.matches.size) ? 0 : idx;
+}
+
+bool Search_FindNear(SearchResult *match) {
+  if (state != SEARCH_RUNNING || num_chunks == 0) {
+    return false;
+  }
+  // walk the chunks outward from the one holding the place looked from,
+  //  and back into it after wrapping around, while they are done.
+  int home = Search_ChunkOf(near_row);
+  const SearchResult *found = NULL;
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i <= num_chunks && found == NULL; i++) {
+    const SearchChunk *chunk = (near_direction < 0) ?
+        &(chunks[(home + num_chunks - i) % num_chunks]) :
+        &(chunks[(home + i) % num_chunks]);
+    if (!chunk->is_done) {
+      break;
+    }
+    const MatchList *list = &(chunk->matches);
+    if (list->size == 0) {
+      continue;
+    }
+    if (near_direction < 0) {
+      // the last match before the place, or the last one of the chunk.
+      int idx = (i == 0) ? Search_LowerBound(list, near_row, near_col)
+                         : list->size;
+      found = (idx > 0) ? &(list->items[idx - 1]) : NULL;
+    } else {
+      // the first match at (or after, if direction is 1) the place, or
+      //  the first one of the chunk.
+      int idx = (i == 0) ? Search_LowerBound(list, near_row,
+                                             near_col + near_direction)
+                         : 0;
+      found = (idx < list->size) ? &(list->items[idx]) : NULL;
+    }
+  }
+  if (found != NULL) {
+    *match = *found;
+    is_near_found = true;
+  }
+  pthread_mutex_unlock(&lock);
+  return found != NULL;
+}
+
+void Search_Edited(FileLines *f_lines, int row, int num_removed,
+                   int num_added) {
+  if (state == SEARCH_RUNNING) {
+    // the workers are searching text that has changed, so the search is
+    //  dropped, and the last one done is updated instead.
+    Search_Cancel();
+    Search_FreePieces(&scan);
+    Search_FreeSet(&pending);
+    state = (kept.query == NULL) ? SEARCH_NONE : SEARCH_DONE;
+  }
+  Search_DropText();
+  if (state == SEARCH_NONE || kept.query_size == 0 || kept.error != NULL) {
+    return;
+  }
+  // the matches on the lines replaced are [first, last).
+  MatchList *matches = &(kept.matches);
+  int first = Search_LowerBound(matches, row, 0);
+  int last = Search_LowerBound(matches, row + num_removed, 0);
+  MatchList added = {NULL, 0, 0};
+  REMatcher *matcher = (kept.regex == NULL) ? NULL
+                                            : RE_NewMatcher(kept.regex);
+  for (int i = row; i < row + num_added; i++) {
+    FileLine *f_line = File_GetLine(f_lines, i);
+    const char *line = File_LineText(f_line);
+    Search_ScanSet(&kept, matcher, line, line + f_line->size, i, &added,
+                   NULL);
+  }
+  RE_FreeMatcher(matcher);
+
+  // splice the matches of the added lines in place of the ones removed,
+  //  moving the rows of those below by the number of lines added.
+  int num_below = matches->size - last;
+  int new_size = first + added.size + num_below;
+  Search_GrowMatches(matches, new_size - matches->size);
+  SearchResult *below = &(matches->items[first + added.size]);
+  memmove(below, &(matches->items[last]), num_below * sizeof(*below));
+  if (num_added != num_removed) {
+    for (int i = 0; i < num_below; i++) {
+      below[i].cur_row += num_added - num_removed;
+    }
+  }
+  if (added.size > 0) {
+    memcpy(&(matches->items[first]), added.items,
+           added.size * sizeof(*below));
+  }
+  matches->size = new_size;
+  free(added.items);
+}
+
+void Search_Clear(void) {
+  if (state == SEARCH_RUNNING) {
+    Search_Cancel();
+  }
+  Search_FreeSet(&pending);
+  Search_FreePieces(&scan);
+  Search_FreeSet(&kept);
+  Search_DropText();
+  state = SEARCH_NONE;
+}
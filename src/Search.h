@@ -0,0 +1,107 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+// Finds every match of a query in the open file at once, in file order,
+//  so the matches can be counted and stepped through in O(1). Matches
+//  don't overlap: each is looked for after the end of the one before.
+//  The query is matched against the raw text of the lines (see
+//  StrScan.h), so it may hold tabs, and columns are raw ones.
+//
+// The text is taken as it is at the start of a search. The lines that
+//  were never edited are read where they lie in the memory-mapped file,
+//  which doesn't change, and only the edited lines are copied, so a large
+//  file is searched on worker threads while the editor goes on reading
+//  keys. The text is split into chunks of about a megabyte, which the
+//  workers take in turn, each from a share of its own and then from the
+//  others' shares, and the matches of the chunks are put together in
+//  file order once all are searched. The chunks are taken outward from
+//  the cursor, so the match it jumps to is found before the others (see
+//  Search_FindNear). Once all the matches are found, they are kept until
+//  another query is searched for, and edits rescan only the lines they
+//  changed.
+//
+// A query may also be a regular expression (see Regex.h), whose matches
+//  vary in size. Only the lines holding the bytes all its matches hold
+//  are matched against it, skipping to them as to a plain query, and
+//  each worker builds its own DFAs.
+//
+// As a query is typed, each longer query only matches on the lines the
+//  shorter one did, so the lines with matches are kept along with them,
+//  and the next search is narrowed down to those. The text taken is kept
+//  as well until an edit, so a query that isn't longer doesn't take it
+//  again. A search stops past a number of matches, so a short query on a
+//  huge file doesn't take up all the memory (see Search_IsCapped).
+
+#include <stdbool.h>
+
+#include "EventLoop.h"  // for LoopFn
+#include "FileParser.h"  // for FileLines and SearchResult
+
+// Searches the lines of f_lines for the null-terminated query, as a
+//  regular expression if is_regex, dropping the matches of the last
+//  search once it is done. Does nothing if the matches of query are kept
+//  already, or being found. If query extends the query of the last
+//  search, or of the one running, and neither is a regular expression,
+//  only the lines that one matched on are searched. A regular expression
+//  that isn't valid has no matches (see Search_Error). Text too large to
+//  search right away is searched on worker threads (see
+//  Search_OnProgress), starting from raw column col of the line at index
+//  row and going forward, or backward if direction is -1, to find first
+//  the match near it (see Search_FindNear). Calls quit on allocation
+//  failure.
+void Search_Start(FileLines *f_lines, const char *query, bool is_regex,
+                  int row, int col, int direction);
+
+// Calls fn with arg from the event loop each time a search on worker
+//  threads has found more matches for a while, may have found the match
+//  near where it started, and once it is done.
+void Search_OnProgress(LoopFn fn, void *arg);
+
+// Returns the query of the last search, or NULL if there was none, or
+//  it was empty. Only valid until the next search is started.
+const char *Search_Query(void);
+
+// Returns true if all the matches of the last search have been found.
+bool Search_IsDone(void);
+
+// Returns true if the last search is done, but stopped before the end of
+//  the text as it found too many matches.
+bool Search_IsCapped(void);
+
+// Returns the number of matches of the last search found so far.
+int Search_NumMatches(void);
+
+// Returns why the query of the last search can't be searched for, if
+//  it's a regular expression that isn't valid, or NULL.
+const char *Search_Error(void);
+
+// Returns the match at index idx, in file order, of the last search,
+//  which must be done.
+const SearchResult *Search_GetMatch(int idx);
+
+// Returns the index of the first match of the last search, which must be
+//  done, at or after raw column col of the line at index row, or of the
+//  first match if there is none after it. Returns -1 if there are no
+//  matches. Costs O(log n).
+int Search_FindNext(int row, int col);
+
+// Sets match to the match near where the search running started (see
+//  Search_Start), once all the text up to it has been searched: the first
+//  match at raw column col or after it, if direction is 0, the first one
+//  after it, if 1, or the last one before it, if -1, wrapping around at
+//  the end or start of the file. Returns false if it isn't known yet, or
+//  no search is running.
+bool Search_FindNear(SearchResult *match);
+
+// Updates the matches of the last search after the num_removed lines of
+//  f_lines from index row were replaced by the num_added lines there now.
+//  Only the added lines are searched, and the matches below are moved.
+//  A search still running is stopped and dropped, as its text is out of
+//  date, and the last search done before it is updated instead.
+void Search_Edited(FileLines *f_lines, int row, int num_removed,
+                   int num_added);
+
+// Stops the search running, if any, and drops the matches kept.
+void Search_Clear(void);
+
+#endif  // SEARCH_H_
@@ -0,0 +1,173 @@
+#include <stddef.h>  // for NULL
+#include <stdint.h>
+#include <string.h>  // for memchr, memcmp
+
+#include "StrScan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SS_X86
+#endif
+
+// a function returning the first match of a pattern of 2 to SS_SHORT_MAX
+//  bytes in the size bytes of text, or NULL.
+typedef const char *(*SSFindFn)(const SSPattern *pattern, const char *text,
+                                long size);
+
+// The SSFindFn used where no vector instructions are available, and for
+//  the text too close to the end for a whole block. Looks for the first
+//  byte of the pattern with memchr, and compares the rest there.
+static const char *SS_FindPlain(const SSPattern *pattern, const char *text,
+                                long size) {
+  const char *bytes = pattern->bytes;
+  int n = pattern->size;
+  // the last position the pattern fits at.
+  const char *last = text + size - n;
+  const char *pos = text;
+  while (pos <= last) {
+    pos = memchr(pos, bytes[0], last - pos + 1);
+    if (pos == NULL) {
+      return NULL;
+    }
+    if (memcmp(pos + 1, bytes + 1, n - 1) == 0) {
+      return pos;
+    }
+    pos++;
+  }
+  return NULL;
+}
+
+#ifdef SS_X86
+// The SSFindFn for CPUs with SSE2, filtering 16 positions at a time.
+__attribute__((target("sse2")))
+static const char *SS_FindSSE2(const SSPattern *pattern, const char *text,
+                               long size) {
+  const char *bytes = pattern->bytes;
+  int n = pattern->size;
+  const __m128i first = _mm_set1_epi8(bytes[0]);
+  const __m128i last = _mm_set1_epi8(bytes[n - 1]);
+  long i = 0;
+  for (; i + n - 1 + 16 <= size; i += 16) {
+    __m128i starts = _mm_loadu_si128((const __m128i *) &(text[i]));
+    __m128i ends = _mm_loadu_si128((const __m128i *) &(text[i + n - 1]));
+    uint32_t mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(starts, first),
+                      _mm_cmpeq_epi8(ends, last)));
+    while (mask != 0) {
+      long pos = i + __builtin_ctz(mask);
+      if (memcmp(&(text[pos + 1]), &(bytes[1]), n - 2) == 0) {
+        return &(text[pos]);
+      }
+      mask &= mask - 1;
+    }
+  }
+  return SS_FindPlain(pattern, &(text[i]), size - i);
+}
+
+// The SSFindFn for CPUs with AVX2, filtering 64 positions at a time.
+__attribute__((target("avx2")))
+static const char *SS_FindAVX2(const SSPattern *pattern, const char *text,
+                               long size) {
+  const char *bytes = pattern->bytes;
+  int n = pattern->size;
+  const __m256i first = _mm256_set1_epi8(bytes[0]);
+  const __m256i last = _mm256_set1_epi8(bytes[n - 1]);
+  long i = 0;
+  for (; i + n - 1 + 64 <= size; i += 64) {
+    const char *block = &(text[i]);
+    __m256i low = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) block),
+                          first),
+        _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) &(block[n - 1])), last));
+    __m256i high = _mm256_and_si256(
+        _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) &(block[32])), first),
+        _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) &(block[32 + n - 1])),
+            last));
+    // most blocks have no candidates, so test both halves at once.
+    if (_mm256_testz_si256(_mm256_or_si256(low, high),
+                           _mm256_set1_epi8(-1))) {
+      continue;
+    }
+    uint64_t mask = (uint64_t) (uint32_t) _mm256_movemask_epi8(high) << 32 |
+                    (uint32_t) _mm256_movemask_epi8(low);
+    while (mask != 0) {
+      long pos = i + __builtin_ctzll(mask);
+      if (memcmp(&(text[pos + 1]), &(bytes[1]), n - 2) == 0) {
+        return &(text[pos]);
+      }
+      mask &= mask - 1;
+    }
+  }
+  return SS_FindPlain(pattern, &(text[i]), size - i);
+}
+#endif
+
+// Returns the best SSFindFn for this CPU.
+static SSFindFn SS_Resolve(void) {
+#ifdef SS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SS_FindAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SS_FindSSE2;
+  }
+#endif
+  return SS_FindPlain;
+}
+
+// the SSFindFn in use, or NULL until SS_Prepare picks it.
+static SSFindFn find_short = NULL;
+
+// Returns the first match of a pattern longer than SS_SHORT_MAX bytes in
+//  the size bytes of text, or NULL. Compares the last byte under the
+//  pattern first, and moves the pattern along by its shift.
+static const char *SS_FindLong(const SSPattern *pattern, const char *text,
+                               long size) {
+  const char *bytes = pattern->bytes;
+  int n = pattern->size;
+  unsigned char last = bytes[n - 1];
+  for (long i = 0; i <= size - n;) {
+    unsigned char c = text[i + n - 1];
+    if (c == last && memcmp(&(text[i]), bytes, n - 1) == 0) {
+      return &(text[i]);
+    }
+    i += pattern->shift[c];
+  }
+  return NULL;
+}
+
+void SS_Prepare(SSPattern *pattern, const char *bytes, int size) {
+  if (find_short == NULL) {
+    find_short = SS_Resolve();
+  }
+  pattern->bytes = bytes;
+  pattern->size = size;
+  // a byte not in the pattern (but for its last byte) lets it move past
+  //  it whole, otherwise just far enough to line up its last copy.
+  for (int c = 0; c < 256; c++) {
+    pattern->shift[c] = size;
+  }
+  for (int i = 0; i < size - 1; i++) {
+    pattern->shift[(unsigned char) bytes[i]] = size - 1 - i;
+  }
+}
+
+const char *SS_Find(const SSPattern *pattern, const char *text, long size) {
+  if (size < pattern->size) {
+    return NULL;
+  }
+  if (pattern->size == 0) {
+    return text;
+  }
+  if (pattern->size == 1) {
+    return memchr(text, pattern->bytes[0], size);
+  }
+  if (pattern->size > SS_SHORT_MAX) {
+    return SS_FindLong(pattern, text, size);
+  }
+  return find_short(pattern, text, size);
+}
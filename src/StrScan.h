@@ -0,0 +1,35 @@
+#ifndef STR_SCAN_H_
+#define STR_SCAN_H_
+
+// Finding a pattern in raw text of a given size, which may hold any
+//  bytes, tabs and null characters included. Patterns up to SS_SHORT_MAX
+//  bytes are looked for with the widest vector instructions the CPU
+//  supports (AVX2 or SSE2 on x86, chosen when first used): a block of
+//  positions is kept as a candidate only if it holds both the first and
+//  the last byte of the pattern at the right distance, so only those few
+//  are compared in full. Longer patterns skip through the text with the
+//  Boyer-Moore-Horspool shift table. Elsewhere, plain C is used.
+
+// the longest pattern found with vector instructions.
+#define SS_SHORT_MAX 32
+
+// a pattern prepared for searching.
+typedef struct {
+  // the pattern, of size bytes. not copied, so it must outlive this.
+  const char *bytes;
+  int size;
+  // how far a long pattern moves along the text when the last byte under
+  //  it is the byte at the index.
+  int shift[256];
+} SSPattern;
+
+// Prepares pattern for finding the size bytes of bytes. Also picks the
+//  instructions used for this CPU on its first call, so it must be
+//  called before SS_Find is from other threads.
+void SS_Prepare(SSPattern *pattern, const char *bytes, int size);
+
+// Returns a pointer to the first match of pattern in the size bytes of
+//  text, or NULL if there is none. An empty pattern matches at text.
+const char *SS_Find(const SSPattern *pattern, const char *text, long size);
+
+#endif  // STR_SCAN_H_
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <ctype.h>  // isspace
+#include <limits.h>  // for INT_MAX
 
 #include "SyntaxHL.h"
 
@@ -21,14 +22,20 @@ Syntax langs[] = {
     "c",
     EXTENSIONS_C,
     "//",
+    "/*",
+    "*/",
     KEYWORDS_C,
-    HIGHLIGHT_NUMBERS | HIGHLIGHT_STRINGS
+    HIGHLIGHT_NUMBERS | HIGHLIGHT_STRINGS,
+    NULL
   }
 };
 
 // the length of the languages array.
 #define NUM_LANGS (sizeof(langs) / sizeof(Syntax))
 
+// the spans made by the last run of the lexer, kept to be reused.
+static HSBuilder lexed = EMPTY_HS_BUILDER;
+
 int File_GetHighlightCode(unsigned char h) {
   switch (h) {
     case HL_NUMBER:
@@ -36,6 +43,7 @@ int File_GetHighlightCode(unsigned char h) {
     case HL_STRING:
       return 35;
     case HL_COMMENT:
+    case HL_MLCOMMENT:
       return 36;
     case HL_KEYWORD1:
       return 32;
@@ -54,136 +62,355 @@ static bool Is_Separator(char c) {
   return isspace(c) || c == '\0' || strchr(",.()+/*=~%<>[];", c) != NULL;
 }
 
-// puts the highlighting codes for the characters in the
-//  given line (length l_size) into the given h_line 
-//  according to the given syntax.
-void Syntax_SetHighlight(Syntax *syntax, char *line,
-                         int l_size, unsigned char **h_line) {
-  // resize the highlight buffer, since line_display may have changed.
-  // the highlight array has the same size as line_display.
-  *h_line = realloc(*h_line, l_size);
-  // set all characters in highlight to default.
-  memset(*h_line, HL_NORMAL, l_size);
+// Returns the length of delim, or 0 if it is NULL.
+static int Delim_Size(const char *delim) {
+  return (delim != NULL) ? strlen(delim) : 0;
+}
 
-  if (syntax == NULL) {
-    // no syntax specified for the file, so return after setting
-    //  all highlighting to default in the memset above.
-    return;
+// Returns true if c is part of either multi-line comment delimiter of
+//  syntax. the lexer consumes a delimiter at once, so it can only be
+//  known to be between characters next to one of these.
+static bool Is_MultiDelimChar(Syntax *syntax, char c) {
+  return c != '\0' &&
+         ((syntax->comment_delim_multi_start != NULL &&
+           strchr(syntax->comment_delim_multi_start, c) != NULL) ||
+          (syntax->comment_delim_multi_end != NULL &&
+           strchr(syntax->comment_delim_multi_end, c) != NULL));
+}
+
+// the state the lexer carries from one character to the next.
+typedef struct {
+  // true if the previous character was a separator, in order to tell
+  //  if the current character is part of a new sequence.
+  bool prev_sep;
+  // true if the current char is part of a string (starts and ends
+  //  with double quotes "")
+  bool in_string;
+  // the current string delimiter (either ' or ", or '\0' if not in a string).
+  char str_delim;
+  // true if the current char is part of a multi-line comment.
+  bool in_comment;
+  // true if the last char was a '\' escaping the end of the line inside
+  //  a string, which then continues on the next line.
+  bool eol_escape;
+} LexState;
+
+// the state at the start of a line, and after any normal separator.
+#define LEX_STATE_INIT ((LexState) {true, false, '\0', false, false})
+
+// Returns the lexer state at the start of a line entered in lex_in.
+static LexState Lex_Enter(unsigned char lex_in) {
+  LexState state = LEX_STATE_INIT;
+  if (lex_in == LEX_COMMENT) {
+    state.in_comment = true;
+  } else if (lex_in == LEX_STRING_DOUBLE || lex_in == LEX_STRING_SINGLE) {
+    state.in_string = true;
+    state.str_delim = (lex_in == LEX_STRING_DOUBLE) ? '"' : '\'';
+  }
+  return state;
+}
+
+// Returns the state the next line is entered in after a line ending in
+//  state.
+static unsigned char Lex_Exit(const LexState *state) {
+  if (state->in_comment) {
+    return LEX_COMMENT;
+  }
+  if (state->in_string && state->eol_escape) {
+    return (state->str_delim == '"') ? LEX_STRING_DOUBLE : LEX_STRING_SINGLE;
   }
+  // anything else, including an unterminated string, ends with the line.
+  return LEX_NORMAL;
+}
 
+// Appends the spans of the highlighting of line (length l_size) from
+//  index start up to limit to lexed, starting in the given state. old
+//  reads the codes the line had before. If stop_after is not negative,
+//  stops at the first index past stop_after where the lexer is known to
+//  be back in the state it was in for the old codes, so the old codes
+//  from there on are still correct. Returns the index where lexing
+//  stopped, or -1 if it reached a limit before the end of the line. line
+//  must be readable LEX_LOOKAHEAD characters past limit, or be
+//  null-terminated if limit is l_size.
+static int Syntax_Lex(Syntax *syntax, const char *line, int l_size,
+                      HSReader *old, int start, int limit, int stop_after,
+                      LexState *state) {
   // alias for the single line comment delimiter.
   char *cd_single = syntax->comment_delim_single;
-  int cd_single_size = (cd_single != NULL) ? strlen(cd_single) : 0;
+  int cd_single_size = Delim_Size(cd_single);
+  // aliases for the multi-line comment delimiters.
+  char *cd_start = syntax->comment_delim_multi_start;
+  int cd_start_size = Delim_Size(cd_start);
+  char *cd_end = syntax->comment_delim_multi_end;
+  int cd_end_size = Delim_Size(cd_end);
 
-  // alias for keywords array.
-  char **keywords = syntax->keywords;
+  // alias for the compiled keywords.
+  const KeywordTable *keywords = syntax->keyword_table;
+
+  // the old and new codes of the character before i. they are the same
+  //  before start, which isn't lexed again.
+  unsigned char old_prev = (start > 0) ? HS_CodeAt(old, start - 1)
+                                       : HL_NORMAL;
+  unsigned char new_prev = old_prev;
 
-  // track whether the previous character was a separator, in order
-  //  to tell if the current character is part of a new sequence.
-  // initialize to true since the first word is part of a new word.
-  bool prev_sep = true;
-  // true if the current char is part of a string (starts and ends
-  //  with double quotes "")
-  bool in_string = false;
-  // the current string delimiter (either ' or ", or '\0' if not in a string).
-  char str_delim = '\0';
-  
   // set the color codes for the line_display characters.
-  int i = 0;
-  while (i < l_size) {
+  int i = start;
+  while (i < limit) {
+    if (stop_after >= 0 && i > stop_after && state->prev_sep &&
+        !state->in_string && !state->in_comment &&
+        new_prev == HL_NORMAL && old_prev == HL_NORMAL &&
+        Is_Separator(line[i - 1])) {
+      // both the old and the new codes end in a normal separator right
+      //  before i, so both lexers were in the initial state at i and the
+      //  rest of the old codes are unchanged.
+      return i;
+    }
+    if (stop_after >= 0 && i > stop_after && state->in_comment &&
+        old_prev == HL_MLCOMMENT && !Is_MultiDelimChar(syntax, line[i - 1])) {
+      // both lexers took line[i - 1] as a lone character of a multi-line
+      //  comment, so both are inside it at i.
+      return i;
+    }
+
     // alias for the current line character.
     char c = line[i];
     // the type of highlight of the previous character.
-    unsigned char prev_h_char = (i > 0) ? (*h_line)[i - 1] : HL_NORMAL;
+    unsigned char prev_h_char = new_prev;
 
-    if (cd_single_size != 0 && !in_string) {
+    if (cd_single_size != 0 && !state->in_string && !state->in_comment) {
       // syntax specifies comment highlighting, and we're not in a string.
       if (!strncmp(&(line[i]), cd_single, cd_single_size)) {
+        if (stop_after >= 0 && i >= stop_after &&
+            HS_CodeAt(old, i) == HL_COMMENT) {
+          // the old codes already had a comment running from here to the
+          //  end of the line.
+          return i;
+        }
+        if (limit < l_size) {
+          // the rest of the line is out of reach.
+          return -1;
+        }
         // encountered the start of a single line comment, so set the
         //  rest of the line for comment highlighting and break.
-        memset(&((*h_line)[i]), HL_COMMENT, l_size - i);
-        break;
+        HS_BuilderAppend(&lexed, i, l_size - i, HL_COMMENT);
+        return l_size;
       }
     }
 
-    if (syntax->flags & HIGHLIGHT_NUMBERS) {
-      // the syntax specifies number highlighting.
-      if ((isdigit(c) && (prev_sep || prev_h_char == HL_NUMBER)) ||
-          (c == '.' && prev_h_char == HL_NUMBER)) {
-        // in order to be highlighted, a character must be a digit
-        //  and the previous char must be either a separator or
-        //  also highlighted, or a character must be a dot '.'
-        //  and the previous char must be highlighted.
-        (*h_line)[i] = HL_NUMBER;
-        // consume this character.
-        i++;
-        // the just consumed char was not a separator.
-        prev_sep = false;
-        continue;
+    // the number of characters consumed by this iteration and the code
+    //  they get. consume 1 normal character by default.
+    int consumed = 1;
+    unsigned char h_char = HL_NORMAL;
+    bool next_sep = Is_Separator(c);
+    state->eol_escape = false;
+
+    if (state->in_comment) {
+      h_char = HL_MLCOMMENT;
+      if (cd_end_size != 0 && !strncmp(&(line[i]), cd_end, cd_end_size)) {
+        // encountered the end of the comment.
+        consumed = cd_end_size;
+        state->in_comment = false;
+      }
+      next_sep = true;
+    } else if (cd_start_size != 0 && !state->in_string &&
+               !strncmp(&(line[i]), cd_start, cd_start_size)) {
+      // encountered the start of a multi-line comment.
+      consumed = cd_start_size;
+      state->in_comment = true;
+      h_char = HL_MLCOMMENT;
+      next_sep = true;
+    } else if ((syntax->flags & HIGHLIGHT_NUMBERS) &&
+        ((isdigit(c) && (state->prev_sep || prev_h_char == HL_NUMBER)) ||
+         (c == '.' && prev_h_char == HL_NUMBER))) {
+      // in order to be highlighted, a character must be a digit
+      //  and the previous char must be either a separator or
+      //  also highlighted, or a character must be a dot '.'
+      //  and the previous char must be highlighted.
+      h_char = HL_NUMBER;
+      // the just consumed char was not a separator.
+      next_sep = false;
+    } else if ((syntax->flags & HIGHLIGHT_STRINGS) && state->in_string) {
+      h_char = HL_STRING;
+      if (c == '\\' && i + 1 < l_size) {
+        // encountered an escaped character, so consume '\' and the
+        //  escaped char.
+        consumed = 2;
+      } else if (c == '\\') {
+        // the end of the line is escaped, so the string goes on.
+        state->eol_escape = true;
+      } else if (c == state->str_delim) {
+        // encountered the matching delimiter, so we are not in a string.
+        state->str_delim = '\0';
+        state->in_string = false;
+      }
+      // closing quote is a separator.
+      next_sep = true;
+    } else if ((syntax->flags & HIGHLIGHT_STRINGS) && (c == '"' || c == '\'')) {
+      // encountered the start of a string, so save the opening delimiter.
+      state->str_delim = c;
+      state->in_string = true;
+      h_char = HL_STRING;
+      next_sep = state->prev_sep;
+    } else if (state->prev_sep && keywords != NULL) {
+      // keywords need a separator before and after them (\0 EOL counts as
+      //  a separator), so only the token up to the next separator can be
+      //  one. tokens longer than any keyword are not read to their end.
+      int max_size = KW_MaxSize(keywords);
+      int token_size = 0;
+      while (token_size <= max_size && !Is_Separator(line[i + token_size])) {
+        token_size++;
+      }
+      Keyword_t type = KW_Lookup(keywords, &(line[i]), token_size);
+      if (type != KW_NONE) {
+        h_char = (type == KW_TYPE2) ? HL_KEYWORD2 : HL_KEYWORD1;
+        consumed = token_size;
+        next_sep = false;
       }
     }
 
-    if (syntax->flags & HIGHLIGHT_STRINGS) {
-      if (in_string) {
-        (*h_line)[i] = HL_STRING;
-        if (c == '\\' && i + 1 < l_size) {
-          // encountered an escaped character.
-          i += 2;  // consume '\' and the escaped char.
-          continue;
-        }
-        if (c == str_delim) {
-          // encountered the matching delimiter, so we are not in a string.
-          str_delim = '\0';
-          in_string = false;
-        }
-        i++;
-        // closing quote is a separator.
-        prev_sep = true;
-        continue;
-      } {
-        if (c == '"' || c == '\'') {
-          // encountered the start of a string, so save the opening delimiter.
-          str_delim = c;
-          in_string = true;
-          (*h_line)[i] = HL_STRING;
-          i++;
-          continue;
-        }
-      }
+    // remember the last old code being replaced, then set the codes of
+    //  the consumed characters.
+    if (stop_after >= 0) {
+      old_prev = HS_CodeAt(old, i + consumed - 1);
     }
+    HS_BuilderAppend(&lexed, i, consumed, h_char);
+    new_prev = h_char;
+    state->prev_sep = next_sep;
+    i += consumed;
+  }
+  return (limit < l_size) ? -1 : l_size;
+}
 
-    if (prev_sep) {
-      // keywords need a separator before them.
-      int j;  // index into the keywords array.
-      for (j = 0; keywords[j] != NULL; j++) {
-        int keyword_len = strlen(keywords[j]);
-        bool is_type_2 = keywords[j][keyword_len - 1] == '|';
-        if (is_type_2) {
-          // remove the last char if it is a type 2 keyword.
-          keyword_len--;
-        }
+unsigned char Syntax_SetHighlight(Syntax *syntax, const char *line,
+                                  int l_size, HLSpans **h_line,
+                                  unsigned char lex_in, Arena *arena) {
+  HS_BuilderClear(&lexed);
+  if (syntax == NULL) {
+    // no syntax specified for the file, so set all highlighting
+    //  to default.
+    HS_Replace(h_line, 0, INT_MAX, NULL, 0, arena);
+    return LEX_NORMAL;
+  }
+  LexState state = Lex_Enter(lex_in);
+  HSReader old;
+  HS_ReaderInit(&old, NULL, 0);
+  Syntax_Lex(syntax, line, l_size, &old, 0, l_size, -1, &state);
+  HS_Replace(h_line, 0, INT_MAX, lexed.spans, lexed.num_spans, arena);
+  return Lex_Exit(&state);
+}
 
-        if (!strncmp(&(line[i]), keywords[j], keyword_len) &&
-            Is_Separator(line[i + keyword_len])) {
-          // check if the current keyword exists at this point int the line,
-          //  and that it is followed by a separator (\0 EOL counts as a separator).
-          // unsigned char keyword_type = (is_type_2) ? HL_KEYWORD2 : HL_KEYWORD1;
-          memset(&((*h_line)[i]), (is_type_2) ? HL_KEYWORD2 : HL_KEYWORD1, keyword_len);
-          i += keyword_len;
-          break;
-        }
-      }
+unsigned char Syntax_ScanState(Syntax *syntax, const char *text, int size,
+                               unsigned char lex_in) {
+  if (syntax == NULL) {
+    return LEX_NORMAL;
+  }
+  char *cd_single = syntax->comment_delim_single;
+  int cd_single_size = Delim_Size(cd_single);
+  char *cd_start = syntax->comment_delim_multi_start;
+  int cd_start_size = Delim_Size(cd_start);
+  char *cd_end = syntax->comment_delim_multi_end;
+  int cd_end_size = Delim_Size(cd_end);
 
-      if (keywords[j] != NULL) {
-        // encountered a keyword in the above loop.
-        prev_sep = false;
-        continue;
+  // follow the lexer through comments and strings only. keywords and
+  //  numbers never hold their delimiters, so they can't change the state.
+  LexState state = Lex_Enter(lex_in);
+  int i = 0;
+  while (i < size) {
+    char c = text[i];
+    state.eol_escape = false;
+    if (state.in_comment) {
+      if (cd_end_size != 0 && cd_end_size <= size - i &&
+          !memcmp(&(text[i]), cd_end, cd_end_size)) {
+        state.in_comment = false;
+        i += cd_end_size;
+      } else {
+        i++;
       }
+    } else if ((syntax->flags & HIGHLIGHT_STRINGS) && state.in_string) {
+      if (c == '\\' && i + 1 < size) {
+        i++;
+      } else if (c == '\\') {
+        state.eol_escape = true;
+      } else if (c == state.str_delim) {
+        state.in_string = false;
+      }
+      i++;
+    } else if (cd_single_size != 0 && cd_single_size <= size - i &&
+               !memcmp(&(text[i]), cd_single, cd_single_size)) {
+      // the rest of the line is a comment.
+      return LEX_NORMAL;
+    } else if (cd_start_size != 0 && cd_start_size <= size - i &&
+               !memcmp(&(text[i]), cd_start, cd_start_size)) {
+      state.in_comment = true;
+      i += cd_start_size;
+    } else {
+      if ((syntax->flags & HIGHLIGHT_STRINGS) && (c == '"' || c == '\'')) {
+        state.in_string = true;
+        state.str_delim = c;
+      }
+      i++;
+    }
+  }
+  return Lex_Exit(&state);
+}
+
+int Syntax_UpdateHighlight(Syntax *syntax, const char *line, int l_size,
+                           HLSpans **h_line, int start, int stop_after,
+                           int limit, unsigned char lex_in,
+                           unsigned char *lex_out, Arena *arena) {
+  if (syntax == NULL) {
+    HS_Replace(h_line, start, stop_after, NULL, 0, arena);
+    return stop_after;
+  }
+
+  // a comment delimiter ending at start may have been completed by the
+  //  edit, so begin lexing at least that far back.
+  int delim_size = Delim_Size(syntax->comment_delim_single);
+  if (Delim_Size(syntax->comment_delim_multi_start) > delim_size) {
+    delim_size = Delim_Size(syntax->comment_delim_multi_start);
+  }
+  if (Delim_Size(syntax->comment_delim_multi_end) > delim_size) {
+    delim_size = Delim_Size(syntax->comment_delim_multi_end);
+  }
+  int restart = start - ((delim_size > 1) ? delim_size - 1 : 0);
+  if (restart < 0) {
+    restart = 0;
+  }
+  // back up to the start of the enclosing token: the nearest point after
+  //  a normal separator, where the lexer is known to be in its initial
+  //  state, or after a lone character of a multi-line comment, where it
+  //  is known to be inside the comment. keywords and numbers only look
+  //  back to that point. at the start of the line, it is in lex_in.
+  LexState state = Lex_Enter(lex_in);
+  HSReader old;
+  HS_ReaderInit(&old, *h_line, restart);
+  while (restart > 0) {
+    unsigned char prev_h = HS_CodeAt(&old, restart - 1);
+    if (prev_h == HL_NORMAL && Is_Separator(line[restart - 1])) {
+      state = LEX_STATE_INIT;
+      break;
     }
+    if (prev_h == HL_MLCOMMENT &&
+        !Is_MultiDelimChar(syntax, line[restart - 1])) {
+      state = LEX_STATE_INIT;
+      state.in_comment = true;
+      break;
+    }
+    restart--;
+  }
 
-    prev_sep = Is_Separator(c);
-    i++;
+  HS_BuilderClear(&lexed);
+  int end = Syntax_Lex(syntax, line, l_size, &old, restart, limit,
+                       stop_after, &state);
+  if (end < 0) {
+    // leave the old codes for lexing further.
+    return end;
   }
+  HS_Replace(h_line, restart, end, lexed.spans, lexed.num_spans, arena);
+  if (end == l_size) {
+    *lex_out = Lex_Exit(&state);
+  }
+  return end;
 }
 
 void Syntax_LangFromFile(const char *file_name, Syntax **syntax) {
@@ -212,7 +439,11 @@ void Syntax_LangFromFile(const char *file_name, Syntax **syntax) {
       //  match only if the pattern appears anywhere in the file_name.
       if ((is_ext && ext != NULL && strcmp(ext, (*syntax)->extensions[j]) == 0) ||
           (!is_ext && strstr(file_name, (*syntax)->extensions[j]))) {
-        // a match was found. the output parameter was already set, so return.
+        // a match was found. the output parameter was already set, so
+        //  compile its keywords if this is the first time it's used.
+        if ((*syntax)->keyword_table == NULL) {
+          (*syntax)->keyword_table = KW_Compile((*syntax)->keywords);
+        }
         return;
       }
     }
@@ -6,6 +6,13 @@
 
 #include <stdint.h>  // for standard int types
 
+#include "HLSpans.h"
+#include "Keywords.h"
+
+// the number of characters past the current one the lexer may read.
+//  keywords and comment delimiters must be shorter than this.
+#define LEX_LOOKAHEAD 32
+
 // bit flags to define what char sequences should be highlighted.
 #define HIGHLIGHT_NUMBERS (1<<0)
 #define HIGHLIGHT_STRINGS (1<<1)
@@ -18,26 +25,49 @@ typedef struct {
   // the delimiter for a single line comment in this language. set
   //  to NULL or "" for no single line comment highlighting.
   char *comment_delim_single;
-  // a list of keyword strings. type 2 keywords end in a pipe '|' symbol
+  // the delimiters opening and closing a comment that may span several
+  //  lines. set to NULL or "" for no multi-line comment highlighting.
+  char *comment_delim_multi_start;
+  char *comment_delim_multi_end;
+  // a list of keyword strings. type 2 keywords end in a pipe '|' symbol.
+  //  keywords must not contain separators.
   char **keywords;
   // a collection of flags for this syntax describing what
   //  char sequences should be highlighted.
   int32_t flags;
+  // keywords compiled into a hash table when the syntax is first chosen
+  //  by Syntax_LangFromFile. leave NULL.
+  KeywordTable *keyword_table;
 } Syntax;
 
 // the codes representing color types for syntax highlighting.
-//  these define the values a FileLine's highligh array
+//  these define the codes a FileLine's highlight spans
 //  can contain.
 typedef enum {
   HL_NORMAL = 0,
   HL_NUMBER,
   HL_STRING,
   HL_COMMENT,
+  // a comment between multi-line comment delimiters.
+  HL_MLCOMMENT,
   HL_KEYWORD1,
   HL_KEYWORD2,
   HL_MATCH,
 } Highlight_t;
 
+// the state of the lexer at the start or end of a line, which is all
+//  that carries over from one line to the next.
+typedef enum {
+  // not lexed yet.
+  LEX_UNKNOWN = 0,
+  LEX_NORMAL,
+  // inside a multi-line comment.
+  LEX_COMMENT,
+  // inside a string continued onto the next line by a trailing '\'.
+  LEX_STRING_DOUBLE,
+  LEX_STRING_SINGLE,
+} LexLine_t;
+
 // Identifies the syntax of the given file_name based
 //  on its extension. Only identifies a language if it exists
 //  in the list of specified languages. Sets the fields
@@ -45,11 +75,38 @@ typedef enum {
 //  or sets it to NULL otherwise.
 void Syntax_LangFromFile(const char *file_name, Syntax **syntax);
 
-// puts the highlighting codes for the characters in the
-//  given line (length l_size) into the given h_line 
-//  according to the given syntax.
-void Syntax_SetHighlight(Syntax *syntax, char *line,
-                         int l_size, unsigned char **h_line);
+// sets the highlighting spans for the characters in the
+//  given line (length l_size) in the given h_line 
+//  according to the given syntax, starting in lexer state lex_in
+//  (LEX_UNKNOWN is taken as LEX_NORMAL). the spans are allocated from
+//  arena, and line must be null-terminated. Returns the lexer
+//  state at the end of the line.
+unsigned char Syntax_SetHighlight(Syntax *syntax, const char *line,
+                                  int l_size, HLSpans **h_line,
+                                  unsigned char lex_in, Arena *arena);
+
+// Returns the lexer state at the end of the size characters of text when
+//  starting in state lex_in, without highlighting them. text need not be
+//  null-terminated.
+unsigned char Syntax_ScanState(Syntax *syntax, const char *text, int size,
+                               unsigned char lex_in);
+
+// Updates the highlighting spans in h_line after the characters of line
+//  in [start, stop_after) were replaced and the spans of the characters
+//  after them were shifted to their new positions (see HS_Edit).
+//  Re-lexes from the start of the token containing start, and stops as
+//  soon as the lexer is back in sync with the old codes past stop_after.
+//  Only characters before limit are lexed; line must be readable
+//  LEX_LOOKAHEAD characters past limit, or be null-terminated if limit is
+//  l_size. The line starts in lexer state lex_in. Returns the index where
+//  re-lexing stopped, or -1, leaving h_line unchanged, if it reached
+//  limit first. If it stopped at the end of the line, sets lex_out to the
+//  lexer state there; otherwise that state is unchanged. Spans are
+//  allocated from arena.
+int Syntax_UpdateHighlight(Syntax *syntax, const char *line, int l_size,
+                           HLSpans **h_line, int start, int stop_after,
+                           int limit, unsigned char lex_in,
+                           unsigned char *lex_out, Arena *arena);
 
 int File_GetHighlightCode(unsigned char h);
 
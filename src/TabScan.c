@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <string.h>  // for memcpy, memset
+
+#include "TabScan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TS_X86
+#endif
+
+// a single tab character.
+#define TAB '\t'
+// the character tabs are replaced with.
+#define SPACE_CHAR ' '
+
+// a function returning the mask of the tabs in the TS_BLOCK bytes of
+//  block: bit i is set if block[i] is a tab.
+typedef uint64_t (*TSMaskFn)(const char *block);
+
+// Returns the mask of the tabs in the size (at most TS_BLOCK) bytes of
+//  block, one byte at a time.
+static uint64_t TS_TabMaskScalar(const char *block, int size) {
+  uint64_t mask = 0;
+  for (int i = 0; i < size; i++) {
+    mask |= (uint64_t) (block[i] == TAB) << i;
+  }
+  return mask;
+}
+
+// The TSMaskFn used where no vector instructions are available.
+static uint64_t TS_TabMaskPlain(const char *block) {
+  return TS_TabMaskScalar(block, TS_BLOCK);
+}
+
+#ifdef TS_X86
+// The TSMaskFn for CPUs with SSE2, comparing 16 bytes at a time.
+__attribute__((target("sse2")))
+static uint64_t TS_TabMaskSSE2(const char *block) {
+  const __m128i tabs = _mm_set1_epi8(TAB);
+  uint64_t mask = 0;
+  for (int i = 0; i < TS_BLOCK; i += 16) {
+    __m128i chars = _mm_loadu_si128((const __m128i *) &(block[i]));
+    uint32_t bits = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, tabs));
+    mask |= (uint64_t) bits << i;
+  }
+  return mask;
+}
+
+// The TSMaskFn for CPUs with AVX2, comparing 32 bytes at a time.
+__attribute__((target("avx2")))
+static uint64_t TS_TabMaskAVX2(const char *block) {
+  const __m256i tabs = _mm256_set1_epi8(TAB);
+  __m256i low = _mm256_loadu_si256((const __m256i *) block);
+  __m256i high = _mm256_loadu_si256((const __m256i *) &(block[32]));
+  uint32_t low_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, tabs));
+  uint32_t high_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, tabs));
+  return (uint64_t) high_bits << 32 | low_bits;
+}
+#endif
+
+// Returns the best TSMaskFn for this CPU.
+static TSMaskFn TS_Resolve(void) {
+#ifdef TS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return TS_TabMaskAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return TS_TabMaskSSE2;
+  }
+#endif
+  return TS_TabMaskPlain;
+}
+
+static uint64_t TS_TabMaskFirst(const char *block);
+
+// the TSMaskFn in use. starts out as one that picks it on the first call.
+static TSMaskFn tab_mask = TS_TabMaskFirst;
+
+// The TSMaskFn used until the CPU has been checked.
+static uint64_t TS_TabMaskFirst(const char *block) {
+  tab_mask = TS_Resolve();
+  return tab_mask(block);
+}
+
+// Returns the mask of the tabs in the block of size (at most TS_BLOCK)
+//  bytes starting at block.
+static uint64_t TS_TabMask(const char *block, int size) {
+  return (size == TS_BLOCK) ? tab_mask(block) :
+                              TS_TabMaskScalar(block, size);
+}
+
+// Returns the number of display columns taken by a tab at column col.
+static int TS_TabWidth(int col) {
+  return TS_TAB_SIZE - (col % TS_TAB_SIZE);
+}
+
+int TS_Expand(const char *str, int size, int col, char *disp) {
+  for (int i = 0; i < size; i += TS_BLOCK) {
+    int block_size = (size - i < TS_BLOCK) ? size - i : TS_BLOCK;
+    uint64_t mask = TS_TabMask(&(str[i]), block_size);
+    // the start of the run of characters before the next tab.
+    int run = i;
+    while (mask != 0) {
+      int tab = i + __builtin_ctzll(mask);
+      mask &= mask - 1;
+      if (disp != NULL) {
+        memcpy(&(disp[col]), &(str[run]), tab - run);
+      }
+      col += tab - run;
+      int width = TS_TabWidth(col);
+      if (disp != NULL) {
+        // replace the tab with spaces.
+        memset(&(disp[col]), SPACE_CHAR, width);
+      }
+      col += width;
+      run = tab + 1;
+    }
+    int run_end = i + block_size;
+    if (disp != NULL) {
+      memcpy(&(disp[col]), &(str[run]), run_end - run);
+    }
+    col += run_end - run;
+  }
+  return col;
+}
+
+int TS_CountTabs(const char *str, int size) {
+  int count = 0;
+  for (int i = 0; i < size; i += TS_BLOCK) {
+    int block_size = (size - i < TS_BLOCK) ? size - i : TS_BLOCK;
+    count += __builtin_popcountll(TS_TabMask(&(str[i]), block_size));
+  }
+  return count;
+}
+
+int TS_IndexOfColumn(const char *str, int size, int *col, int target) {
+  int cur_col = *col;
+  for (int i = 0; i < size; i += TS_BLOCK) {
+    int block_size = (size - i < TS_BLOCK) ? size - i : TS_BLOCK;
+    uint64_t mask = TS_TabMask(&(str[i]), block_size);
+    int run = i;
+    while (mask != 0) {
+      int tab = i + __builtin_ctzll(mask);
+      mask &= mask - 1;
+      if (target < cur_col + (tab - run)) {
+        // target is in the run of single-column characters.
+        *col = target;
+        return run + (target - cur_col);
+      }
+      cur_col += tab - run;
+      int width = TS_TabWidth(cur_col);
+      if (target < cur_col + width) {
+        // target is one of the tab's columns.
+        *col = cur_col;
+        return tab;
+      }
+      cur_col += width;
+      run = tab + 1;
+    }
+    int run_end = i + block_size;
+    if (target < cur_col + (run_end - run)) {
+      *col = target;
+      return run + (target - cur_col);
+    }
+    cur_col += run_end - run;
+  }
+  *col = cur_col;
+  return size;
+}
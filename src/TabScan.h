@@ -0,0 +1,32 @@
+#ifndef TAB_SCAN_H_
+#define TAB_SCAN_H_
+
+// Tab expansion and conversions between raw and display columns. Text
+//  is scanned for tabs a block of TS_BLOCK bytes at a time with the
+//  widest vector instructions the CPU supports (AVX2 or SSE2 on x86,
+//  chosen when first used), falling back to plain C elsewhere. The runs
+//  of text between tabs are then copied or skipped over whole, so long
+//  lines are handled at about the speed of memcpy.
+
+// the size of a single tab character in number of spaces (" ").
+#define TS_TAB_SIZE 8
+// the number of bytes scanned for tabs at once.
+#define TS_BLOCK 64
+
+// Expands size raw characters from str for display starting at display
+//  column col, writing them into disp unless it is NULL. Tabs reach the
+//  next column divisible by TS_TAB_SIZE and are replaced with spaces.
+//  Returns the display column after the expanded characters.
+int TS_Expand(const char *str, int size, int col, char *disp);
+
+// Returns the number of tabs in the size characters of str.
+int TS_CountTabs(const char *str, int size);
+
+// Returns the index of the first of the size characters of str whose
+//  display columns, with str starting at display column *col, include
+//  column target, and sets *col to that character's first column. If no
+//  character does, returns size and sets *col to the column after str.
+//  target must be at least *col.
+int TS_IndexOfColumn(const char *str, int size, int *col, int target);
+
+#endif  // TAB_SCAN_H_
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <termios.h>  // for terminal control
 #include <stdlib.h>   // for exit codes, atexit
 #include <unistd.h>   // for std fd's
@@ -5,10 +7,18 @@
 #include <sys/ioctl.h>  // for ioctl, winsize
 #include <stdio.h>
 #include <ctype.h>
+#include <poll.h>     // for poll
+#include <string.h>   // for strstr
 
 #include "Quit.h"
 #include "IOUtils.h"
 #include "TerminalUtils.h"
+#include "ESCCommands.h"
+
+// the size of the buffer for the answers to Term_QueryMode.
+#define BUF_SIZE_REPLY 64
+// how long to wait for each byte of an answer from the terminal.
+#define REPLY_TIMEOUT_MS 100
 
 // static global variables.
 
@@ -41,12 +51,13 @@ void Term_SetRawMode(struct termios *og_termios) {
   // with BRKINT, INPCK, ISTRIP, originally used to set things
   //  on old terminals; probably unecessary now.
   term_attr.c_cflag |= (CS8);
-  // set timeout for POSIX read to return.
+  // have POSIX read return at once with whatever input is available,
+  //  even none. input is waited for with poll instead (see EventLoop.h),
+  //  so the editor doesn't wake up while idle.
   // min input bytes for read to return.
   term_attr.c_cc[VMIN] = 0;
   // max time to wait for input before read returns.
-  // units are 1/10 sec.
-  term_attr.c_cc[VTIME] = 1;
+  term_attr.c_cc[VTIME] = 0;
 
   // set the termios settings.
   SetAttr(STDIN_FILENO, TCSAFLUSH, &term_attr);
@@ -76,6 +87,64 @@ int Term_Size(int *rows, int *cols) {
   }
 }
 
+// Writes query followed by a request for the device attributes (DA1),
+//  and reads the answers into the BUF_SIZE_REPLY bytes of buf as a
+//  string. Every terminal answers DA1, so one that ignores query isn't
+//  waited on past the end of that answer. Returns false if the query
+//  couldn't be written.
+static bool Term_Ask(const char *query, char *buf) {
+  char request[BUF_SIZE_REPLY];
+  int size = snprintf(request, sizeof(request), "%s\x1b[c", query);
+  if (WrappedWrite(STDOUT_FILENO, (const unsigned char *) request, size) !=
+      size) {
+    return false;
+  }
+  // read up to the end of the DA1 answer, "<esc>[?...c".
+  int i = 0;
+  while (i < BUF_SIZE_REPLY - 1) {
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) break;
+    if (WrappedRead(STDIN_FILENO, &buf[i], 1) != 1) break;
+    if (buf[i++] == 'c') break;
+  }
+  buf[i] = '\0';
+  return true;
+}
+
+TermMode_t Term_QueryMode(int mode) {
+  // ask for the mode (DECRQM).
+  char query[BUF_SIZE_REPLY];
+  char buf[BUF_SIZE_REPLY];
+  snprintf(query, sizeof(query), "\x1b[?%d$p", mode);
+  if (!Term_Ask(query, buf)) {
+    return TERM_MODE_UNKNOWN;
+  }
+
+  // the DECRQM answer (DECRPM) is "<esc>[?<mode>;<state>$y".
+  for (char *reply = strstr(buf, "\x1b[?"); reply != NULL;
+       reply = strstr(reply + 1, "\x1b[?")) {
+    int reply_mode, state;
+    char final[3];
+    if (sscanf(&reply[3], "%d;%d%2[$y]", &reply_mode, &state, final) == 3 &&
+        reply_mode == mode && final[0] == '$' && final[1] == 'y' &&
+        state > TERM_MODE_UNKNOWN && state <= TERM_MODE_ALWAYS_RESET) {
+      return state;
+    }
+  }
+  return TERM_MODE_UNKNOWN;
+}
+
+bool Term_AnswersStatus(void) {
+  char buf[BUF_SIZE_REPLY];
+  return Term_Ask(ESC_CMD_STATUS_REPORT, buf) &&
+         strstr(buf, TERM_STATUS_OK) != NULL;
+}
+
+bool Term_OutputBlocked(void) {
+  struct pollfd pfd = {STDOUT_FILENO, POLLOUT, 0};
+  return poll(&pfd, 1, 0) == 0;
+}
+
 static int Term_CurorPosition(int *row, int *col) {
   // we get the result of an n escape sequence through stdin
   //  and store it in a buffer. result form: "<esc>[<col>;<row>R"
@@ -87,6 +156,9 @@ static int Term_CurorPosition(int *row, int *col) {
   if (res != 4) return -1;
 
   while (i < sizeof(buf) - 1) {
+    // give the terminal up to a tenth of a second for each byte.
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, 100) <= 0) break;
     if (WrappedRead(STDIN_FILENO, &buf[i], 1) != 1) break;
     if (buf[i] == 'R') break;
     i++;
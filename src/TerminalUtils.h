@@ -1,6 +1,24 @@
 #ifndef TERMINAL_UTILS_H_
 #define TERMINAL_UTILS_H_
 
+#include <stdbool.h>
+#include <termios.h>  // for struct termios
+
+// the DEC private mode of synchronized updates (see ESC_CMD_SYNC_MODE).
+#define TERM_MODE_SYNC 2026
+
+// the terminal's answer to a device status request when all is well.
+#define TERM_STATUS_OK "\x1b[0n"
+
+// the states of a DEC private mode reported by Term_QueryMode.
+typedef enum {
+  TERM_MODE_UNKNOWN = 0,  // the terminal doesn't know the mode.
+  TERM_MODE_SET,
+  TERM_MODE_RESET,
+  TERM_MODE_ALWAYS_SET,
+  TERM_MODE_ALWAYS_RESET
+} TermMode_t;
+
 // Saves the original termios struct in the given location
 //  before setting the terminal to raw mode.
 void Term_SetRawMode(struct termios *og_termios);
@@ -12,4 +30,19 @@ void Term_UnSetRawMode(struct termios *og_termios);
 // Get the size of the window.
 int Term_Size(int *rows, int *cols);
 
+// Asks the terminal for the state of DEC private mode mode. Returns
+//  TERM_MODE_UNKNOWN if the terminal doesn't know it or doesn't answer.
+//  Must be called in raw mode, before any input is read, as the answer
+//  comes through stdin.
+TermMode_t Term_QueryMode(int mode);
+
+// Returns true if the terminal answers device status requests (see
+//  ESC_CMD_STATUS_REPORT). Must be called in raw mode, before any input
+//  is read.
+bool Term_AnswersStatus(void);
+
+// Returns true if writing to stdout would block, as the terminal (or the
+//  link to it) has not taken in what was written before.
+bool Term_OutputBlocked(void);
+
 #endif  // TERMINAL_UTILS_H_
@@ -6,28 +6,52 @@
 
 #include "WriteBuffer.h"
 
+// the capacity first allocated for a buffer.
+#define WB_MIN_CAPACITY 1024
+
 void WB_AppendESCCmd(Buffer *wbuf, char *cmd) {
   WB_Append(wbuf, cmd, strlen((const char *) cmd));
 }
 
 void WB_Append(Buffer *wbuf, char *str, int size) {
-  // allocate an expanced buffer for the new characters.
-  unsigned char *expanded = realloc(wbuf->buffer, wbuf->size + size);
-
-  if (expanded == NULL) {
+  char *dest = WB_Extend(wbuf, size);
+  if (dest == NULL) {
     // realloc failed.
     return;
   }
+  // copy the new characters to the end of the buffer.
+  memcpy(dest, str, size);
+}
 
-  // copy the new characters to the end of the new buffer location.
-  memcpy(&expanded[wbuf->size], str, size);
-  // update the Buffer metadata.
-  wbuf->buffer = expanded;
+char *WB_Extend(Buffer *wbuf, int size) {
+  if (wbuf->size + size > wbuf->capacity) {
+    int capacity = (wbuf->capacity == 0) ? WB_MIN_CAPACITY
+                                         : wbuf->capacity;
+    while (capacity < wbuf->size + size) {
+      capacity *= 2;
+    }
+    // allocate an expanded buffer for the new characters.
+    unsigned char *expanded = realloc(wbuf->buffer, capacity);
+    if (expanded == NULL) {
+      return NULL;
+    }
+    wbuf->buffer = expanded;
+    wbuf->capacity = capacity;
+  }
+  char *dest = (char *) &(wbuf->buffer[wbuf->size]);
   wbuf->size += size;
+  return dest;
+}
+
+void WB_Clear(Buffer *wbuf) {
+  wbuf->size = 0;
 }
 
 void WB_Free(Buffer *wbuf) {
   free(wbuf->buffer);
+  wbuf->buffer = NULL;
+  wbuf->size = 0;
+  wbuf->capacity = 0;
 }
 
 void WB_Write(Buffer *buf) {
@@ -6,21 +6,33 @@ typedef struct buf {
   unsigned char *buffer;
   // size of the buffer.
   int size;
+  // the number of bytes allocated for the buffer.
+  int capacity;
 } Buffer;
 
-#define EMPTY_BUF {NULL, 0}
+#define EMPTY_BUF {NULL, 0, 0}
 
 // void WB_AppendCmd(Buffer *buf, unsigned char *str);
 
 // Appends the given sequence of characters (str) of size 'size'
 //  to the end of the given Buffer struct. Updates its size and 
-//  realloc's the buffer if needed. Caller must free the buffer
-//  allocated at some time after the first call to WB_Append.
+//  realloc's the buffer if needed, doubling its capacity so a buffer
+//  grown to size n was only realloc'd about log(n) times. Caller must
+//  free the buffer allocated at some time after the first call to
+//  WB_Append.
 void WB_Append(Buffer *buf, char *str, int size);
 
+// Adds size bytes to the end of buf and returns a pointer to the first,
+//  for the caller to fill in. Returns NULL, leaving buf as it was, if
+//  the buffer couldn't be grown.
+char *WB_Extend(Buffer *buf, int size);
+
 // Append the given escape command.
 void WB_AppendESCCmd(Buffer *wbuf, char *cmd);
 
+// Empties buf, keeping its allocation for appending to again.
+void WB_Clear(Buffer *buf);
+
 // Frees a Buffer struct's heap allocated buffer.
 void WB_Free(Buffer *buf);
 
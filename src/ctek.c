@@ -4,6 +4,8 @@
 #include <stdio.h>  // for perror
 
 #include "Editor.h"
+#include "Keyboard.h"
+#include "EventLoop.h"
 #include "Quit.h"
 
 // static helper functions.
@@ -23,7 +25,13 @@ int main(int argc, char const *argv[]) {
 
   while (1) {
     Editor_Refresh();
-    Editor_InterpretKeypress();
+    // sleep until there is input or a timer is due (e.g., to hide the
+    //  message), then apply every key that has arrived before drawing
+    //  the next frame, so a burst of input (e.g., a paste) is drawn once.
+    Loop_RunOnce(-1);
+    while (Keyboard_KeyPending()) {
+      Editor_InterpretKeypress();
+    }
   }
   return EXIT_SUCCESS;
 }